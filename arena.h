@@ -0,0 +1,76 @@
+//SRAM arena. Playing an xsvf or pin vectors, receiving an upload, sampling
+//the boundary register and bridging JTAG for a host never happen at the
+//same time, so their buffers share this one static block instead of each
+//having its own on the stack or in .bss. Every phase has a struct here and
+//only the code of that phase touches it; the arena is as big as the biggest
+//phase.
+
+#define ARENA_SIZE 256 //Budget; the build fails if a phase needs more
+
+//Playing, see xsvf.c, unpack.c, vector.c and stream.c
+#define MAXTDOBYTES 176 //Bytes the AVR is able to shift out
+#define MAXTDIBYTES 8 //Bytes the AVR is able to check against clocked in bytes.
+#define CACHESIZE 32 //Flash cache line, needs to be power of 2
+#define VECTOR_CHUNK 256 //Vector bytes read at a time, see vector.c; has to be 256
+#define STREAM_CHUNK (2*CACHESIZE) //Bytes of a streamed xsvf received at a time, see stream.c
+
+//Uploading, see xmodem.c and lz.c. Windowed uploads keep their frames in
+//arena.window, which overlaps arena.upload.lz.
+#define XMODEM_BLOCK 128
+#define LZ_CHUNK 128 //has to divide the flash page size
+#define WINDOW_BLOCK 64 //Frame size of windowed uploads; has to divide the page size
+#define WINDOW_FRAMES (ARENA_SIZE/WINDOW_BLOCK) //Has to be a power of 2
+#define WINDOW_FRAMES_LZ (XMODEM_BLOCK/WINDOW_BLOCK) //The ones before arena.upload.lz
+#if (WINDOW_FRAMES & (WINDOW_FRAMES-1))
+#error "WINDOW_FRAMES has to be a power of 2, change ARENA_SIZE or WINDOW_BLOCK"
+#endif
+
+//Sampling, see sample.c
+#define MAXBSBYTES 64 //Longest boundary register we can handle, in bytes
+#define SAMPLE_BUFSIZE 192 //Captures get batched here before being sent
+
+//Bridging, see bridge.c
+#define BRIDGE_BUF 256 //Bytes of commands in a batch; their TDO replaces them
+
+typedef struct {
+	unsigned char tdi[MAXTDOBYTES];
+	unsigned char tdo[MAXTDIBYTES];
+	unsigned char mask[MAXTDIBYTES];
+	union {
+		unsigned char cache[2][CACHESIZE];
+		unsigned char chunk[STREAM_CHUNK]; //streamed xsvfs don't come from the flash
+	};
+} ArenaPlay;
+
+typedef struct {
+	unsigned char chunk[VECTOR_CHUNK];
+} ArenaVector;
+
+typedef struct {
+	unsigned char block[XMODEM_BLOCK];
+	unsigned char lz[LZ_CHUNK];
+} ArenaUpload;
+
+typedef struct {
+	unsigned char frame[WINDOW_FRAMES][WINDOW_BLOCK];
+} ArenaWindow;
+
+typedef struct {
+	unsigned char buff[SAMPLE_BUFSIZE];
+	unsigned char prev[MAXBSBYTES];
+} ArenaSample;
+
+typedef struct {
+	unsigned char buf[BRIDGE_BUF];
+} ArenaBridge;
+
+typedef union {
+	ArenaPlay play;
+	ArenaVector vector;
+	ArenaUpload upload;
+	ArenaWindow window;
+	ArenaSample sample;
+	ArenaBridge bridge;
+} Arena;
+
+extern Arena arena;
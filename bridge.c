@@ -0,0 +1,248 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Turns the board into a JTAG cable for a host: it sends batches of commands,
+we run them on the chain and send the TDO back. emu/xvcd.c uses this to
+offer the chain to a debugger as a Xilinx Virtual Cable. Started with 'j' in
+xmodem mode.
+
+JTAG and the UART share pins, so like in stream.c, a batch is received
+whole, then run, and only then is the UART back for the answer. The more
+commands in a batch, the fewer of these switches. Commands, n being a 16-bit
+bitcount, lsb first, and the bits packed lsb first:
+BRIDGE_TMS n tms[]: clock n bits with these TMS values.
+BRIDGE_SHIFT|flags n tdi[]: shift n bits in Shift-DR or Shift-IR. With
+BRIDGE_EXIT, TMS goes high on the last bit. With BRIDGE_TDO, the TDO bits are
+sent back.
+BRIDGE_RUN|flags n: clock n times, TMS high with BRIDGE_EXIT; for Run-Test/Idle.
+
+Between batches the UART toggles TCK with TMS as it was, so the TAP has to
+be parked where that does nothing: Run-Test/Idle, a Pause state or
+Test-Logic-Reset. Hosts have to end a batch there, in a Shift state after a
+shift or in an Exit1 state after a shift with BRIDGE_EXIT. For the last two,
+the last bit gets shifted with TMS high like xsvfPark() does and the TAP
+waits in Pause; the next batch picks up as if it never left.
+
+We ask for batch n (mod 256) with 0xFF 'J' n ~n. The host sends 'B' n lenL
+lenH cmds[len] sum, sum being the 8-bit sum of everything from n on. After
+running it, we answer with 0xFF 'R' n ~n ok lenL lenH tdo[len] sum, ok being
+0 if a command wasn't possible in the state the TAP was in, and wait for
+batch n+1. 'A' sends the last answer again, 'T' us sets the TCK delay of
+ioJtagSetDelay() (answered with 0xFF 'T' us ~us) and 'Q' stops bridging.
+*/
+
+#include <stdio.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include "io.h"
+#include "jtag.h"
+#include "swuart.h"
+#include "arena.h"
+#include "bridge.h"
+
+#define SYNC 0xff
+#define ASKTIME 10000 //100us ticks to wait for a batch before asking again
+#define BYTETIME 200 //100us ticks to wait for the next byte of a batch
+#define NOWHERE 0xff
+
+//Where the host thinks the TAP is, if we parked it somewhere else.
+static unsigned char virt;
+
+//Receive a byte, or return -1 after ticks*100us.
+static int getTimed(unsigned int ticks) {
+	while (ticks--) {
+		if (swUartHasRecved()) return getchar()&0xff;
+		wdt_reset();
+		_delay_us(100);
+	}
+	return -1;
+}
+
+static void sendHeader(unsigned char type, unsigned char n) {
+	swUartXmit(SYNC);
+	swUartXmit(type);
+	swUartXmit(n);
+	swUartXmit(~n);
+}
+
+//TMS for the host. From a parked Exit1, TMS high is Pause-xR -> Exit2-xR ->
+//Update-xR, low is staying in Pause.
+static void clockTms(unsigned char tms) {
+	unsigned char s=virt;
+	virt=NOWHERE;
+	if (s==JTAG_EXIT1DR) {
+		if (tms) jtagGotoState(JTAG_UPDATEDR);
+	} else if (s==JTAG_EXIT1IR) {
+		if (tms) jtagGotoState(JTAG_UPDATEUR);
+	} else {
+		jtagClockTms(1, tms);
+	}
+}
+
+static void park(void) {
+	unsigned char s=jtagGetState();
+	if (s==JTAG_EXIT1DR || s==JTAG_EXIT1IR) {
+		if (virt==NOWHERE) virt=s;
+		jtagGotoState(s+1); //the Pause state
+	}
+}
+
+//Runs the len bytes of commands in buf. Their TDO goes to the start of buf,
+//which works out as a command takes more bytes than its TDO. Returns the
+//bytes of TDO, with 0x8000 set if something wasn't possible.
+static unsigned int run(unsigned char *buf, unsigned int len) {
+	unsigned char *r=buf, *w=buf;
+	unsigned char cmd, d, bits, exit, s;
+	unsigned int n, bad=0;
+	if (virt==JTAG_SHIFTDR || virt==JTAG_SHIFTIR) {
+		jtagGotoState(virt);
+		virt=NOWHERE;
+	}
+	while (r+3<=buf+len) {
+		cmd=r[0];
+		n=r[1]|(r[2]<<8);
+		r+=3;
+		//The bits of TMS and SHIFT have to be in the batch.
+		if (((cmd&BRIDGE_CMD)==BRIDGE_TMS || (cmd&BRIDGE_CMD)==BRIDGE_SHIFT) &&
+				((n+7)>>3)>(unsigned int)(buf+len-r)) {
+			bad=0x8000;
+			break;
+		}
+		if ((cmd&BRIDGE_CMD)==BRIDGE_RUN) {
+			while (n--) {
+				wdt_reset();
+				clockTms(cmd&BRIDGE_EXIT);
+			}
+		} else if ((cmd&BRIDGE_CMD)==BRIDGE_TMS) {
+			for (bits=0; n; n--) {
+				clockTms((*r>>bits)&1);
+				if (++bits==8) {
+					bits=0;
+					r++;
+				}
+			}
+			if (bits) r++;
+		} else if ((cmd&BRIDGE_CMD)==BRIDGE_SHIFT) {
+			s=jtagGetState();
+			if (virt!=NOWHERE || (s!=JTAG_SHIFTDR && s!=JTAG_SHIFTIR)) {
+				bad=0x8000;
+				r+=(n+7)>>3;
+				continue;
+			}
+			while (n) {
+				wdt_reset();
+				bits=(n>8)?8:n;
+				n-=bits;
+				//The last bit of the batch without an exit: park in Pause
+				//and go on from there next batch.
+				exit=(n==0 && ((cmd&BRIDGE_EXIT) || r+1>=buf+len));
+				if (exit && !(cmd&BRIDGE_EXIT)) virt=s;
+				if (bits==8 && !exit) d=jtagShiftByte(*r++);
+				else d=jtagShift(*r++, bits, exit);
+				if (cmd&BRIDGE_TDO) *w++=d;
+			}
+		} else {
+			bad=0x8000;
+			break;
+		}
+	}
+	park();
+	return (w-buf)|bad;
+}
+
+//Sends the TDO of batch n, which is at the start of buf.
+static void answer(unsigned char n, unsigned char ok, unsigned int len) {
+	unsigned char *buf=arena.bridge.buf;
+	unsigned char sum=ok+len+(len>>8);
+	unsigned int i;
+	sendHeader('R', n);
+	swUartXmit(ok);
+	swUartXmit(len);
+	swUartXmit(len>>8);
+	for (i=0; i<len; i++) {
+		swUartXmit(buf[i]);
+		sum+=buf[i];
+	}
+	swUartXmit(sum);
+	swUartFlush();
+}
+
+void bridgeRun(void) {
+	unsigned char *buf=arena.bridge.buf;
+	unsigned char seq=0, sum, ok=0, ask=1, haveTdo=0;
+	unsigned int n, i, tdoLen=0;
+	int c;
+	virt=NOWHERE;
+	ioJtagEnable();
+	jtagReset();
+	ioUartEnable();
+	while (1) {
+		if (ask) {
+			sendHeader('J', seq);
+			swUartFlush();
+		}
+		ask=1;
+		c=getTimed(ASKTIME);
+		if (c=='Q') break;
+		if (c=='A' && haveTdo) {
+			answer(seq-1, ok, tdoLen);
+			ask=0;
+		} else if (c=='T') {
+			c=getTimed(BYTETIME);
+			if (c>=0) {
+				ioJtagSetDelay(c);
+				sendHeader('T', c);
+				swUartFlush();
+			}
+			ask=0;
+		} else if (c=='B') {
+			//Whatever comes in overwrites the last TDO.
+			haveTdo=0;
+			n=getTimed(BYTETIME);
+			c=(n==seq);
+			n=getTimed(BYTETIME);
+			n|=getTimed(BYTETIME)<<8;
+			if (n>BRIDGE_BUF) c=0;
+			sum=seq+n+(n>>8);
+			for (i=0; i<n && c; i++) {
+				c=getTimed(BYTETIME);
+				if (c<0) break;
+				buf[i]=c;
+				sum+=c;
+				c=1;
+			}
+			if (!c || i<n || getTimed(BYTETIME)!=sum) {
+				//Wait for the rest of whatever this was to pass, then ask
+				//for the batch again.
+				while (getTimed(BYTETIME)>=0) ;
+				continue;
+			}
+			ioJtagEnable();
+			tdoLen=run(buf, n);
+			ioUartEnable();
+			ok=!(tdoLen&0x8000);
+			tdoLen&=0x7fff;
+			haveTdo=1;
+			answer(seq++, ok, tdoLen);
+			ask=0;
+		}
+	}
+	//The TAP stays parked, xmodem mode toggles TCK too.
+}
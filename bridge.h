@@ -0,0 +1,9 @@
+//Batch commands, see bridge.c
+#define BRIDGE_TMS		0x01
+#define BRIDGE_SHIFT	0x02
+#define BRIDGE_RUN		0x03
+#define BRIDGE_CMD		0x0f //the command bits
+#define BRIDGE_EXIT		0x10 //TMS high on the last bit; for BRIDGE_RUN, on all of them
+#define BRIDGE_TDO		0x20 //send TDO back
+
+void bridgeRun(void);
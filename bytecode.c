@@ -0,0 +1,159 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Interpreter for bytecode images, which emu/xsvfvec.c -b compiles from an
+xsvf. Like with the pin vectors in vector.c, the compiler already did the
+TAP routing, padding and bit order, but the data stays 8 bits to the byte, so
+the image is about as big as the xsvf. Every instruction is one TCK sequence;
+there's no state to keep between them.
+
+The image starts with "XSVB", followed by instructions. Counts are msb-first,
+data is lsb-first: the first bit to shift is bit 0 of the first byte.
+0x01 n bits: n TCKs with TDI high and TMS from bits.
+0x02 nH nL tdi: shift n bits of tdi.
+0x03 nH nL (tdi exp mask)...: shift n bits of tdi, compare TDO to exp where
+mask is set.
+0x04 nH nL b: shift n bits that are all b (0x00 or 0xFF).
+0x05 nH nL: n TCKs with TMS and TDI low, 1ms each (XRUNTEST).
+0x06 nH nL (tdi exp)...: shift n bits of tdi, compare all of TDO to exp.
+0x00: end of the image.
+Bit 7 set on 0x02-0x04 and 0x06 raises TMS on the last bit. TMS is low for
+the rest of the bits.
+*/
+
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include "io.h"
+#include "jtag.h"
+#include "flash25cxx.h"
+#include "overclock.h"
+#include "debug.h"
+#include "unpack.h"
+#include "bytecode.h"
+
+#define MAGIC 0x58535642UL //'XSVB'
+
+#define BC_END 0x00
+#define BC_TMS 0x01
+#define BC_SHIFT 0x02
+#define BC_SHIFTCMP 0x03
+#define BC_FILL 0x04
+#define BC_WAIT 0x05
+#define BC_SHIFTEXP 0x06
+#define BC_LASTTMS 0x80
+
+static long start;
+
+static unsigned int getWord(void) {
+	unsigned int w=xsvfGetByte()<<8;
+	return w|xsvfGetByte();
+}
+
+//Like jtagShift(), without keeping track of the TAP state.
+static unsigned char shift(unsigned char data, unsigned char bits, unsigned char lastTms) {
+	unsigned char x, out=0;
+	for (x=0; x<bits; x++) {
+		if (ioJtagClock(data&1, lastTms && x==bits-1)) out|=(1<<x);
+		data>>=1;
+	}
+	return out;
+}
+
+//Returns 1 if the image at addr is bytecode, and gets ready to run it.
+unsigned char bytecodeOpen(long addr) {
+	unsigned char i, buff[4];
+	unsigned long magic=0;
+	ioFlashEnable();
+	f25cxxReadBuff(addr, buff, 4);
+	ioJtagEnable();
+	for (i=0; i<4; i++) magic=(magic<<8)|buff[i];
+	start=addr+4;
+	return (magic==MAGIC);
+}
+
+//Runs the bytecode. Returns 1 if all compares matched.
+unsigned char bytecodeRun(void) {
+	unsigned char op, tms, bits, b=0, exp, mask, in, err=0, k;
+	unsigned int n;
+	unpackOpen(start);
+	dputs("Bytecode start\n");
+	ioJtagEnable();
+	while (1) {
+		op=xsvfGetByte();
+		tms=op&BC_LASTTMS;
+		op&=~BC_LASTTMS;
+		if (op==BC_END) {
+			dputs("Bytecode done!\n");
+			return 1;
+		} else if (op==BC_WAIT) {
+			n=getWord();
+			while (n--) {
+				wdt_reset();
+				overclockStopwatchPoll();
+				ioJtagClock(0, 0);
+				_delay_ms(1);
+			}
+			continue;
+		} else if (op==BC_TMS) {
+			n=xsvfGetByte();
+		} else if (op>=BC_SHIFT && op<=BC_SHIFTEXP) {
+			n=getWord();
+			if (op==BC_FILL) b=xsvfGetByte();
+		} else {
+			dputs("Bytecode: invalid instruction ");
+			dhex(op, 2);
+			dputc('\n');
+			return 0;
+		}
+		k=0;
+		while (n) {
+			bits=(n>8)?8:n;
+			n-=bits;
+			if (op!=BC_FILL) b=xsvfGetByte();
+			//A fill doesn't read bytes, which keep the watchdog and the
+			//stopwatch going; at a slow TCK it can take seconds.
+			else if (!++k) {
+				wdt_reset();
+				overclockStopwatchPoll();
+			}
+			if (op==BC_TMS) {
+				while (bits--) {
+					ioJtagClock(1, b&1);
+					b>>=1;
+				}
+			} else if (op==BC_SHIFTCMP || op==BC_SHIFTEXP) {
+				exp=xsvfGetByte();
+				mask=(op==BC_SHIFTCMP)?xsvfGetByte():0xff;
+				in=shift(b, bits, tms && n==0);
+				if ((in^exp)&mask) err=1;
+			} else if (bits==8 && (n || !tms)) {
+				jtagShiftOutByte(b);
+			} else {
+				shift(b, bits, tms && n==0);
+			}
+		}
+		if (err) {
+			dputs("Bytecode: compare failed @");
+			dhex(xsvfTell(), 0);
+			dputc('\n');
+			return 0;
+		}
+	}
+}
@@ -0,0 +1,2 @@
+unsigned char bytecodeOpen(long addr);
+unsigned char bytecodeRun(void);
@@ -1,9 +1,16 @@
 #define DEBUG
 
+//Log messages; see print.c. Without DEBUG, they don't get compiled in.
 #ifdef DEBUG
-#include <avr/pgmspace.h>
 #include <stdio.h>
-#define dprintf(format, args...) printf_P(PSTR(format), ## args)
+#include "print.h"
+#define dputs(s) printStr(s)
+#define dputc(c) putchar(c)
+#define dhex(v, digits) printHex((v), (digits))
+#define ddec(v) printDec(v)
 #else
-#define dprintf(format, args...) 
+#define dputs(s)
+#define dputc(c)
+#define dhex(v, digits)
+#define ddec(v)
 #endif
@@ -0,0 +1,12 @@
+
+//EEPROM layout. The lower part is the log ring buffer stdout.c writes to, the
+//bytes above that store settings that need to survive a power cycle.
+#define EE_LOGSIZE		480
+
+#define EE_OSCCAL		480 //Calibrated max OSCCAL, see overclockCalibrate()
+#define EE_OSCCALCHK	481 //~EE_OSCCAL, so an erased/bad EEPROM is detected
+#define EE_OSCKHZ		482 //Clock the calibrated OSCCAL runs at, in KHz (word)
+#define EE_BOOTSLOT		484 //Image slot to play at boot, see imageBootSlot()
+#define EE_BOOTSLOTCHK	485 //~EE_BOOTSLOT
+#define EE_SPEED		486 //TCK speeds of the last chains seen, see speed.c (18 bytes)
+#define EE_BOOTMS		504 //ms from power-on to done configuring, last boot; see main.c (word)
@@ -0,0 +1,210 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Host side of the boundary scan sampler (sample.c). Starts it on a board (or
+the emulator) that's in xmodem mode, decodes the captures and prints every
+one that differs from the one before, as hex in shift order. The rate and
+dropped samples the firmware reports go to stderr.
+
+Build with:
+gcc -O2 -o bsview emu/bsview.c
+
+Usage: bsview [-n captures] [-p period_us] [-H hir:tir:hdr:tdr] port irlen:sampleins bslen
+e.g. for a part with an 8-bit IR, SAMPLE=0x01 and 216 boundary cells:
+bsview /dev/ttyUSB0 8:0x01 216
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+
+#define NAK 0x15
+#define SYNC 0xff
+#define MAXBSBYTES 64
+
+static int readTimed(int fd, int timeout) {
+	struct pollfd p;
+	unsigned char c;
+	p.fd=fd;
+	p.events=POLLIN;
+	if (poll(&p, 1, timeout)<=0) return -1;
+	if (read(fd, &c, 1)!=1) return -1;
+	return c;
+}
+
+static int readWord(int fd) {
+	int h=readTimed(fd, 1000), l=readTimed(fd, 1000);
+	if (h<0 || l<0) return -1;
+	return (h<<8)|l;
+}
+
+static int openPort(const char *name) {
+	struct termios tio;
+	int fd=open(name, O_RDWR|O_NOCTTY);
+	if (fd<0) {
+		perror(name);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, B38400);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIFLUSH);
+	return fd;
+}
+
+static void putWord(unsigned char *p, int w) {
+	p[0]=w>>8;
+	p[1]=w;
+}
+
+//Decode one capture from the frame data at p into cur. Returns the number
+//of bytes used, or -1 if the data is bad.
+static int decode(const unsigned char *p, int len, unsigned char *cur, int bytes) {
+	int pos=0, i=0, n;
+	while (i<bytes) {
+		if (pos>=len) return -1;
+		n=(p[pos]&0x7f)+1;
+		if (i+n>bytes) return -1;
+		if (p[pos++]&0x80) {
+			if (pos+n>len) return -1;
+			while (n--) cur[i++]^=p[pos++];
+		} else {
+			i+=n;
+		}
+	}
+	return pos;
+}
+
+int main(int argc, char **argv) {
+	unsigned char cmd[16], cur[MAXBSBYTES], last[MAXBSBYTES], frame[256];
+	int fd, opt, c, i, n, len, pos, r, bytes, irlen, ins, bits;
+	int hir=0, tir=0, hdr=0, tdr=0, synced;
+	long count=-1, seen=0, periodUs=0;
+
+	while ((opt=getopt(argc, argv, "n:p:H:"))!=-1) {
+		if (opt=='n') count=atol(optarg);
+		else if (opt=='p') periodUs=atol(optarg);
+		else if (opt=='H') sscanf(optarg, "%i:%i:%i:%i", &hir, &tir, &hdr, &tdr);
+		else break;
+	}
+	if (argc-optind!=3 || sscanf(argv[optind+1], "%i:%i", &irlen, &ins)!=2) {
+		fprintf(stderr, "Usage: %s [-n captures] [-p period_us] [-H hir:tir:hdr:tdr] port irlen:sampleins bslen\n", argv[0]);
+		exit(1);
+	}
+	bits=atoi(argv[optind+2]);
+	bytes=(bits+7)/8;
+	if (bits<1 || bytes>MAXBSBYTES) {
+		fprintf(stderr, "Boundary register can be 1 to %d bits.\n", MAXBSBYTES*8);
+		exit(1);
+	}
+
+	fd=openPort(argv[optind]);
+	fprintf(stderr, "Waiting for the firmware...\n");
+	while ((c=readTimed(fd, 10000))!=NAK) {
+		if (c<0) {
+			fprintf(stderr, "No NAK from the firmware.\n");
+			exit(1);
+		}
+	}
+	cmd[0]='p';
+	cmd[1]=irlen;
+	putWord(&cmd[2], ins);
+	putWord(&cmd[4], hir);
+	putWord(&cmd[6], tir);
+	putWord(&cmd[8], hdr);
+	putWord(&cmd[10], tdr);
+	putWord(&cmd[12], bits);
+	putWord(&cmd[14], periodUs/64);
+	tcflush(fd, TCIFLUSH);
+	if (write(fd, cmd, sizeof(cmd))!=sizeof(cmd)) {
+		perror("write");
+		exit(1);
+	}
+
+	//Between frames there's whatever the UART made of TCK. If a batch gets
+	//lost, the captures after it can't be decoded until the next 'S' frame
+	//starts over from zeroes.
+	memset(cur, 0, sizeof(cur));
+	memset(last, 0xff, sizeof(last));
+	synced=1;
+	while (count<0 || seen<count) {
+		if ((c=readTimed(fd, 5000))<0) {
+			fprintf(stderr, "No data from the firmware.\n");
+			break;
+		}
+		if (c!=SYNC) continue;
+		c=readTimed(fd, 1000);
+		if (c=='S') {
+			r=readWord(fd);
+			n=readWord(fd);
+			if (r<0 || n<0) continue;
+			fprintf(stderr, "%d samples/s, %d dropped\n", r, n);
+			memset(cur, 0, sizeof(cur));
+			synced=1;
+		} else if (c=='D') {
+			n=readTimed(fd, 1000);
+			len=readWord(fd);
+			if (n<1 || len<0 || len>(int)sizeof(frame)) {
+				synced=0;
+				continue;
+			}
+			for (i=0; i<len; i++) {
+				if ((c=readTimed(fd, 1000))<0) break;
+				frame[i]=c;
+			}
+			if (i<len) {
+				synced=0;
+				continue;
+			}
+			for (pos=0; synced && n>0; n--) {
+				r=decode(&frame[pos], len-pos, cur, bytes);
+				if (r<0) break;
+				pos+=r;
+				seen++;
+				if (memcmp(cur, last, bytes)) {
+					printf("%8ld ", seen);
+					for (i=0; i<bytes; i++) printf("%02x", cur[i]);
+					printf("\n");
+					memcpy(last, cur, bytes);
+				}
+			}
+			if (n || pos!=len) {
+				if (synced) fprintf(stderr, "Bad frame, waiting for the next stats.\n");
+				synced=0;
+			}
+		}
+	}
+
+	//It only listens between batches, so keep asking until it's back in
+	//xmodem: no more frames and the last thing we got was a NAK.
+	for (i=0; i<50; i++) {
+		c='q';
+		if (write(fd, &c, 1)!=1) break;
+		r=-1;
+		for (n=0; n<2000 && (c=readTimed(fd, 300))>=0; n++) r=c;
+		if (c<0 && r==NAK) break;
+	}
+	return 0;
+}
@@ -0,0 +1,704 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+Runs the firmware as a Linux process. The software UART shows up as a pty,
+the flash and EEPROM are backed by files and a virtual JTAG chain hangs off
+the JTAG pins. Timer0, the pin change interrupt and the watchdog run off a
+separate thread in real time, so the UART really runs at 38400 baud and the
+xmodem timeouts work like on the board. A watchdog reset re-executes the
+emulator, keeping the pty, flash and EEPROM.
+
+Build it from the top directory with:
+gcc -O2 -Iemu -Iemu/include -o stdalonejtag-emu main.c xmodem.c stdout.c \
+	swuart.c flash25cxx.c xsvf.c jtag.c io.c overclock.c image.c sample.c \
+	lz.c unpack.c vector.c bytecode.c stream.c print.c speed.c bridge.c \
+	emu/emu.c emu/flash.c emu/tap.c -lpthread
+*/
+
+#define _GNU_SOURCE
+#define EMU_HOST
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <avr/io.h>
+#include "emu.h"
+#include "hw.h"
+#include "../arena.h"
+#include "../eeconf.h"
+
+//Provided by the firmware.
+int firmwareMain(void);
+void emuIsrTim0CompA(void);
+void emuIsrTim0CompB(void);
+void emuIsrPcint0(void);
+
+#define FLASHSIZE (512*1024) //a 25P40, unless -F says otherwise
+#define EEPROMSIZE 512
+#define EEPROM_TWR 3400.0 //us per EEPROM write
+#define F_NOMINAL 16e6
+#define RX_HOLDOFF 200 //bit times a received byte may stay unread before the next one comes in anyway
+#define CYCLES_PER_ACCESS 3 //rough average of CPU cycles spent per register access
+
+//Pins
+#define P_Q_TDO_RXD (1<<0)
+#define P_D_TDI (1<<1)
+#define P_C_TMS (1<<2)
+#define P_S (1<<3)
+#define P_TCK_TXD (1<<4)
+
+static volatile uint8_t regs[EMU_NREGS];
+static pthread_mutex_t regLock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t irqLock;
+static volatile int irqEnabled;
+static pthread_t mainThread;
+//Register accesses only take effect at the next access, when the firmware
+//has done its store. That's per thread: the timer thread must not handle
+//an access the firmware is still busy with.
+static __thread int lastReg=-1;
+static __thread uint8_t lastVal;
+static uint8_t lastPins=0x1f;
+
+//Options
+static const char *flashFile="emu-flash.bin";
+static const char *eepromFile="emu-eeprom.bin";
+static const char *chain="0x01414093:6:32:0x09";
+static const char *linkName;
+static const char *statsFile;
+static double flashTimeScale=1.0;
+static long flashSize=FLASHSIZE;
+static int flashModern;
+static int factoryOsccal=0x60;
+static double maxMhz;
+static double maxKhz, lastTckUs;
+static char **savedArgv;
+
+static uint8_t *eeprom;
+static double eepromBusyUntil;
+
+//Timer1
+static double t1Count, t1Last;
+static long t1OvfSeen;
+
+//Timer0 and the UART lines, in timer0 ticks.
+static volatile uint64_t t0Tick;
+static int pendingIrqs;
+#define IRQ_COMPA 1
+#define IRQ_COMPB 2
+#define IRQ_PCINT 4
+static int rxLevel=1;
+static uint16_t rxFrame;
+static int rxBitsLeft;
+static uint64_t rxNextTick=UINT64_MAX;
+static uint64_t rxFrameTick;
+static volatile int rxUnread;
+static uint8_t rxQueue[4096];
+static int rxHead, rxTail;
+static int txState=-1;
+static uint8_t txByte;
+static int ptyMaster=-1, ptySlave=-1;
+
+//Watchdog
+static int wdtMode;
+static int wdtFlag;
+static double wdtKick;
+
+//Stats
+static int bootNo;
+static double bootUs, jtagStartUs, jtagStartModelUs, jtagEndUs;
+static volatile double modelUs;
+static int configReported;
+static long uartBytesIn, uartBytesOut;
+
+static double nowUs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+static void report(const char *fmt, ...) {
+	char buf[512];
+	va_list ap;
+	FILE *f;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "emu: %s\n", buf);
+	if (statsFile && (f=fopen(statsFile, "a"))) {
+		fprintf(f, "%s\n", buf);
+		fclose(f);
+	}
+}
+
+//Same mapping the firmware uses in overclock.c
+static int toMaxRange(int osccal) {
+	if (osccal&0x80) return osccal;
+	return ((osccal-0x40)>>1)+0xC0;
+}
+
+//Rough model: every OSCCAL step in the high range is 1.6% faster.
+static double cpuHz(void) {
+	return F_NOMINAL*(1.0+(toMaxRange(regs[EMU_OSCCAL])-toMaxRange(factoryOsccal))*0.016);
+}
+
+//Levels of the pins as driven by the AVR. Undriven pins read high.
+static uint8_t outPins(void) {
+	uint8_t p=(regs[EMU_PORTB]&regs[EMU_DDRB])|(~regs[EMU_DDRB]&0x1f);
+	//USI three-wire mode drives DO from the top bit of USIDR
+	if ((regs[EMU_USICR]&(1<<USIWM0)) && (regs[EMU_DDRB]&P_D_TDI)) {
+		p=(p&~P_D_TDI)|((regs[EMU_USIDR]&0x80)?P_D_TDI:0);
+	}
+	return p;
+}
+
+//What's on PB0: the flash when it's driving Q, the serial line when the UART
+//is listening, the JTAG chain otherwise.
+static int pinIn0(void) {
+	int v=flashQ();
+	if (v<0) v=(regs[EMU_GIMSK]&(1<<5))?rxLevel:tapTdo();
+	//Too fast for the signals to keep up?
+	if (maxMhz>0 && cpuHz()>maxMhz*1e6 && (random()&63)==0) v^=1;
+	return v;
+}
+
+static void t1Update(void) {
+	double now=nowUs();
+	int cs=regs[EMU_TCCR1]&15;
+	if (cs) t1Count+=(now-t1Last)*1e-6*cpuHz()/(1<<(cs-1));
+	t1Last=now;
+}
+
+static void wdtWrite(uint8_t v) {
+	wdtMode=v&~((1<<WDIF)|(1<<WDCE));
+	if (v&(1<<WDIF)) wdtFlag=0;
+	wdtKick=nowUs();
+}
+
+static void wdtCheck(double now);
+
+//Handle the side effects of this threads previous register access, and of
+//the pins changing. Needs regLock.
+static void syncLocked(void) {
+	uint8_t v, pins, ch;
+	if (lastReg==EMU_USICR) {
+		//Every access to USICR is a write. Handle the clock strobe first,
+		//then the clock pin toggle.
+		v=regs[EMU_USICR];
+		if ((v&(1<<USICLK)) && !(v&(3<<USICS0))) {
+			regs[EMU_USIDR]=(regs[EMU_USIDR]<<1)|pinIn0();
+		}
+		if (v&(1<<USITC)) regs[EMU_PORTB]^=P_C_TMS;
+	} else if (lastReg==EMU_TCNT1 && regs[EMU_TCNT1]!=lastVal) {
+		t1Count=regs[EMU_TCNT1];
+		t1OvfSeen=0;
+	} else if (lastReg==EMU_WDTCR && regs[EMU_WDTCR]!=lastVal) {
+		wdtWrite(regs[EMU_WDTCR]);
+	} else if (lastReg==EMU_GIMSK && (regs[EMU_GIMSK]&(1<<5)) && !(lastVal&(1<<5))) {
+		//UART got enabled. The first time that happens after the JTAG chain
+		//has been busy, the firmware is done configuring.
+		if (!configReported && tapStats.tcks) {
+			configReported=1;
+			report("boot %d: configure done in %.1f ms (%.1f ms modelled), %.1f ms after power-on; %ld TCKs, %ld IR/%ld DR scans, %ld flash bytes read",
+				bootNo, (nowUs()-jtagStartUs)/1e3, (modelUs-jtagStartModelUs)/1e3, (nowUs()-bootUs)/1e3,
+				tapStats.tcks, tapStats.irScans, tapStats.drScans, flashStats.bytesRead);
+			//What the firmware measured itself, see EE_BOOTMS in eeconf.h.
+			report("boot %d: last TCK %.1f ms after power-on, firmware says %d ms",
+				bootNo, (jtagEndUs-bootUs)/1e3, eeprom[EE_BOOTMS]|(eeprom[EE_BOOTMS+1]<<8));
+		}
+	}
+	lastReg=-1;
+
+	pins=outPins();
+	ch=pins^lastPins;
+	lastPins=pins;
+	if (!ch) return;
+	if (ch&P_S) flashSelect(!(pins&P_S));
+	if (ch&P_C_TMS) flashClock(pins&P_C_TMS, pins&P_D_TDI);
+	if (ch&P_TCK_TXD) {
+		if (!tapStats.tcks) {
+			jtagStartUs=nowUs();
+			jtagStartModelUs=modelUs;
+		}
+		//JTAG leaves TCK low, the UART leaves TXD high.
+		if (!(pins&P_TCK_TXD) && pthread_equal(pthread_self(), mainThread)) jtagEndUs=nowUs();
+		v=pins&P_D_TDI;
+		//A TCK faster than the chain takes gets the wrong bit in now and then.
+		//TXD wiggling for the UART doesn't count.
+		if ((pins&P_TCK_TXD) && maxKhz>0 && pthread_equal(pthread_self(), mainThread)) {
+			if (modelUs-lastTckUs<1e3/maxKhz && (random()&7)==0) v^=P_D_TDI;
+			lastTckUs=modelUs;
+		}
+		tapClock(pins&P_TCK_TXD, pins&P_C_TMS, v);
+	}
+}
+
+volatile uint8_t *emuReg(int reg) {
+	uint8_t v;
+	int isMain=pthread_equal(pthread_self(), mainThread);
+	pthread_mutex_lock(&regLock);
+	syncLocked();
+	if (reg==EMU_PINB) {
+		v=(lastPins&regs[EMU_DDRB])|(regs[EMU_PORTB]&~regs[EMU_DDRB]&0x1e);
+		if (!(regs[EMU_DDRB]&P_Q_TDO_RXD)) v|=pinIn0();
+		regs[reg]=v;
+	} else if (reg==EMU_TCNT0) {
+		regs[reg]=t0Tick%(regs[EMU_OCR0A]+1);
+	} else if (reg==EMU_TCNT1 || reg==EMU_TCCR1 || reg==EMU_OSCCAL) {
+		t1Update();
+		if (reg==EMU_TCNT1) regs[reg]=((long)t1Count)&0xff;
+	} else if (reg==EMU_TIFR) {
+		//Flags are cleared when read; the firmware only ever reads them to
+		//clear them afterwards.
+		t1Update();
+		regs[reg]=0;
+		if (((long)t1Count>>8)>t1OvfSeen) {
+			regs[reg]|=(1<<TOV1);
+			t1OvfSeen=((long)t1Count)>>8;
+		}
+	} else if (reg==EMU_GIFR) {
+		regs[reg]=0;
+	} else if (reg==EMU_WDTCR) {
+		wdtCheck(nowUs()); //don't wait for the timer thread to notice
+		regs[reg]=wdtMode|(wdtFlag?(1<<WDIF):0);
+		wdtFlag=0;
+	}
+	lastReg=reg;
+	lastVal=regs[reg];
+	if (isMain) modelUs+=CYCLES_PER_ACCESS*1e6/cpuHz();
+	pthread_mutex_unlock(&regLock);
+	return &regs[reg];
+}
+
+static void flush(void) {
+	pthread_mutex_lock(&regLock);
+	syncLocked();
+	pthread_mutex_unlock(&regLock);
+}
+
+//Delay loops count CPU cycles, so they get shorter when overclocked.
+void emuDelayUs(double us) {
+	double real=us*F_NOMINAL/cpuHz();
+	double end=nowUs()+real;
+	int isMain=pthread_equal(pthread_self(), mainThread);
+	flush();
+	if (isMain) modelUs+=real;
+	if (real>200) usleep(real-100);
+	while (nowUs()<end) ;
+}
+
+//Interrupts
+void emuSei(void) {
+	irqEnabled=1;
+}
+
+void emuCli(void) {
+	pthread_mutex_lock(&irqLock);
+	irqEnabled=0;
+	pthread_mutex_unlock(&irqLock);
+}
+
+int emuIrqSave(void) {
+	int s;
+	pthread_mutex_lock(&irqLock);
+	s=irqEnabled;
+	irqEnabled=0;
+	pthread_mutex_unlock(&irqLock);
+	return s;
+}
+
+void emuIrqRestore(int s) {
+	irqEnabled=s;
+}
+
+static void runIrqs(int irqs) {
+	pthread_mutex_lock(&irqLock);
+	irqs|=pendingIrqs;
+	if (!irqEnabled) {
+		pendingIrqs=irqs;
+	} else {
+		pendingIrqs=0;
+		if (irqs&IRQ_PCINT) emuIsrPcint0();
+		if (irqs&IRQ_COMPB) emuIsrTim0CompB();
+		if (irqs&IRQ_COMPA) emuIsrTim0CompA();
+		flush();
+	}
+	pthread_mutex_unlock(&irqLock);
+}
+
+//Watchdog
+static int wdtPeriodUs(void) {
+	int p=(wdtMode&7)|((wdtMode>>2)&8);
+	return 16000<<p;
+}
+
+void emuWdtEnable(int t) {
+	pthread_mutex_lock(&regLock);
+	wdtMode=(1<<WDE)|(t&7)|((t&8)<<2);
+	wdtKick=nowUs();
+	pthread_mutex_unlock(&regLock);
+}
+
+void emuWdtDisable(void) {
+	wdtMode=0;
+}
+
+void emuWdtReset(void) {
+	wdtKick=nowUs();
+}
+
+//Reset the chip by re-executing ourselves. The pty fds are inherited.
+static void resetChip(const char *why) {
+	char env[64];
+	report("boot %d: %s reset after %.1f s; %ld pages programmed, %ld chip/%ld sector erases, flash busy %.1f ms, uart %ld bytes in/%ld out",
+		bootNo, why, (nowUs()-bootUs)/1e6, flashStats.pagePrograms, flashStats.chipErases, flashStats.sectorErases,
+		flashStats.busyUs/1e3, uartBytesIn, uartBytesOut);
+	sprintf(env, "%d,%d,%d", ptyMaster, ptySlave, bootNo+1);
+	setenv("EMU_STATE", env, 1);
+	execv("/proc/self/exe", savedArgv);
+	perror("execv");
+	exit(1);
+}
+
+static void wdtCheck(double now) {
+	if (!(wdtMode&((1<<WDE)|(1<<WDIE)))) return;
+	if (now-wdtKick<wdtPeriodUs()) return;
+	wdtKick=now;
+	if (wdtMode&(1<<WDIE)) {
+		//Only running the interrupt clears WDIE, and the firmware has no
+		//handler and polls the flag with interrupts off: no reset, even
+		//with WDE set.
+		wdtFlag=1;
+	} else {
+		resetChip("watchdog");
+	}
+}
+
+//Serial port
+static void ptyPoll(void) {
+	uint8_t buf[256];
+	int n, i;
+	n=read(ptyMaster, buf, sizeof(buf));
+	for (i=0; i<n; i++) {
+		if (((rxHead+1)&(sizeof(rxQueue)-1))==rxTail) break;
+		rxQueue[rxHead]=buf[i];
+		rxHead=(rxHead+1)&(sizeof(rxQueue)-1);
+	}
+}
+
+//The TX line is TCK as well, so the host also sees what JTAG does to it. A
+//missing stop bit (TCK idles low) reaches it as a 0 byte, like a real UART
+//passes on a break, after which it waits for the line to go high again.
+static void txSample(int level) {
+	if (txState==-2) {
+		if (level) txState=-1;
+	} else if (txState<0) {
+		if (!level) txState=0;
+	} else if (txState<8) {
+		txByte=(txByte>>1)|(level?0x80:0);
+		txState++;
+	} else {
+		if (!level) txByte=0;
+		if (write(ptyMaster, &txByte, 1)==1) uartBytesOut++;
+		txState=level?-1:-2;
+	}
+}
+
+//Next bit on the RX line: start bit, 8 databits lsb first, stop bit.
+//On the board, the firmware picks up a byte well within a byte time. Here
+//the host can take the CPU away from it for longer than that, so the next
+//byte waits until the firmware has read the last one, or until it clearly
+//isn't going to.
+static void rxNextBit(int period) {
+	int old=rxLevel;
+	if (rxBitsLeft==0) {
+		if (rxHead==rxTail) {
+			rxNextTick=UINT64_MAX;
+			return;
+		}
+		if (rxUnread && t0Tick-rxFrameTick<RX_HOLDOFF*period) {
+			rxNextTick+=period/4;
+			return;
+		}
+		rxFrame=(rxQueue[rxTail]<<1)|(1<<9);
+		rxTail=(rxTail+1)&(sizeof(rxQueue)-1);
+		rxBitsLeft=10;
+		rxUnread=1;
+		rxFrameTick=t0Tick;
+		uartBytesIn++;
+	}
+	rxLevel=rxFrame&1;
+	rxFrame>>=1;
+	rxBitsLeft--;
+	rxNextTick+=period;
+	if (rxLevel!=old && (regs[EMU_GIMSK]&(1<<5)) && (regs[EMU_PCMSK]&1)) runIrqs(IRQ_PCINT);
+}
+
+//Move timer0 up to the current time, firing the interrupts it'd fire.
+//Returns the time in us until the next event.
+#define IRQ_HOLD_US 100000
+static double timer0Run(double now, double *last) {
+	static double heldSince;
+	static const int prescalers[8]={0, 1, 8, 64, 256, 1024, 0, 0};
+	int ps=prescalers[regs[EMU_TCCR0B]&7];
+	uint64_t target, next, t;
+	int period=regs[EMU_OCR0A]+1;
+	int ocrb;
+	double elapsed=now-*last;
+	//An interrupt that has to wait for the firmware to enable them again
+	//would get merged with the next one if we went on. The chip gets
+	//through an atomic block in a few cycles, while here the host may have
+	//taken the CPU away in the middle of one, so hold the clock for a while.
+	if (!pendingIrqs) {
+		heldSince=0;
+	} else if (heldSince==0 || now-heldSince<IRQ_HOLD_US) {
+		if (heldSince==0) heldSince=now;
+		*last=now;
+		return 20; //sleep, so the firmware gets the CPU to finish it
+	}
+	if (!ps) {
+		*last=now;
+		return 1000;
+	}
+	target=t0Tick+(uint64_t)(elapsed*1e-6*cpuHz()/ps);
+	if (target==t0Tick) return 0;
+	*last=now;
+	if (rxNextTick==UINT64_MAX && rxHead!=rxTail) rxNextTick=t0Tick+period/3;
+	while (1) {
+		//Next event: compare A match, compare B match or RX line change.
+		//The PCINT ISR moves OCR0B, so don't keep it around.
+		ocrb=regs[EMU_OCR0B];
+		t=t0Tick-(t0Tick%period);
+		next=t+period-1;
+		if (next<=t0Tick) next+=period;
+		if (t+ocrb>t0Tick && t+ocrb<next) next=t+ocrb;
+		else if (t+period+ocrb>t0Tick && t+period+ocrb<next) next=t+period+ocrb;
+		if (rxNextTick<next) next=rxNextTick;
+		if (next>target) {
+			t0Tick=target;
+			return (next-target)*ps*1e6/cpuHz();
+		}
+		t0Tick=next;
+		if (t0Tick==rxNextTick) rxNextBit(period);
+		if ((t0Tick%period)==regs[EMU_OCR0B] && (regs[EMU_TIMSK]&(1<<3))) runIrqs(IRQ_COMPB);
+		if ((t0Tick%period)==period-1) {
+			//Sample the TX line as the ISR left it a bit time ago, then
+			//let it send the next bit.
+			txSample(outPins()&P_TCK_TXD);
+			if (regs[EMU_TIMSK]&(1<<4)) runIrqs(IRQ_COMPA);
+		}
+		if (pendingIrqs && heldSince==0) return 20;
+	}
+}
+
+//Runs the timers. Sleeps until the next event instead of spinning, so the
+//firmware still gets the CPU on a single core machine.
+static void *timerThread(void *arg) {
+	double now, last=nowUs(), lastPoll=0, next;
+	struct timespec ts;
+	struct sched_param sp;
+	prctl(PR_SET_TIMERSLACK, 1000);
+	//Wake up in time to run the UART, if we're allowed to.
+	sp.sched_priority=1;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	while (1) {
+		now=nowUs();
+		if (now-lastPoll>20) {
+			ptyPoll();
+			lastPoll=now;
+		}
+		flush();
+		wdtCheck(now);
+		if (pendingIrqs && irqEnabled) runIrqs(0);
+		next=timer0Run(now, &last);
+		if (next>50) next=50;
+		if (next>=2) {
+			ts.tv_sec=0;
+			ts.tv_nsec=next*1000;
+			nanosleep(&ts, NULL);
+		}
+	}
+	return NULL;
+}
+
+//EEPROM
+uint8_t emuEepromRead(uintptr_t addr) {
+	emuEepromBusyWait();
+	return eeprom[addr&(EEPROMSIZE-1)];
+}
+
+void emuEepromWrite(uintptr_t addr, uint8_t val) {
+	emuEepromBusyWait();
+	if (eeprom[addr&(EEPROMSIZE-1)]==val) return;
+	eeprom[addr&(EEPROMSIZE-1)]=val;
+	eepromBusyUntil=nowUs()+EEPROM_TWR;
+}
+
+void emuEepromBusyWait(void) {
+	double now=nowUs();
+	if (now<eepromBusyUntil) {
+		if (pthread_equal(pthread_self(), mainThread)) modelUs+=eepromBusyUntil-now;
+		while (nowUs()<eepromBusyUntil) ;
+	}
+}
+
+//stdio
+emuFILE *emuStdout, *emuStdin;
+
+int emuPutchar(int c) {
+	if (emuStdout && emuStdout->put) emuStdout->put(c, emuStdout);
+	return c;
+}
+
+int emuGetchar(void) {
+	rxUnread=0;
+	if (emuStdin && emuStdin->get) return emuStdin->get(emuStdin);
+	return -1;
+}
+
+static uint8_t *mapFile(const char *name, long size) {
+	int fd;
+	struct stat st;
+	uint8_t *p;
+	fd=open(name, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+	if (fd<0 || fstat(fd, &st)<0) {
+		perror(name);
+		exit(1);
+	}
+	if (st.st_size<size) {
+		//New (or short) file: fill with 0xff, like an erased chip.
+		uint8_t ff[512];
+		long x;
+		memset(ff, 0xff, sizeof(ff));
+		lseek(fd, st.st_size, SEEK_SET);
+		for (x=st.st_size; x<size; x+=sizeof(ff)) {
+			if (write(fd, ff, (size-x<(long)sizeof(ff))?size-x:(long)sizeof(ff))<0) break;
+		}
+	}
+	p=mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p==MAP_FAILED) {
+		perror(name);
+		exit(1);
+	}
+	close(fd);
+	return p;
+}
+
+static void ptyOpen(void) {
+	struct termios tio;
+	char *env=getenv("EMU_STATE");
+	if (env && sscanf(env, "%d,%d,%d", &ptyMaster, &ptySlave, &bootNo)==3) return;
+	ptyMaster=posix_openpt(O_RDWR|O_NOCTTY);
+	if (ptyMaster<0 || grantpt(ptyMaster)<0 || unlockpt(ptyMaster)<0) {
+		perror("pty");
+		exit(1);
+	}
+	//Keep the slave open ourselves too, so the master doesn't return errors
+	//while no-one is connected.
+	ptySlave=open(ptsname(ptyMaster), O_RDWR|O_NOCTTY);
+	tcgetattr(ptySlave, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, B38400);
+	tcsetattr(ptySlave, TCSANOW, &tio);
+	fcntl(ptyMaster, F_SETFL, O_NONBLOCK);
+	fprintf(stderr, "emu: serial port is %s\n", ptsname(ptyMaster));
+	fprintf(stderr, "emu: SRAM arena: play %u, vectors %u, upload %u, windowed upload %u, sample %u, bridge %u of %u bytes\n",
+		(unsigned)sizeof(ArenaPlay), (unsigned)sizeof(ArenaVector), (unsigned)sizeof(ArenaUpload),
+		(unsigned)sizeof(ArenaWindow), (unsigned)sizeof(ArenaSample), (unsigned)sizeof(ArenaBridge), ARENA_SIZE);
+	if (linkName) {
+		unlink(linkName);
+		if (symlink(ptsname(ptyMaster), linkName)<0) perror(linkName);
+	}
+}
+
+static void usage(const char *me) {
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  -f file    flash image backing file (default %s)\n"
+		"  -e file    EEPROM backing file (default %s)\n"
+		"  -c chain   JTAG chain, idcode:irlen[:drlen[:idcodeins]],... TDI to TDO (default %s)\n"
+		"  -l name    symlink to create to the serial pty\n"
+		"  -s file    append statistics to this file\n"
+		"  -t scale   scale flash program/erase times (default 1.0)\n"
+		"  -F mb      emulate a newer flash of mb MiB, with SFDP, instead of the 25P40\n"
+		"  -o osccal  factory OSCCAL value (default 0x%02x)\n"
+		"  -m mhz     introduce bit errors above this CPU clock\n"
+		"  -k khz     introduce bit errors above this TCK rate\n",
+		me, flashFile, eepromFile, chain, factoryOsccal);
+	exit(1);
+}
+
+#undef main
+int main(int argc, char **argv) {
+	int c;
+	pthread_t thread;
+	pthread_mutexattr_t attr;
+	struct sched_param sp;
+	savedArgv=argv;
+	while ((c=getopt(argc, argv, "f:e:c:l:s:t:F:o:m:k:h"))!=-1) {
+		if (c=='f') flashFile=optarg;
+		else if (c=='e') eepromFile=optarg;
+		else if (c=='c') chain=optarg;
+		else if (c=='l') linkName=optarg;
+		else if (c=='s') statsFile=optarg;
+		else if (c=='t') flashTimeScale=atof(optarg);
+		else if (c=='F') {
+			flashSize=atol(optarg)<<20;
+			flashModern=1;
+			if (flashSize<(1<<20) || flashSize>(256<<20) || (flashSize&(flashSize-1))) usage(argv[0]);
+		}
+		else if (c=='o') factoryOsccal=strtol(optarg, NULL, 0);
+		else if (c=='m') maxMhz=atof(optarg);
+		else if (c=='k') maxKhz=atof(optarg);
+		else usage(argv[0]);
+	}
+	flashInit(mapFile(flashFile, flashSize), flashSize, flashTimeScale, flashModern);
+	eeprom=mapFile(eepromFile, EEPROMSIZE);
+	if (!tapInit(chain)) {
+		fprintf(stderr, "Can't parse chain %s\n", chain);
+		exit(1);
+	}
+	ptyOpen();
+
+	//A watchdog reset re-executes us from the timer thread, which may have
+	//left us with its real-time priority.
+	sp.sched_priority=0;
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&irqLock, &attr);
+	regs[EMU_OSCCAL]=factoryOsccal;
+	regs[EMU_MCUSR]=bootNo?(1<<WDRF):(1<<PORF);
+	bootUs=nowUs();
+	t1Last=bootUs;
+	mainThread=pthread_self();
+	pthread_create(&thread, NULL, timerThread, NULL);
+	firmwareMain();
+	return 0;
+}
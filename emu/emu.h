@@ -0,0 +1,75 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Register shim to run the firmware as a Linux process. Every register access
+goes through emuReg(), which first handles the side effects of the access
+before it (pin changes, USI strobes, flag clears) and then returns a pointer
+to the register, so the firmware code doesn't need any changes.
+*/
+
+#ifndef EMU_H
+#define EMU_H
+
+#include <stdint.h>
+
+enum {
+	EMU_PORTB, EMU_PINB, EMU_DDRB,
+	EMU_USICR, EMU_USIDR, EMU_USISR,
+	EMU_OSCCAL,
+	EMU_TCCR0A, EMU_TCCR0B, EMU_TCNT0, EMU_OCR0A, EMU_OCR0B,
+	EMU_TCCR1, EMU_TCNT1,
+	EMU_TIMSK, EMU_TIFR, EMU_GIMSK, EMU_GIFR, EMU_PCMSK,
+	EMU_WDTCR, EMU_MCUSR,
+	EMU_NREGS
+};
+
+volatile uint8_t *emuReg(int reg);
+
+void emuDelayUs(double us);
+void emuWdtEnable(int timeout);
+void emuWdtDisable(void);
+void emuWdtReset(void);
+
+void emuSei(void);
+void emuCli(void);
+int emuIrqSave(void);
+void emuIrqRestore(int state);
+
+uint8_t emuEepromRead(uintptr_t addr);
+void emuEepromWrite(uintptr_t addr, uint8_t val);
+void emuEepromBusyWait(void);
+
+//avr-libc style stdio streams.
+typedef struct emuFILE {
+	int (*put)(char, struct emuFILE *);
+	int (*get)(struct emuFILE *);
+	int flags;
+} emuFILE;
+
+extern emuFILE *emuStdout, *emuStdin;
+int emuPutchar(int c);
+int emuGetchar(void);
+
+//The firmware's main() gets renamed, the emulator has its own.
+#ifndef EMU_HOST
+#define main firmwareMain
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+Timed model of a 25P40-style SPI flash chip, clocked bit by bit from the pin
+changes the emulated AVR makes. Programming and erasing take (scaled) real
+time, with WIP set in the status register while the chip is busy, so the
+firmware has to wait just like on the real thing.
+
+With modern set, it's a newer part of the given size instead: a JEDEC ID and
+an SFDP table describing it, 4K/32K/64K erases, and 4-byte addressing (B7/E9)
+when it's over 16MiB.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "hw.h"
+
+#define FINS_WREN	0x06
+#define FINS_WRDI	0x04
+#define FINS_RDSR	0x05
+#define FINS_WRSR	0x01
+#define FINS_READ	0x03
+#define FINS_FREAD	0x0B
+#define FINS_PP		0x02
+#define FINS_SE		0xD8
+#define FINS_BE		0xC7
+#define FINS_DP		0xB9
+#define FINS_RES	0xAB
+#define FINS_RDID	0x9F
+#define FINS_RDSFDP	0x5A
+#define FINS_SE4K	0x20
+#define FINS_SE32K	0x52
+#define FINS_EN4B	0xB7
+#define FINS_EX4B	0xE9
+
+#define FSR_WEL		(1<<1)
+#define FSR_WIP		(1<<0)
+
+//Typical 25P40 timings, in us
+#define T_PP	1400.0
+#define T_SE	600000.0
+#define T_BE	4500000.0
+#define T_W		5000.0
+//and of a modern part, a W25Q-style one
+#define T_SE4K	45000.0
+#define T_SE32K	120000.0
+#define T_SE64K	150000.0
+#define T_PPNEW	700.0
+
+#define SECTORSIZE 65536
+#define PAGESIZE 256
+
+FlashStats flashStats;
+
+static uint8_t *mem;
+static long memSize;
+static double timeScale;
+
+static int selected;
+static int cmd, byteNo, bitNo;
+static uint8_t inByte, outByte;
+static int outBit, q=1, driving;
+static long addr;
+static int wel;
+static double busyUntil;
+static int modern, addrBytes=3, eraseSize;
+static uint8_t sfdp[256];
+
+static double nowUs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e6+ts.tv_nsec/1e3;
+}
+
+//The write enable latch stays set until the write cycle is done. The
+//firmware relies on that: it polls WEL instead of WIP.
+static int busy(void) {
+	if (nowUs()<busyUntil) return 1;
+	if (busyUntil) {
+		busyUntil=0;
+		wel=0;
+	}
+	return 0;
+}
+
+static void startBusy(double us) {
+	us*=timeScale;
+	busyUntil=nowUs()+us;
+	flashStats.busyUs+=us;
+}
+
+static void putDword(int pos, uint32_t v) {
+	sfdp[pos]=v;
+	sfdp[pos+1]=v>>8;
+	sfdp[pos+2]=v>>16;
+	sfdp[pos+3]=v>>24;
+}
+
+void flashInit(uint8_t *m, long size, double scale, int newPart) {
+	mem=m;
+	memSize=size;
+	timeScale=scale;
+	modern=newPart;
+	if (!modern) return;
+
+	//SFDP header, one parameter header: the basic table, 16 dwords at 0x80.
+	memset(sfdp, 0xff, sizeof(sfdp));
+	memcpy(sfdp, "SFDP\x06\x01\x00\xff", 8);
+	memcpy(sfdp+8, "\x00\x06\x01\x10\x80\x00\x00\xff", 8);
+	memset(sfdp+0x80, 0, 64);
+	//4K erases with 0x20, 3 or 4 byte addresses over 16MiB.
+	putDword(0x80, 0x01|(FINS_SE4K<<8)|((size>0x1000000)?(1<<17):0));
+	putDword(0x84, (uint32_t)size*8-1);
+	putDword(0x9c, 12|(FINS_SE4K<<8)|(15<<16)|(FINS_SE32K<<24));
+	putDword(0xa0, 16|(FINS_SE<<8));
+	putDword(0xa8, 8<<4); //256-byte pages
+	putDword(0xbc, 1<<24); //enter 4-byte mode with B7
+}
+
+//Handle a complete byte clocked in; returns the byte to clock out next, or
+//-1 if Q stays high impedance.
+static int flashByte(uint8_t b) {
+	int n;
+	if (byteNo==0) {
+		cmd=b;
+		if (busy() && cmd!=FINS_RDSR) cmd=-1; //Chip ignores everything but RDSR while busy
+		if (!modern && (cmd==FINS_RDSFDP || cmd==FINS_SE4K || cmd==FINS_SE32K || cmd==FINS_EN4B || cmd==FINS_EX4B)) cmd=-1;
+	}
+	if (cmd==FINS_RDSR) {
+		b=busy()?FSR_WIP:0; //first, it may clear wel
+		return b|(wel?FSR_WEL:0);
+	} else if (cmd==FINS_READ || cmd==FINS_FREAD || cmd==FINS_PP || cmd==FINS_SE || cmd==FINS_SE4K || cmd==FINS_SE32K) {
+		n=addrBytes;
+		if (byteNo>=1 && byteNo<=n) addr=((addr<<8)|b)&(memSize-1);
+		if (cmd==FINS_PP && byteNo>n) {
+			if (wel) mem[(addr&~(PAGESIZE-1))|((addr+byteNo-n-1)&(PAGESIZE-1))]&=b;
+		}
+		if ((cmd==FINS_READ && byteNo>=n) || (cmd==FINS_FREAD && byteNo>n)) {
+			flashStats.bytesRead++;
+			return mem[(addr++)&(memSize-1)];
+		}
+	} else if (cmd==FINS_RDSFDP) {
+		if (byteNo>=1 && byteNo<=3) addr=((addr<<8)|b)&0xffffff;
+		if (byteNo>=4) return sfdp[(addr++)&(sizeof(sfdp)-1)];
+	} else if (cmd==FINS_RES) {
+		if (byteNo>=3) return 0x12;
+	} else if (cmd==FINS_RDID) {
+		if (byteNo==0) return modern?0xef:0x20;
+		if (byteNo==1) return modern?0x40:0x20;
+		if (byteNo==2) {
+			for (n=0; (1L<<n)<memSize; n++) ;
+			return n;
+		}
+	}
+	return -1;
+}
+
+//Chip select changed. Most commands only take effect when S goes high again.
+void flashSelect(int sel) {
+	if (sel==selected) return;
+	selected=sel;
+	if (sel) {
+		cmd=-1;
+		byteNo=0;
+		bitNo=0;
+		outByte=0xff;
+		outBit=8;
+		driving=0;
+		return;
+	}
+	q=1;
+	if (cmd==FINS_WREN && byteNo==1) {
+		wel=1;
+	} else if (cmd==FINS_WRDI && byteNo==1) {
+		wel=0;
+	} else if (cmd==FINS_WRSR && byteNo==2 && wel) {
+		startBusy(T_W);
+	} else if (cmd==FINS_PP && byteNo>addrBytes+1 && wel) {
+		startBusy(modern?T_PPNEW:T_PP);
+		flashStats.pagePrograms++;
+	} else if ((cmd==FINS_SE || cmd==FINS_SE4K || cmd==FINS_SE32K) && byteNo==addrBytes+1 && wel) {
+		eraseSize=(cmd==FINS_SE4K)?4096:(cmd==FINS_SE32K)?32768:SECTORSIZE;
+		memset(&mem[addr&~(eraseSize-1)], 0xff, eraseSize);
+		startBusy((cmd==FINS_SE4K)?T_SE4K:(cmd==FINS_SE32K)?T_SE32K:modern?T_SE64K:T_SE);
+		flashStats.sectorErases++;
+	} else if (cmd==FINS_EN4B && byteNo==1) {
+		addrBytes=4;
+	} else if (cmd==FINS_EX4B && byteNo==1) {
+		addrBytes=3;
+	} else if (cmd==FINS_BE && byteNo==1 && wel) {
+		memset(mem, 0xff, memSize);
+		startBusy(T_BE);
+		flashStats.chipErases++;
+	}
+}
+
+//Clock edge. Data is shifted in on the rising edge and out on the falling one.
+void flashClock(int rising, int d) {
+	int r;
+	if (!selected) return;
+	if (rising) {
+		inByte=(inByte<<1)|(d?1:0);
+		if (++bitNo==8) {
+			r=flashByte(inByte);
+			driving=(r>=0);
+			outByte=r;
+			outBit=0;
+			bitNo=0;
+			byteNo++;
+		}
+	} else if (outBit<8) {
+		q=(outByte>>(7-outBit))&1;
+		outBit++;
+	}
+}
+
+//Level on Q, or -1 when the chip isn't driving it.
+int flashQ(void) {
+	return (selected && driving)?q:-1;
+}
@@ -0,0 +1,564 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Builds the images for a whole fleet of boards in one go. Every input goes
+through the same steps:
+- convert: anything that isn't an .xsvf (an .svf, a .bit...) is turned into
+  one by an external converter, svf2xsvf502 by default.
+- pack: xsvfpack, so the image stays packed in flash.
+- compress: lzpack on the packed image, for a compressed ('z') upload.
+- stamp: the packed image with the slot header image.c writes in front of
+  it, ready to be written at the start of a slot by a flash programmer.
+The steps run as external commands, given as templates where %i is the input
+and %o the output file. "-" as a template skips that step. What every step
+makes is written to the output directory, named after the input without its
+directory and extension; inputs that would end up with the same name are
+refused before anything runs.
+
+The outputs of the external steps are cached in a directory, named by a hash
+of the command template and the content of their input, so an input that
+didn't change since the last run (or that is the same as another one) never
+gets converted, packed or compressed again. Inputs are handed out to a pool
+of threads, largest first; every thread works through its own queue and
+steals from the others when that runs out.
+
+At the end, a summary gets printed with the sizes and the predicted time to
+configure the chain with every image: the TCKs the xsvf clocks times the time
+a TCK takes, plus the XRUNTEST waits, plus the time to read the image from the
+flash. The defaults are rough numbers for a 8MHz ATTiny85; calibrate them with
+what xmbench reports for an image or two.
+
+Build with:
+gcc -O2 -Wall -o fleet emu/fleet.c -lpthread
+
+Usage: fleet [options] file...
+ -j n      threads (default: the number of CPUs)
+ -f list   also build the files named in list, one per line
+ -o dir    where the results go (default .)
+ -c dir    cache directory (default .fleetcache)
+ -C cmd    converter template (default "./svf2xsvf502 -fpga -rlen 1024
+           -useXSDR -d -i %i -o %o")
+ -P cmd    packer template (default "./xsvfpack %i %o")
+ -Z cmd    compressor template (default "./lzpack %i %o")
+ -k khz    TCK rate for the prediction (default 200)
+ -b us     time to read and parse one image byte (default 10)
+ -s kb     slot size: a quarter of the flash (default 128, for a 25P40)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+extern char **environ;
+
+#define IMAGE_MAGIC 0x58535646UL //'XSVF', same as image.h
+#define IMAGE_START 0x100
+
+//Same as jtag.h
+#define JTAG_TESTLOGICRESET		0
+#define JTAG_RUNTEST			1
+#define JTAG_SHIFTDR			4
+#define JTAG_PAUSEDR			6
+#define JTAG_SHIFTIR			11
+#define JTAG_PAUSEIR			13
+
+//Same tables as jtag.c
+static const unsigned char nextStates[]={
+	0x01, 0x21, 0x93, 0x54, 0x54, 0x86, 0x76, 0x84,
+	0x21, 0x0A, 0xCB, 0xCB, 0xFD, 0xED, 0xFB, 0x21
+};
+
+static const unsigned int routingTable[]={
+	0x0001, 0xFFFD, 0xFE03, 0xFFE7, 0xFFEF, 0xFF0F, 0xFFBF, 0xFF0F,
+	0xFEFD, 0x01FF, 0xF3FF, 0xF7FF, 0x87FF, 0xDFFF, 0x87FF, 0x7FFD
+};
+
+typedef struct {
+	const char *name;
+	long size;
+	//Results
+	int failed;
+	long xsvfLen, packLen, lzLen;
+	long tcks, waitMs;
+	double predicted;
+	int hits, misses;
+} Job;
+
+typedef struct {
+	pthread_mutex_t lock;
+	int *jobs;
+	int head, tail; //the owner takes from the head (largest first), thieves from the tail
+} Queue;
+
+static Job *jobs;
+static int jobCount;
+static Queue *queues;
+static int threads;
+static const char *outDir=".", *cacheDir=".fleetcache";
+static long slotSize=0x20000; //IMAGE_SLOTSIZE in image.h
+static const char *convCmd="./svf2xsvf502 -fpga -rlen 1024 -useXSDR -d -i %i -o %o";
+static const char *packCmd="./xsvfpack %i %o";
+static const char *lzCmd="./lzpack %i %o";
+static double tckKhz=200, byteUs=10;
+static int steals;
+static pthread_mutex_t printLock=PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned char *readFile(const char *name, long *len) {
+	FILE *f=fopen(name, "rb");
+	unsigned char *buf;
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	*len=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf=malloc(*len+1);
+	if (fread(buf, 1, *len, f)!=(size_t)*len) {
+		free(buf);
+		buf=NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+static int writeFile(const char *name, const unsigned char *buf, long len) {
+	FILE *f=fopen(name, "wb");
+	if (!f) return 0;
+	if (fwrite(buf, 1, len, f)!=(size_t)len) {
+		fclose(f);
+		return 0;
+	}
+	return fclose(f)==0;
+}
+
+//64-bit FNV-1a. Plenty to tell a few thousand cache entries apart.
+static unsigned long long hash(unsigned long long h, const unsigned char *p, long len) {
+	while (len--) {
+		h^=*p++;
+		h*=0x100000001b3ULL;
+	}
+	return h;
+}
+
+//The zip CRC32, same as image.c
+static unsigned long crc32(const unsigned char *p, long len) {
+	unsigned long crc=0xFFFFFFFFUL;
+	int i;
+	while (len--) {
+		crc^=*p++;
+		for (i=0; i<8; i++) crc=(crc>>1)^((crc&1)?0xEDB88320UL:0);
+	}
+	return crc^0xFFFFFFFFUL;
+}
+
+static void fail(Job *j, const char *what) {
+	pthread_mutex_lock(&printLock);
+	fprintf(stderr, "%s: %s\n", j->name, what);
+	pthread_mutex_unlock(&printLock);
+	j->failed=1;
+}
+
+//Runs a command template with %i and %o filled in. Splits at spaces, no
+//shell involved. Returns 1 if it exited with 0.
+static int run(const char *tmpl, const char *inName, const char *outName) {
+	char *buf=strdup(tmpl), *argv[64], *p, *save;
+	int argc=0, status, ret=0;
+	pid_t pid;
+	posix_spawn_file_actions_t fa;
+
+	for (p=strtok_r(buf, " ", &save); p && argc<63; p=strtok_r(NULL, " ", &save)) {
+		if (strcmp(p, "%i")==0) p=(char*)inName;
+		else if (strcmp(p, "%o")==0) p=(char*)outName;
+		argv[argc++]=p;
+	}
+	argv[argc]=NULL;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&fa, 2, "/dev/null", O_WRONLY, 0);
+	if (argc && posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ)==0) {
+		while (waitpid(pid, &status, 0)<0 && errno==EINTR) ;
+		ret=WIFEXITED(status) && WEXITSTATUS(status)==0;
+	}
+	posix_spawn_file_actions_destroy(&fa);
+	free(buf);
+	return ret;
+}
+
+//Runs one step on data, or takes its result from the cache. Returns the
+//output (malloc'ed) or NULL if the step failed.
+static unsigned char *step(Job *j, const char *tmpl, const char *ext, const unsigned char *data, long len, long *outLen) {
+	unsigned long long h=0xcbf29ce484222325ULL;
+	char name[1024], inName[1024], tmpName[1024];
+	const char *base=strrchr(j->name, '/');
+	unsigned char *out;
+
+	h=hash(h, (const unsigned char*)tmpl, strlen(tmpl)+1);
+	h=hash(h, data, len);
+	snprintf(name, sizeof(name), "%s/%016llx%s", cacheDir, h, ext);
+	out=readFile(name, outLen);
+	if (out) {
+		j->hits++;
+		return out;
+	}
+	j->misses++;
+
+	//The tools want files; give them a private copy of the input, named
+	//after the original so converters that look at the extension still can.
+	snprintf(inName, sizeof(inName), "%s/in.%d.%d.%s", cacheDir, (int)getpid(), (int)(j-jobs), base?base+1:j->name);
+	snprintf(tmpName, sizeof(tmpName), "%s/out.%d.%d%s", cacheDir, (int)getpid(), (int)(j-jobs), ext);
+	out=NULL;
+	if (writeFile(inName, data, len) && run(tmpl, inName, tmpName)) {
+		out=readFile(tmpName, outLen);
+		//Only a complete result goes in the cache, under its final name.
+		if (out && rename(tmpName, name)!=0) perror(name);
+	}
+	unlink(inName);
+	unlink(tmpName);
+	return out;
+}
+
+//Walks the xsvf like xsvf.c plays it and counts the TCKs that gives, the
+//XRUNTEST ones separately. Returns 0 if the xsvf doesn't parse.
+static int estimate(Job *j, const unsigned char *x, long len) {
+	long pos=0, sdrsize=32, runtest=0, n, bits;
+	unsigned int hir=0, tir=0, hdr=0, tdr=0;
+	int state, endir=JTAG_RUNTEST, enddr=JTAG_RUNTEST, ins, target;
+	long tcks=32, waits=0;
+
+#define GET(v, bytes) do { int b_=(bytes); v=0; while (b_--) { if (pos>=len) return 0; v=(v<<8)|x[pos++]; } } while (0)
+#define GOTO(s) do { target=(s); while (state!=target) { \
+	int tms_=(routingTable[state]>>target)&1; \
+	state=tms_?(nextStates[state]>>4):(nextStates[state]&15); \
+	tcks++; \
+} } while (0)
+
+	state=JTAG_TESTLOGICRESET;
+	while (1) {
+		if (pos>=len) return 0;
+		ins=x[pos++];
+		if (ins==0x00) { //XCOMPLETE
+			break;
+		} else if (ins==0x01) { //XTDOMASK
+			pos+=(sdrsize+7)/8;
+		} else if (ins==0x07) { //XREPEAT
+			pos++;
+		} else if (ins==0x04) { //XRUNTEST
+			GET(runtest, 4);
+		} else if (ins==0x02 || ins==0x15) { //XSIR, XSIR2
+			GET(bits, (ins==0x15)?2:1);
+			pos+=(bits+7)/8;
+			GOTO(JTAG_SHIFTIR);
+			tcks+=hir+bits+tir;
+			state=JTAG_PAUSEIR-1; //Exit1-IR
+		} else if (ins==0x03 || ins==0x09) { //XSDR, XSDRTDO
+			pos+=(sdrsize+7)/8*((ins==0x09)?2:1);
+			GOTO(JTAG_SHIFTDR);
+			tcks+=hdr+sdrsize+tdr;
+			state=JTAG_PAUSEDR-1; //Exit1-DR
+		} else if (ins==0x08) { //XSDRSIZE
+			GET(sdrsize, 4);
+		} else if (ins>=0x0C && ins<=0x11) { //XSDR[BCE], XSDRTDO[BCE]
+			pos+=(sdrsize+7)/8*((ins>=0x0F)?2:1);
+			if (ins==0x0C || ins==0x0F) {
+				GOTO(JTAG_SHIFTDR);
+				tcks+=hdr;
+			}
+			tcks+=sdrsize;
+			if (ins==0x0E || ins==0x11) {
+				tcks+=tdr;
+				state=JTAG_PAUSEDR-1;
+				GOTO(enddr);
+			}
+		} else if (ins==0x12) { //XSTATE
+			GET(n, 1);
+			GOTO(n&15);
+		} else if (ins==0x13) { //XENDIR
+			GET(n, 1);
+			endir=n?JTAG_PAUSEIR:JTAG_RUNTEST;
+		} else if (ins==0x14) { //XENDDR
+			GET(n, 1);
+			enddr=n?JTAG_PAUSEDR:JTAG_RUNTEST;
+		} else if (ins>=0x20 && ins<=0x23) { //X[HT][ID]R
+			GET(n, 2);
+			if (ins==0x20) hir=n;
+			if (ins==0x21) tir=n;
+			if (ins==0x22) hdr=n;
+			if (ins==0x23) tdr=n;
+		} else if (ins==0x24) { //XIDENT, skipped when everything gets played
+			GET(n, 4);
+			pos+=n;
+		} else {
+			return 0;
+		}
+		if (ins==0x02 || ins==0x15 || ins==0x03 || ins==0x09) {
+			if (runtest) {
+				GOTO(JTAG_RUNTEST);
+				waits+=runtest;
+			} else {
+				GOTO((ins==0x02 || ins==0x15)?endir:enddr);
+			}
+		}
+	}
+#undef GET
+#undef GOTO
+	j->tcks=tcks+waits;
+	j->waitMs=waits;
+	return 1;
+}
+
+static const char *baseName(const char *name, char *buf, int size) {
+	const char *p=strrchr(name, '/');
+	char *dot;
+	snprintf(buf, size, "%s", p?p+1:name);
+	dot=strrchr(buf, '.');
+	if (dot && dot!=buf) *dot=0;
+	return buf;
+}
+
+static void output(Job *j, const char *ext, const unsigned char *data, long len) {
+	char base[512], name[1024];
+	snprintf(name, sizeof(name), "%s/%s%s", outDir, baseName(j->name, base, sizeof(base)), ext);
+	if (!writeFile(name, data, len)) fail(j, "can't write the results");
+}
+
+static void putLong(unsigned char *p, unsigned long l) {
+	p[0]=l>>24;
+	p[1]=l>>16;
+	p[2]=l>>8;
+	p[3]=l;
+}
+
+//All the steps for one input.
+static void build(Job *j) {
+	const char *ext=strrchr(j->name, '.');
+	unsigned char *in, *xsvf=NULL, *img=NULL, *lz=NULL, *slot;
+	long inLen, imgLen=0, lzLen=0;
+
+	in=readFile(j->name, &inLen);
+	if (!in) {
+		fail(j, strerror(errno));
+		return;
+	}
+	if (ext && strcmp(ext, ".xsvf")==0) {
+		xsvf=in;
+		j->xsvfLen=inLen;
+	} else if (strcmp(convCmd, "-")==0) {
+		fail(j, "not an .xsvf and no converter");
+		goto out;
+	} else {
+		xsvf=step(j, convCmd, ".xsvf", in, inLen, &j->xsvfLen);
+		if (!xsvf) {
+			fail(j, "conversion failed");
+			goto out;
+		}
+		output(j, ".xsvf", xsvf, j->xsvfLen);
+	}
+	if (!estimate(j, xsvf, j->xsvfLen)) {
+		fail(j, "the xsvf doesn't parse");
+		goto out;
+	}
+
+	if (strcmp(packCmd, "-")==0) {
+		img=xsvf;
+		imgLen=j->xsvfLen;
+	} else {
+		img=step(j, packCmd, ".xsvp", xsvf, j->xsvfLen, &imgLen);
+		if (!img) {
+			fail(j, "packing failed");
+			goto out;
+		}
+		output(j, ".xsvp", img, imgLen);
+		j->packLen=imgLen;
+	}
+	if (imgLen>slotSize-IMAGE_START) {
+		fail(j, "too big for a slot");
+		goto out;
+	}
+
+	if (strcmp(lzCmd, "-")!=0) {
+		lz=step(j, lzCmd, ".lz", img, imgLen, &lzLen);
+		if (!lz) {
+			fail(j, "compression failed");
+			goto out;
+		}
+		output(j, ".lz", lz, lzLen);
+		j->lzLen=lzLen;
+	}
+
+	//Header page as imageWriteHeader() leaves it, the rest of it erased.
+	slot=malloc(IMAGE_START+imgLen);
+	memset(slot, 0xff, IMAGE_START);
+	putLong(slot, IMAGE_MAGIC);
+	putLong(slot+4, imgLen);
+	putLong(slot+8, crc32(img, imgLen));
+	memcpy(slot+IMAGE_START, img, imgLen);
+	output(j, ".img", slot, IMAGE_START+imgLen);
+	free(slot);
+
+	j->predicted=(j->tcks-j->waitMs)/tckKhz+j->waitMs+imgLen*byteUs/1000.0;
+out:
+	if (img!=xsvf) free(img);
+	if (xsvf!=in) free(xsvf);
+	free(lz);
+	free(in);
+}
+
+//Next job for thread self: its own first, then one from the end of the
+//queue of another thread. -1 when all queues are empty.
+static int take(int self) {
+	Queue *q;
+	int i, job=-1;
+	for (i=0; i<threads && job<0; i++) {
+		q=&queues[(self+i)%threads];
+		pthread_mutex_lock(&q->lock);
+		if (q->head<q->tail) job=(i==0)?q->jobs[q->head++]:q->jobs[--q->tail];
+		pthread_mutex_unlock(&q->lock);
+		if (job>=0 && i) __sync_fetch_and_add(&steals, 1);
+	}
+	return job;
+}
+
+static void *worker(void *arg) {
+	int self=(long)arg, job;
+	while ((job=take(self))>=0) build(&jobs[job]);
+	return NULL;
+}
+
+static int bySize(const void *a, const void *b) {
+	long d=jobs[*(const int*)b].size-jobs[*(const int*)a].size;
+	return (d>0)-(d<0);
+}
+
+static void addJob(const char *name) {
+	struct stat st;
+	jobs=realloc(jobs, (jobCount+1)*sizeof(Job));
+	memset(&jobs[jobCount], 0, sizeof(Job));
+	jobs[jobCount].name=strdup(name);
+	if (stat(name, &st)==0) jobs[jobCount].size=st.st_size;
+	jobCount++;
+}
+
+static void addList(const char *list) {
+	char line[1024];
+	FILE *f=fopen(list, "r");
+	if (!f) {
+		perror(list);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")]=0;
+		if (line[0] && line[0]!='#') addJob(line);
+	}
+	fclose(f);
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+int main(int argc, char **argv) {
+	int c, i, k, *order, failed=0, hits=0, misses=0;
+	char a[512], b[512];
+	double start, total=0;
+	pthread_t *tids;
+	Job *j;
+
+	threads=sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c=getopt(argc, argv, "j:f:o:c:C:P:Z:k:b:s:"))!=-1) {
+		if (c=='j') threads=atoi(optarg);
+		else if (c=='f') addList(optarg);
+		else if (c=='o') outDir=optarg;
+		else if (c=='c') cacheDir=optarg;
+		else if (c=='C') convCmd=optarg;
+		else if (c=='P') packCmd=optarg;
+		else if (c=='Z') lzCmd=optarg;
+		else if (c=='k') tckKhz=atof(optarg);
+		else if (c=='b') byteUs=atof(optarg);
+		else if (c=='s') slotSize=atol(optarg)*1024;
+		else break;
+	}
+	for (i=optind; i<argc; i++) addJob(argv[i]);
+	if (c!=-1 || jobCount==0 || tckKhz<=0 || slotSize<=IMAGE_START) {
+		fprintf(stderr, "Usage: %s [-j threads] [-f list] [-o outdir] [-c cachedir] [-C convert] [-P pack]\n"
+				"  [-Z compress] [-k tck_khz] [-b byte_us] [-s slot_kb] file...\n", argv[0]);
+		exit(1);
+	}
+	//The threads would overwrite each other's results.
+	for (i=0; i<jobCount; i++) {
+		baseName(jobs[i].name, a, sizeof(a));
+		for (k=0; k<i; k++) {
+			if (strcmp(a, baseName(jobs[k].name, b, sizeof(b)))==0) {
+				fprintf(stderr, "%s and %s would both be written to %s/%s.*; rename one\n",
+						jobs[k].name, jobs[i].name, outDir, a);
+				exit(1);
+			}
+		}
+	}
+	if (threads<1) threads=1;
+	if (threads>jobCount) threads=jobCount;
+	mkdir(outDir, 0777);
+	mkdir(cacheDir, 0777);
+
+	//Deal the inputs out largest first, so the big ones don't end up last.
+	order=malloc(jobCount*sizeof(int));
+	for (i=0; i<jobCount; i++) order[i]=i;
+	qsort(order, jobCount, sizeof(int), bySize);
+	queues=calloc(threads, sizeof(Queue));
+	for (i=0; i<threads; i++) {
+		pthread_mutex_init(&queues[i].lock, NULL);
+		queues[i].jobs=malloc(jobCount*sizeof(int));
+	}
+	for (i=0; i<jobCount; i++) {
+		Queue *q=&queues[i%threads];
+		q->jobs[q->tail++]=order[i];
+	}
+
+	start=now();
+	tids=malloc(threads*sizeof(pthread_t));
+	for (i=0; i<threads; i++) pthread_create(&tids[i], NULL, worker, (void*)(long)i);
+	for (i=0; i<threads; i++) pthread_join(tids[i], NULL);
+
+	printf("%-24s %8s %8s %8s %8s %10s %8s %10s\n", "image", "input", "xsvf", "packed", "lz", "TCKs", "waits", "predicted");
+	for (i=0; i<jobCount; i++) {
+		j=&jobs[i];
+		hits+=j->hits;
+		misses+=j->misses;
+		if (j->failed) {
+			printf("%-24s %8ld   failed\n", j->name, j->size);
+			failed++;
+			continue;
+		}
+		printf("%-24s %8ld %8ld %8ld %8ld %10ld %6ldms %9.2fs\n", j->name, j->size, j->xsvfLen,
+				j->packLen, j->lzLen, j->tcks, j->waitMs, j->predicted/1000);
+		total+=j->predicted;
+	}
+	printf("%d images, %d failed, predicted %.2fs to configure them all\n", jobCount, failed, total/1000);
+	fprintf(stderr, "%d steps run, %d from the cache, %d jobs stolen, %d threads, %.2fs\n",
+			misses, hits, steals, threads, now()-start);
+	return failed?1:0;
+}
@@ -0,0 +1,456 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Gang programmer: uploads images to lots of boards at once, one serial port
+per board, all driven from a single epoll loop. Every port has its own xmodem
+state (waiting for the first NAK, selecting the slot, a block or the EOT in
+flight), with a deadline for the answer it waits for. Ports that use the same
+image share one copy of it in memory.
+
+When a block can't get through in RETRIES tries, the board gets retried (-r
+times): the firmware keeps waiting for that block, so we stay quiet until it
+NAKs for lack of input (every 3 seconds) and carry on from there. If the
+board got reset instead, it says its flash ID again before the NAK; then the
+upload starts over from the first block, which counts as a retry too. A CAN
+means the image doesn't fit or isn't valid compressed data, which a retry
+won't fix.
+
+At the end, it prints what happened on every port and the total rate.
+
+Build with:
+gcc -O2 -Wall -o gang emu/gang.c
+
+Usage: gang [-f file] [-S slot] [-z] [-r retries] [-t secs] [-d ms] [-v] port[=file]...
+-f is the image for the ports that aren't given one of their own.
+-S, -z and -d are like xmbench: upload to that slot, a compressed upload of a
+file made by lzpack, and wait that many ms before every block.
+-r retries a board that many times (default 2).
+-t waits that many seconds for a board to show up (default 30).
+-v prints what the firmwares say, prefixed by the port.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/epoll.h>
+
+#define SOH 0x01
+#define ACK 0x06
+#define NAK 0x15
+#define EOT 0x04
+#define CAN 0x18
+
+#define LINE_RATE 3840 //bytes/s 38400 baud carries, with start and stop bits
+
+#define RETRIES 10 //tries per block
+#define ACKTIME 10000 //ms; the first block waits for the slot to be erased
+#define KEYTIME 2000 //ms to confirm a slot or a compressed upload
+#define EOTTIME 5000 //ms; the firmware writes the slot header first
+#define IDLETIME 10000 //ms to wait for a stuck firmware to NAK
+
+enum {
+	WAITNAK=0, //waiting for the firmware to show up
+	SELECT, //sent the slot number
+	COMPRESS, //sent 'z'
+	BLOCK, //block in flight
+	ENDING, //EOT in flight
+	RESYNC, //gave up on a block, waiting for the firmware to NAK
+	DONE,
+	FAILED
+};
+
+typedef struct Image {
+	const char *name;
+	unsigned char *data; //padded to a whole block with 0xff
+	long len, blocks;
+	struct Image *next;
+} Image;
+
+typedef struct {
+	const char *name;
+	int fd;
+	Image *img;
+	int state;
+	long block; //next block to get ACKed, from 0
+	int tries, retries;
+	long resent; //blocks sent again over the whole upload
+	unsigned char out[132];
+	int outLen, outPos; //what still has to go out
+	int writing; //waiting for EPOLLOUT
+	double due; //when out may be sent, see -d
+	double deadline; //when the answer we wait for is late, 0 if none
+	double tStart, tEnd;
+	char line[80]; //what the firmware says
+	int lineLen;
+	char last[80];
+	const char *why;
+} Port;
+
+static Image *images;
+static Port *ports;
+static int portCount, epfd;
+static int slot=-1, lz=0, maxRetries=2, showTime=30, turnaround=0, verbose=0;
+
+static double nowMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3+ts.tv_nsec/1e6;
+}
+
+//Load an image, or return the copy another port already uses.
+static Image *loadImage(const char *name) {
+	Image *img;
+	FILE *f;
+	for (img=images; img; img=img->next) {
+		if (strcmp(img->name, name)==0) return img;
+	}
+	f=fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	img=calloc(1, sizeof(Image));
+	img->name=name;
+	fseek(f, 0, SEEK_END);
+	img->len=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	img->blocks=(img->len+127)/128;
+	img->data=malloc(img->blocks*128+1);
+	memset(img->data, 0xff, img->blocks*128+1);
+	if (fread(img->data, 1, img->len, f)!=(size_t)img->len) {
+		perror(name);
+		exit(1);
+	}
+	fclose(f);
+	img->next=images;
+	images=img;
+	return img;
+}
+
+static int openPort(const char *name) {
+	struct termios tio;
+	int fd=open(name, O_RDWR|O_NOCTTY|O_NONBLOCK);
+	if (fd<0) {
+		perror(name);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, B38400);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIFLUSH);
+	return fd;
+}
+
+static void watchOut(Port *p, int on) {
+	struct epoll_event ev;
+	if (p->writing==on) return;
+	p->writing=on;
+	ev.events=on?(EPOLLIN|EPOLLOUT):EPOLLIN;
+	ev.data.ptr=p;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, p->fd, &ev);
+}
+
+//Write what's left of out. The answer is due timeout ms after the last byte.
+static void flush(Port *p, int timeout) {
+	int n;
+	while (p->outPos<p->outLen) {
+		n=write(p->fd, p->out+p->outPos, p->outLen-p->outPos);
+		if (n<=0) break;
+		p->outPos+=n;
+	}
+	watchOut(p, p->outPos<p->outLen);
+	if (p->outPos==p->outLen) p->deadline=nowMs()+timeout;
+}
+
+static int answerTime(Port *p) {
+	if (p->state==SELECT || p->state==COMPRESS) return KEYTIME;
+	if (p->state==ENDING) return EOTTIME;
+	return ACKTIME;
+}
+
+//Queue len bytes to go out after the turnaround time.
+static void send(Port *p, const unsigned char *buf, int len) {
+	memcpy(p->out, buf, len);
+	p->outLen=len;
+	p->outPos=0;
+	p->deadline=0;
+	p->due=nowMs()+turnaround;
+	if (!turnaround) flush(p, answerTime(p));
+}
+
+static void fail(Port *p, const char *why) {
+	p->state=FAILED;
+	p->why=why;
+	p->deadline=0;
+	p->outLen=p->outPos=0;
+	p->tEnd=nowMs();
+	watchOut(p, 0);
+}
+
+static void sendBlock(Port *p) {
+	unsigned char *blk=p->out, sum=0;
+	long n=p->block;
+	int x;
+	p->state=BLOCK;
+	blk[0]=SOH;
+	blk[1]=n+1;
+	blk[2]=(n+1)^0xff;
+	memcpy(&blk[3], &p->img->data[n*128], 128);
+	for (x=0; x<128; x++) sum+=blk[3+x];
+	blk[131]=sum;
+	if (p->tries++) p->resent++;
+	send(p, blk, 132);
+}
+
+static void sendKey(Port *p, int state, unsigned char key) {
+	p->state=state;
+	send(p, &key, 1);
+}
+
+static void startUpload(Port *p) {
+	//Drop older NAKs, they'd look like a NAK on the first block.
+	tcflush(p->fd, TCIFLUSH);
+	p->block=0;
+	p->tries=0;
+	p->tStart=nowMs();
+	sendBlock(p);
+}
+
+static void sendEot(Port *p) {
+	unsigned char c=EOT;
+	p->state=ENDING;
+	if (p->tries++==RETRIES) {
+		fail(p, "no ACK on EOT");
+		return;
+	}
+	send(p, &c, 1);
+}
+
+//Give up on this block for now; see the comment at the top.
+static void retry(Port *p, const char *why) {
+	if (p->retries++==maxRetries) {
+		fail(p, why);
+		return;
+	}
+	if (verbose) printf("%s: %s, retrying\n", p->name, why);
+	p->state=RESYNC;
+	p->outLen=p->outPos=0;
+	watchOut(p, 0);
+	p->deadline=nowMs()+IDLETIME;
+}
+
+//The firmware got reset halfway; it waits for the first block again.
+static void restart(Port *p) {
+	if (p->retries++==maxRetries) {
+		fail(p, "board keeps resetting");
+		return;
+	}
+	if (verbose) printf("%s: board got reset, starting over\n", p->name);
+	p->state=WAITNAK;
+	p->outLen=p->outPos=0;
+	watchOut(p, 0);
+	p->deadline=nowMs()+showTime*1000.0;
+}
+
+static void blockAnswer(Port *p, int c) {
+	if (c==ACK) {
+		p->block++;
+		p->tries=0;
+		if (p->block<p->img->blocks) sendBlock(p);
+		else sendEot(p);
+		return;
+	}
+	if (c==CAN) {
+		fail(p, "cancelled, doesn't fit or not compressed");
+		return;
+	}
+	if (p->tries==RETRIES) retry(p, "too many NAKs");
+	else sendBlock(p);
+}
+
+static void chatter(Port *p, int c) {
+	if (c=='\n' || p->lineLen==sizeof(p->line)-1) {
+		p->line[p->lineLen]=0;
+		if (p->lineLen) {
+			strcpy(p->last, p->line);
+			if (verbose) printf("%s: %s\n", p->name, p->line);
+			if ((p->state==BLOCK || p->state==RESYNC) && strncmp(p->line, "Flash ID", 8)==0) restart(p);
+		}
+		p->lineLen=0;
+	} else if (c>=' ' && c<0x7f) {
+		p->line[p->lineLen++]=c;
+	}
+}
+
+//Handle a byte from the firmware.
+static void received(Port *p, int c) {
+	int sending=(p->outPos<p->outLen);
+	if (p->state==WAITNAK && c==NAK) {
+		if (slot>=0) sendKey(p, SELECT, '0'+slot);
+		else if (lz) sendKey(p, COMPRESS, 'z');
+		else startUpload(p);
+	} else if (p->state==SELECT && c=='\n') {
+		chatter(p, c);
+		if (lz) sendKey(p, COMPRESS, 'z');
+		else startUpload(p);
+	} else if (p->state==COMPRESS && c=='\n') {
+		chatter(p, c);
+		startUpload(p);
+	} else if (p->state==BLOCK && !sending && (c==ACK || c==NAK || c==CAN)) {
+		blockAnswer(p, c);
+	} else if (p->state==ENDING && !sending && c==ACK) {
+		p->state=DONE;
+		p->deadline=0;
+		p->tEnd=nowMs();
+	} else if (p->state==RESYNC && c==NAK) {
+		p->tries=0;
+		sendBlock(p);
+	} else {
+		chatter(p, c);
+	}
+}
+
+static void timedOut(Port *p) {
+	p->deadline=0;
+	if (p->state==WAITNAK) fail(p, "no NAK from the firmware");
+	else if (p->state==SELECT) fail(p, "couldn't select the slot");
+	else if (p->state==COMPRESS) fail(p, "couldn't select a compressed upload");
+	else if (p->state==RESYNC) fail(p, "firmware stopped answering");
+	else if (p->state==ENDING) sendEot(p);
+	else if (p->tries==RETRIES) retry(p, "too many timeouts");
+	else sendBlock(p);
+}
+
+static void addPort(char *arg, const char *defImage) {
+	char *eq=strchr(arg, '=');
+	Port *p;
+	struct epoll_event ev;
+	if (eq) *eq=0;
+	if (!eq && !defImage) {
+		fprintf(stderr, "%s: no image, use port=file or -f file\n", arg);
+		exit(1);
+	}
+	p=&ports[portCount++];
+	p->name=arg;
+	p->img=loadImage(eq?eq+1:defImage);
+	p->fd=openPort(arg);
+	p->state=WAITNAK;
+	p->deadline=nowMs()+showTime*1000.0;
+	ev.events=EPOLLIN;
+	ev.data.ptr=p;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, p->fd, &ev);
+}
+
+//Milliseconds until the next port needs attention, or -1.
+static int nextEvent(void) {
+	double t=0, now=nowMs();
+	int i;
+	Port *p;
+	for (i=0; i<portCount; i++) {
+		p=&ports[i];
+		if (p->outPos<p->outLen && !p->writing && (t==0 || p->due<t)) t=p->due;
+		if (p->deadline && (t==0 || p->deadline<t)) t=p->deadline;
+	}
+	if (t==0) return -1;
+	return (t>now)?(int)(t-now)+1:0;
+}
+
+int main(int argc, char **argv) {
+	const char *defImage=NULL;
+	struct epoll_event ev[64];
+	unsigned char buf[256];
+	int opt, i, j, n, events, active, ok=0;
+	long total=0;
+	double tStart, tEnd, first, last, t;
+	Port *p;
+
+	while ((opt=getopt(argc, argv, "f:S:zr:t:d:v"))!=-1) {
+		if (opt=='f') defImage=optarg;
+		else if (opt=='S') slot=atoi(optarg);
+		else if (opt=='z') lz=1;
+		else if (opt=='r') maxRetries=atoi(optarg);
+		else if (opt=='t') showTime=atoi(optarg);
+		else if (opt=='d') turnaround=atoi(optarg);
+		else if (opt=='v') verbose=1;
+		else break;
+	}
+	if (opt!=-1 || optind==argc) {
+		fprintf(stderr, "Usage: %s [-f file] [-S slot] [-z] [-r retries] [-t secs] [-d ms] [-v] port[=file]...\n", argv[0]);
+		exit(1);
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	epfd=epoll_create1(0);
+	//epoll keeps pointers to the ports, so they can't move.
+	ports=calloc(argc-optind, sizeof(Port));
+	for (i=optind; i<argc; i++) addPort(argv[i], defImage);
+
+	tStart=nowMs();
+	do {
+		events=epoll_wait(epfd, ev, 64, nextEvent());
+		for (i=0; i<events; i++) {
+			p=ev[i].data.ptr;
+			if (ev[i].events&EPOLLOUT) flush(p, answerTime(p));
+			if (ev[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR)) {
+				while ((n=read(p->fd, buf, sizeof(buf)))>0) {
+					for (j=0; j<n; j++) received(p, buf[j]);
+				}
+			}
+		}
+		t=nowMs();
+		active=0;
+		for (i=0; i<portCount; i++) {
+			p=&ports[i];
+			if (p->outPos<p->outLen && !p->writing && p->due<=t) flush(p, answerTime(p));
+			if (p->deadline && p->deadline<=t) timedOut(p);
+			if (p->state!=DONE && p->state!=FAILED) active++;
+		}
+	} while (active);
+	tEnd=nowMs();
+
+	printf("%-16s %-20s %8s %6s %9s %5s %7s  %s\n", "port", "image", "bytes", "blocks", "time", "again", "retries", "result");
+	//The total rate counts from the first block to the last EOT, without
+	//the wait for the boards to show up.
+	first=last=0;
+	for (i=0; i<portCount; i++) {
+		p=&ports[i];
+		printf("%-16s %-20s %8ld %6ld ", p->name, p->img->name, p->img->len, p->img->blocks);
+		if (p->tStart) printf("%8.1fs", (p->tEnd-p->tStart)/1000);
+		else printf("%9s", "-");
+		printf(" %5ld %7d  ", p->resent, p->retries);
+		if (p->state==DONE) {
+			printf("ok\n");
+			total+=p->img->blocks*128;
+			ok++;
+			if (first==0 || p->tStart<first) first=p->tStart;
+			if (p->tEnd>last) last=p->tEnd;
+		} else {
+			printf("failed: %s%s%s\n", p->why, p->last[0]?", last said: ":"", p->last);
+		}
+	}
+	t=ok?total*1000.0/(last-first):0;
+	printf("%d of %d boards done in %.1fs, %.0f bytes/s in total, %.1f times the %d bytes/s of one line\n",
+			ok, portCount, (tEnd-tStart)/1000, t, t/LINE_RATE, LINE_RATE);
+	return (ok==portCount)?0:1;
+}
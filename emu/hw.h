@@ -0,0 +1,59 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+//Models of the hardware around the emulated ATTiny85: the SPI flash chip and
+//the JTAG chain. Called from emu.c on pin changes.
+
+#ifndef EMU_HW_H
+#define EMU_HW_H
+
+#include <stdint.h>
+
+//Timed 25P40-style SPI flash. mem is the backing store of size bytes. With
+//modern set, a part with SFDP and smaller erases.
+void flashInit(uint8_t *mem, long size, double timeScale, int modern);
+void flashSelect(int selected);
+void flashClock(int rising, int d);
+int flashQ(void); //-1: not driven
+
+typedef struct {
+	long bytesRead;
+	long pagePrograms;
+	long sectorErases;
+	long chipErases;
+	double busyUs;
+} FlashStats;
+extern FlashStats flashStats;
+
+//JTAG chain. Spec is a comma-separated list of idcode:irlen[:drlen], listed
+//from TDI to TDO.
+int tapInit(const char *spec);
+void tapClock(int rising, int tms, int tdi);
+int tapTdo(void);
+
+typedef struct {
+	long tcks;
+	long irScans;
+	long drScans;
+	long resets;
+} TapStats;
+extern TapStats tapStats;
+
+#endif
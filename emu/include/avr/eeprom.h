@@ -0,0 +1,43 @@
+//Emulated EEPROM, backed by a file; see emu.c.
+#ifndef EMU_AVR_EEPROM_H
+#define EMU_AVR_EEPROM_H
+#include "emu.h"
+
+#define eeprom_read_byte(a) emuEepromRead((uintptr_t)(a))
+#define eeprom_write_byte(a, v) emuEepromWrite((uintptr_t)(a), (v))
+#define eeprom_update_byte(a, v) emuEepromWrite((uintptr_t)(a), (v))
+#define eeprom_busy_wait() emuEepromBusyWait()
+
+static inline uint16_t eeprom_read_word(const uint16_t *a) {
+	return emuEepromRead((uintptr_t)a)|(emuEepromRead((uintptr_t)a+1)<<8);
+}
+
+static inline void eeprom_update_word(uint16_t *a, uint16_t v) {
+	emuEepromWrite((uintptr_t)a, v&0xff);
+	emuEepromWrite((uintptr_t)a+1, v>>8);
+}
+
+static inline uint32_t eeprom_read_dword(const uint32_t *a) {
+	return eeprom_read_word((const uint16_t *)a)|((uint32_t)eeprom_read_word((const uint16_t *)((uintptr_t)a+2))<<16);
+}
+
+static inline void eeprom_update_dword(uint32_t *a, uint32_t v) {
+	eeprom_update_word((uint16_t *)a, v&0xffff);
+	eeprom_update_word((uint16_t *)((uintptr_t)a+2), v>>16);
+}
+
+static inline void eeprom_read_block(void *d, const void *a, unsigned int n) {
+	unsigned int x;
+	for (x=0; x<n; x++) ((uint8_t *)d)[x]=emuEepromRead((uintptr_t)a+x);
+}
+
+static inline void eeprom_update_block(const void *s, void *a, unsigned int n) {
+	unsigned int x;
+	for (x=0; x<n; x++) emuEepromWrite((uintptr_t)a+x, ((const uint8_t *)s)[x]);
+}
+
+#define eeprom_write_word eeprom_update_word
+#define eeprom_write_dword eeprom_update_dword
+#define eeprom_write_block eeprom_update_block
+
+#endif
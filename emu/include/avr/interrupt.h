@@ -0,0 +1,15 @@
+//Interrupts are called from the emulators timer thread.
+#ifndef EMU_AVR_INTERRUPT_H
+#define EMU_AVR_INTERRUPT_H
+#include "emu.h"
+
+#define TIM0_COMPA_vect emuIsrTim0CompA
+#define TIM0_COMPB_vect emuIsrTim0CompB
+#define PCINT0_vect emuIsrPcint0
+#define WDT_vect emuIsrWdt
+
+#define ISR(vect) void vect(void)
+#define sei() emuSei()
+#define cli() emuCli()
+
+#endif
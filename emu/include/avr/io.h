@@ -0,0 +1,80 @@
+//Emulated ATTiny85 registers; see emu.h.
+#ifndef EMU_AVR_IO_H
+#define EMU_AVR_IO_H
+#include "emu.h"
+
+#define PORTB	(*emuReg(EMU_PORTB))
+#define PINB	(*emuReg(EMU_PINB))
+#define DDRB	(*emuReg(EMU_DDRB))
+#define USICR	(*emuReg(EMU_USICR))
+#define USIDR	(*emuReg(EMU_USIDR))
+#define USISR	(*emuReg(EMU_USISR))
+#define OSCCAL	(*emuReg(EMU_OSCCAL))
+#define TCCR0A	(*emuReg(EMU_TCCR0A))
+#define TCCR0B	(*emuReg(EMU_TCCR0B))
+#define TCNT0	(*emuReg(EMU_TCNT0))
+#define OCR0A	(*emuReg(EMU_OCR0A))
+#define OCR0B	(*emuReg(EMU_OCR0B))
+#define TCCR1	(*emuReg(EMU_TCCR1))
+#define TCNT1	(*emuReg(EMU_TCNT1))
+#define TIMSK	(*emuReg(EMU_TIMSK))
+#define TIFR	(*emuReg(EMU_TIFR))
+#define GIMSK	(*emuReg(EMU_GIMSK))
+#define GIFR	(*emuReg(EMU_GIFR))
+#define PCMSK	(*emuReg(EMU_PCMSK))
+#define WDTCR	(*emuReg(EMU_WDTCR))
+#define MCUSR	(*emuReg(EMU_MCUSR))
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+
+#define USIWM1 5
+#define USIWM0 4
+#define USICS1 3
+#define USICS0 2
+#define USICLK 1
+#define USITC 0
+
+#define OCIE1A 6
+#define OCIE1B 5
+#define OCIE0A 4
+#define OCIE0B 3
+#define TOIE1 2
+#define TOIE0 1
+
+#define OCF1A 6
+#define OCF1B 5
+#define OCF0A 4
+#define OCF0B 3
+#define TOV1 2
+#define TOV0 1
+
+#define CS13 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+
+#define INT0 6
+#define PCIE 5
+#define INTF0 6
+#define PCIF 5
+
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+
+#endif
@@ -0,0 +1,28 @@
+//Program memory is just memory on the host.
+#ifndef EMU_AVR_PGMSPACE_H
+#define EMU_AVR_PGMSPACE_H
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) emuPgmReadWord(p)
+#define pgm_read_dword(p) emuPgmReadDword(p)
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+//The tables may be declared with a wider type on the host, so don't alias.
+static inline uint16_t emuPgmReadWord(const void *p) {
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t emuPgmReadDword(const void *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+#endif
@@ -0,0 +1,21 @@
+//Emulated watchdog. Times out in real time and resets the emulator.
+#ifndef EMU_AVR_WDT_H
+#define EMU_AVR_WDT_H
+#include "emu.h"
+
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+
+#define wdt_enable(t) emuWdtEnable(t)
+#define wdt_disable() emuWdtDisable()
+#define wdt_reset() emuWdtReset()
+
+#endif
@@ -0,0 +1,31 @@
+//avr-libc style stdio on top of the host one: FILE becomes a pair of
+//put/get callbacks and stdout/stdin are whatever the firmware points them at.
+#ifndef EMU_STDIO_H
+#define EMU_STDIO_H
+#include_next <stdio.h>
+
+#ifndef EMU_HOST
+#include "emu.h"
+
+#undef FILE
+#define FILE emuFILE
+#undef stdout
+#define stdout emuStdout
+#undef stdin
+#define stdin emuStdin
+//The firmware doesn't use printf (see print.c); keep it that way.
+#undef printf
+#define printf printf_is_not_in_the_firmware
+#undef putchar
+#define putchar emuPutchar
+#undef getchar
+#define getchar emuGetchar
+
+#define _FDEV_SETUP_READ 1
+#define _FDEV_SETUP_WRITE 2
+#define _FDEV_SETUP_RW 3
+#define FDEV_SETUP_STREAM(p, g, f) { (p), (g), (f) }
+#define fdev_setup_stream(s, p, g, f) do { (s)->put=(p); (s)->get=(g); (s)->flags=(f); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef EMU_UTIL_ATOMIC_H
+#define EMU_UTIL_ATOMIC_H
+#include "emu.h"
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (int emuAtomicState=emuIrqSave(), emuAtomicOnce=1; emuAtomicOnce; emuAtomicOnce=0, emuIrqRestore(emuAtomicState))
+
+#endif
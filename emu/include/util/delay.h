@@ -0,0 +1,9 @@
+//Delays take (scaled) real time in the emulator.
+#ifndef EMU_UTIL_DELAY_H
+#define EMU_UTIL_DELAY_H
+#include "emu.h"
+
+#define _delay_us(us) emuDelayUs(us)
+#define _delay_ms(ms) emuDelayUs((ms)*1000.0)
+
+#endif
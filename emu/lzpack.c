@@ -0,0 +1,177 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Compresses an xsvf for a compressed upload, in the format lz.c describes.
+Upload the result with any xmodem sender after pressing 'z', or with
+xmbench -z. The firmware copies matches out of its flash, so the window is
+as large as the format allows: 64K.
+
+Build with:
+gcc -O2 -o lzpack emu/lzpack.c
+
+Usage: lzpack in.xsvf out.lz
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW 65535
+#define MINMATCH 3
+#define MAXMATCH 130
+#define MAXLIT 128
+#define HASHSIZE 65536
+#define MAXCHAIN 1024
+
+static unsigned char *in, *out;
+static long inLen, outLen;
+static long *prevPos, head[HASHSIZE];
+
+static unsigned int hash(long pos) {
+	return ((in[pos]<<8)^(in[pos+1]<<4)^in[pos+2])&(HASHSIZE-1);
+}
+
+static void insert(long pos) {
+	unsigned int h;
+	if (pos+MINMATCH>inLen) return;
+	h=hash(pos);
+	prevPos[pos]=head[h];
+	head[h]=pos;
+}
+
+//Longest match for the data at pos. Returns the length, the distance goes
+//into *dist.
+static int findMatch(long pos, long *dist) {
+	long cand, max=inLen-pos;
+	int len, best=0, chain=0;
+	if (max<MINMATCH) return 0;
+	if (max>MAXMATCH) max=MAXMATCH;
+	for (cand=head[hash(pos)]; cand>=0 && pos-cand<=WINDOW && chain<MAXCHAIN; cand=prevPos[cand], chain++) {
+		for (len=0; len<max && in[cand+len]==in[pos+len]; len++) ;
+		if (len>best) {
+			best=len;
+			*dist=pos-cand;
+			if (len==max) break;
+		}
+	}
+	return (best>=MINMATCH)?best:0;
+}
+
+static void flushLiterals(long from, long to) {
+	long n;
+	while (from<to) {
+		n=to-from;
+		if (n>MAXLIT) n=MAXLIT;
+		out[outLen++]=n-1;
+		memcpy(&out[outLen], &in[from], n);
+		outLen+=n;
+		from+=n;
+	}
+}
+
+//Same as the firmware does, to make sure the output is right.
+static int check(void) {
+	unsigned char *buf=malloc(inLen+MAXMATCH);
+	long o=0, p=0, n, d;
+	while (p<outLen) {
+		if (out[p]&0x80) {
+			n=(out[p]&0x7f)+3;
+			d=(out[p+1]<<8)|out[p+2];
+			p+=3;
+			if (d==0) break;
+			if (d>o) return 0;
+			while (n--) {
+				buf[o]=buf[o-d];
+				o++;
+			}
+		} else {
+			n=out[p++]+1;
+			memcpy(&buf[o], &out[p], n);
+			o+=n;
+			p+=n;
+		}
+	}
+	n=(o==inLen && memcmp(buf, in, inLen)==0);
+	free(buf);
+	return n;
+}
+
+int main(int argc, char **argv) {
+	FILE *f;
+	long pos, lit=0, dist, nextDist, x;
+	int len, nextLen=0;
+
+	if (argc!=3) {
+		fprintf(stderr, "Usage: %s in.xsvf out.lz\n", argv[0]);
+		exit(1);
+	}
+	f=fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	inLen=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	in=malloc(inLen+1);
+	out=malloc(inLen+inLen/MAXLIT+16);
+	prevPos=malloc((inLen+1)*sizeof(long));
+	if (fread(in, 1, inLen, f)!=(size_t)inLen) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+	memset(head, 0xff, sizeof(head));
+
+	//Greedy, but don't take a match if the next byte starts a longer one.
+	pos=0;
+	while (pos<inLen) {
+		len=findMatch(pos, &dist);
+		insert(pos);
+		if (len) nextLen=findMatch(pos+1, &nextDist);
+		if (!len || nextLen>len) {
+			pos++;
+			continue;
+		}
+		flushLiterals(lit, pos);
+		out[outLen++]=0x80|(len-MINMATCH);
+		out[outLen++]=dist>>8;
+		out[outLen++]=dist;
+		for (x=1; x<len; x++) insert(pos+x);
+		pos+=len;
+		lit=pos;
+	}
+	flushLiterals(lit, inLen);
+	out[outLen++]=0x80;
+	out[outLen++]=0;
+	out[outLen++]=0;
+
+	if (!check()) {
+		fprintf(stderr, "Internal error: output doesn't decompress.\n");
+		exit(1);
+	}
+	f=fopen(argv[2], "wb");
+	if (!f || fwrite(out, 1, outLen, f)!=(size_t)outLen || fclose(f)) {
+		perror(argv[2]);
+		exit(1);
+	}
+	fprintf(stderr, "%ld -> %ld bytes (%.1fx)\n", inLen, outLen, outLen?(double)inLen/outLen:0.0);
+	return 0;
+}
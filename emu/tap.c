@@ -0,0 +1,164 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+Model of a JTAG chain for the emulator. Every device has an IR of irlen bits
+(capturing ...01), BYPASS (all ones), an IDCODE instruction and a data
+register of drlen bits that every other instruction selects. That data
+register is a plain shift register which keeps its contents between scans,
+so shifting it delays TDI by drlen bits; that's enough to give xsvf files
+a predictable TDO to check.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "hw.h"
+
+enum {
+	TLR, RTI, SELDR, CAPDR, SHDR, EX1DR, PDR, EX2DR, UPDR,
+	SELIR, CAPIR, SHIR, EX1IR, PIR, EX2IR, UPIR
+};
+
+//Next state for tms=0 and tms=1
+static const uint8_t nextState[16][2]={
+	{RTI, TLR}, {RTI, SELDR}, {CAPDR, SELIR}, {SHDR, EX1DR},
+	{SHDR, EX1DR}, {PDR, UPDR}, {PDR, EX2DR}, {SHDR, UPDR},
+	{RTI, SELDR}, {CAPIR, TLR}, {SHIR, EX1IR}, {SHIR, EX1IR},
+	{PIR, UPIR}, {PIR, EX2IR}, {SHIR, UPIR}, {RTI, SELDR}
+};
+
+typedef struct {
+	uint32_t idcode;
+	int irlen;
+	long drlen;
+	uint32_t idcodeIns;
+	uint32_t ins;
+	uint64_t irShift;
+	uint64_t drShift; //for BYPASS and IDCODE
+	uint8_t *data; //data register ring buffer, one bit per byte
+	long dataHead;
+} Dev;
+
+#define MAXDEVS 16
+
+TapStats tapStats;
+
+static Dev devs[MAXDEVS];
+static int noDevs;
+static int state=TLR;
+static int tdo=1;
+
+static int insIsBypass(Dev *d) {
+	return d->ins==(uint32_t)((1ULL<<d->irlen)-1);
+}
+
+static int insIsIdcode(Dev *d) {
+	return d->ins==d->idcodeIns;
+}
+
+static void reset(void) {
+	int i;
+	for (i=0; i<noDevs; i++) devs[i].ins=devs[i].idcodeIns;
+	tapStats.resets++;
+}
+
+//Parses idcode:irlen[:drlen[:idcodeins]], comma-separated. Returns 0 on error.
+int tapInit(const char *spec) {
+	char *s=strdup(spec), *tok, *save;
+	Dev *d;
+	noDevs=0;
+	for (tok=strtok_r(s, ",", &save); tok; tok=strtok_r(NULL, ",", &save)) {
+		if (noDevs==MAXDEVS) return 0;
+		d=&devs[noDevs++];
+		memset(d, 0, sizeof(Dev));
+		d->drlen=32;
+		d->idcodeIns=1;
+		if (sscanf(tok, "%i:%i:%li:%i", &d->idcode, &d->irlen, &d->drlen, &d->idcodeIns)<2) return 0;
+		if (d->irlen<2 || d->irlen>32 || d->drlen<1) return 0;
+		d->data=calloc(d->drlen, 1);
+	}
+	free(s);
+	reset();
+	return noDevs>0;
+}
+
+static int shiftDev(Dev *d, int in, int ir) {
+	int out;
+	if (ir) {
+		out=d->irShift&1;
+		d->irShift=(d->irShift>>1)|((uint64_t)in<<(d->irlen-1));
+	} else if (insIsBypass(d)) {
+		out=d->drShift&1;
+		d->drShift=in;
+	} else if (insIsIdcode(d)) {
+		out=d->drShift&1;
+		d->drShift=(d->drShift>>1)|((uint64_t)in<<31);
+	} else {
+		out=d->data[d->dataHead];
+		d->data[d->dataHead]=in;
+		if (++d->dataHead==d->drlen) d->dataHead=0;
+	}
+	return out;
+}
+
+static int lsbDev(Dev *d, int ir) {
+	if (ir) return d->irShift&1;
+	if (insIsBypass(d) || insIsIdcode(d)) return d->drShift&1;
+	return d->data[d->dataHead];
+}
+
+void tapClock(int rising, int tms, int tdi) {
+	int i, prev;
+	if (!rising) {
+		if (state==SHIR || state==SHDR) {
+			tdo=lsbDev(&devs[noDevs-1], state==SHIR);
+		} else {
+			tdo=1;
+		}
+		return;
+	}
+	tapStats.tcks++;
+	tdi=tdi?1:0;
+	if (state==CAPIR) {
+		for (i=0; i<noDevs; i++) devs[i].irShift=1;
+	} else if (state==CAPDR) {
+		for (i=0; i<noDevs; i++) {
+			if (insIsBypass(&devs[i])) devs[i].drShift=0;
+			else if (insIsIdcode(&devs[i])) devs[i].drShift=devs[i].idcode;
+		}
+	} else if (state==SHIR || state==SHDR) {
+		for (i=0; i<noDevs; i++) tdi=shiftDev(&devs[i], tdi, state==SHIR);
+	}
+	prev=state;
+	state=nextState[state][tms?1:0];
+	if (state==UPIR) {
+		for (i=0; i<noDevs; i++) devs[i].ins=devs[i].irShift;
+	} else if (state==TLR && prev!=TLR) {
+		reset();
+	}
+	if (state==CAPIR) tapStats.irScans++;
+	if (state==CAPDR) tapStats.drScans++;
+}
+
+int tapTdo(void) {
+	return tdo;
+}
@@ -0,0 +1,505 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Xmodem sender that times an upload. Works against the emulator pty as well
+as against a real board on a serial port. Reports the time until the first
+block is ACKed (which includes the chip erase), the upload speed and, when
+given the emulators statistics file, how long the firmware took from the
+end of the upload until the new configuration was loaded.
+
+Build with:
+gcc -O2 -o xmbench emu/xmbench.c
+
+Usage: xmbench [-s statsfile] [-S slot] [-l] [-z] [-w] [-d ms] port file.xsvf
+       xmbench [-l] [-d ms] -x port file.xsvf
+       xmbench [-S slot] [-k] -r|-R file port
+-S uploads to the given image slot instead of the current boot slot.
+-l dumps the firmwares log afterwards.
+-z uploads a file made by lzpack as a compressed upload.
+-w uses the windowed upload described in xmodem.c instead of xmodem.
+-d waits the given ms before answering the firmware, like the latency timer
+of a USB serial adapter does (16ms by default for FTDI chips). The emulator
+pty answers right away.
+-x has the firmware play the file straight from the serial port instead of
+uploading it, see stream.c, and reports how long that took.
+-r reads the image in the slot back into file, -R the whole flash. This uses
+xmodem-1K with CRCs, or plain xmodem with checksums when given -k.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <termios.h>
+#include <poll.h>
+
+#define SOH 0x01
+#define STX 0x02
+#define ACK 0x06
+#define NAK 0x15
+#define EOT 0x04
+#define CAN 0x18
+#define SYN 0x16
+#define WBLK 0x12
+
+#define WINDOW_BLOCK 64 //same as arena.h
+#define STREAM_CHUNK 64 //same as arena.h
+#define LINE_RATE 3840 //bytes/s 38400 baud carries, with start and stop bits
+
+#define RETRIES 10
+
+static int turnaround; //ms, see -d
+
+static double nowMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3+ts.tv_nsec/1e6;
+}
+
+//Read a byte, or return -1 after timeout ms.
+static int readTimed(int fd, int timeout) {
+	struct pollfd p;
+	unsigned char c;
+	p.fd=fd;
+	p.events=POLLIN;
+	if (poll(&p, 1, timeout)<=0) return -1;
+	if (read(fd, &c, 1)!=1) return -1;
+	return c;
+}
+
+//Wait for one of the two bytes; returns it or -1 on timeout. Anything else
+//the firmware says in between (like the flash ID) gets echoed.
+static int waitFor(int fd, int a, int b, int timeout) {
+	double end=nowMs()+timeout;
+	int c;
+	while (nowMs()<end) {
+		c=readTimed(fd, end-nowMs());
+		if (c==a || c==b) return c;
+		if (c>=0) fputc(c, stderr);
+	}
+	return -1;
+}
+
+static int openPort(const char *name) {
+	struct termios tio;
+	int fd=open(name, O_RDWR|O_NOCTTY);
+	if (fd<0) {
+		perror(name);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, B38400);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIFLUSH);
+	return fd;
+}
+
+//Count the 'configure done' lines the emulator has written to the stats file.
+static int statsLines(const char *name) {
+	char line[512];
+	int n=0;
+	FILE *f=fopen(name, "r");
+	if (!f) return 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (strstr(line, "configure done")) n++;
+	}
+	fclose(f);
+	return n;
+}
+
+static void dumpLog(int fd) {
+	int c;
+	if (write(fd, "l", 1)!=1) return;
+	while ((c=readTimed(fd, 500))>=0) {
+		if (c!=NAK) putchar(c);
+	}
+}
+
+//Wait for the start of a block or the end of the transfer. Returns SOH, STX,
+//EOT or -1 on timeout.
+static int waitBlock(int fd, int timeout) {
+	int c;
+	do {
+		c=readTimed(fd, timeout);
+	} while (c>=0 && c!=SOH && c!=STX && c!=EOT);
+	return c;
+}
+
+//Receive an xmodem(-1K) transfer into out. Returns the number of bytes, or -1.
+static long receive(int fd, FILE *out, int useCrc) {
+	unsigned char blk[1029], expect=1, sum, c;
+	unsigned int crc;
+	long total=0;
+	int n, x, i, len, ok, errors=0, r=-1;
+
+	//Ask for the first block until it comes.
+	for (i=0; i<10 && r<0; i++) {
+		c=useCrc?'C':NAK;
+		if (write(fd, &c, 1)!=1) return -1;
+		r=waitBlock(fd, 1000);
+	}
+	while (r==SOH || r==STX) {
+		len=(r==STX)?1024:128;
+		n=len+(useCrc?4:3);
+		for (x=0; x<n; x++) {
+			if ((r=readTimed(fd, 1000))<0) break;
+			blk[x]=r;
+		}
+		ok=(x==n && blk[0]==(blk[1]^0xff));
+		if (ok && useCrc) {
+			crc=0;
+			for (x=0; x<len; x++) {
+				crc^=blk[2+x]<<8;
+				for (i=0; i<8; i++) crc=(crc&0x8000)?(crc<<1)^0x1021:(crc<<1);
+			}
+			ok=((crc&0xffff)==(unsigned int)((blk[2+len]<<8)|blk[3+len]));
+		} else if (ok) {
+			sum=0;
+			for (x=0; x<len; x++) sum+=blk[2+x];
+			ok=(sum==blk[2+len]);
+		}
+		if (ok && blk[0]==expect) {
+			fwrite(&blk[2], 1, len, out);
+			total+=len;
+			expect++;
+		} else if (!ok || blk[0]!=(unsigned char)(expect-1)) {
+			//A repeat of the previous block means our ACK got lost; anything
+			//else is an error.
+			ok=0;
+			tcflush(fd, TCIFLUSH);
+			if (++errors==10) return -1;
+		}
+		c=ok?ACK:NAK;
+		if (write(fd, &c, 1)!=1) return -1;
+		r=waitBlock(fd, 3000);
+	}
+	if (r!=EOT) return -1;
+	c=ACK;
+	if (write(fd, &c, 1)!=1) return -1;
+	return total;
+}
+
+static unsigned int crc16(unsigned int crc, unsigned char b) {
+	int i;
+	crc^=b<<8;
+	for (i=0; i<8; i++) crc=(crc&0x8000)?(crc<<1)^0x1021:(crc<<1);
+	return crc&0xffff;
+}
+
+//Windowed upload. Sends all frames of the window the firmware doesn't have
+//yet in one write, then waits for its ACK with the first frame it misses and
+//a bitmap of the ones after that it got already. Returns the time of the
+//first ACK, or 0 if the upload failed. The first window is first bytes.
+static double sendWindowed(int fd, unsigned char *data, long len, long *first) {
+	unsigned char buf[256*(WINDOW_BLOCK+4)];
+	long frames=(len+WINDOW_BLOCK-1)/WINDOW_BLOCK, base=0, i, n, resent=0;
+	int size, x, tries=0, c, next, bitmap;
+	unsigned int crc;
+	unsigned char *state=calloc(frames+256, 1); //0: not sent yet, 1: sent, 2: ACKed
+	double tFirstAck=0;
+
+	//The firmware erases the slot before it answers.
+	c=SYN;
+	if (write(fd, &c, 1)!=1 || waitFor(fd, SYN, SYN, 30000)<0 || (size=readTimed(fd, 1000))<=0) {
+		fprintf(stderr, "No windowed upload support.\n");
+		return 0;
+	}
+	fprintf(stderr, "Window of %d frames of %d bytes\n", size, WINDOW_BLOCK);
+	*first=size*WINDOW_BLOCK;
+	while (base<frames) {
+		n=0;
+		for (i=base; i<base+size && i<frames; i++) {
+			if (state[i]==2) continue;
+			if (state[i]==1) resent++;
+			state[i]=1;
+			buf[n++]=WBLK;
+			buf[n++]=i;
+			crc=crc16(0, i&0xff);
+			for (x=0; x<WINDOW_BLOCK; x++) {
+				buf[n++]=data[i*WINDOW_BLOCK+x];
+				crc=crc16(crc, data[i*WINDOW_BLOCK+x]);
+			}
+			buf[n++]=crc>>8;
+			buf[n++]=crc;
+		}
+		if (turnaround) usleep(turnaround*1000);
+		if (write(fd, buf, n)!=n) {
+			perror("write");
+			exit(1);
+		}
+
+		//ACK next bitmap; next is the frame number modulo 256.
+		c=waitFor(fd, ACK, CAN, 3000);
+		if (c==CAN) {
+			fprintf(stderr, "Upload cancelled by the firmware.\n");
+			return 0;
+		}
+		next=(c==ACK)?readTimed(fd, 1000):-1;
+		bitmap=(next>=0)?readTimed(fd, 1000):-1;
+		if (bitmap<0 || (unsigned char)(next-base)>size) {
+			fprintf(stderr, "Window at frame %ld: %s, retrying\n", base, (c==ACK)?"bad ACK":"timeout");
+			if (++tries==RETRIES) {
+				fprintf(stderr, "Giving up on frame %ld.\n", base);
+				return 0;
+			}
+			continue;
+		}
+		if (tFirstAck==0) tFirstAck=nowMs();
+		for (n=(unsigned char)(next-base); n>0; n--) state[base++]=2;
+		for (x=0; x<size-1; x++) {
+			if (bitmap&(1<<x)) state[base+1+x]=2;
+		}
+		tries=0;
+	}
+	if (resent) fprintf(stderr, "%ld frames sent again\n", resent);
+	free(state);
+	return tFirstAck;
+}
+
+//Answer the chunk requests of the firmware playing a streamed xsvf until it
+//says how that went. Returns 1 on success.
+static int stream(int fd, unsigned char *data, long len) {
+	unsigned char buf[STREAM_CHUNK+3], sum;
+	long next=0, chunk, off, chunks=0, resent=0;
+	int c, n, inv, i;
+	double tStart=nowMs();
+	if (write(fd, "x", 1)!=1) return 0;
+	while (1) {
+		//Everything up to the sync byte is TCK toggling TXD.
+		do {
+			c=readTimed(fd, 10000);
+		} while (c>=0 && c!=0xff);
+		if (c<0) {
+			fprintf(stderr, "Stream: the firmware stopped asking.\n");
+			return 0;
+		}
+		//The line idles high, so there may be more 0xFFs in front.
+		do {
+			c=readTimed(fd, 100);
+		} while (c==0xff);
+		if (c=='E') {
+			c=readTimed(fd, 100);
+			break;
+		}
+		n=readTimed(fd, 100);
+		inv=readTimed(fd, 100);
+		if (c!='C' || n<0 || inv!=(n^0xff)) continue;
+		//The next chunk, or the last one again if it didn't arrive intact.
+		if (n==(next&255)) {
+			chunk=next++;
+			chunks++;
+		} else if (next && n==((next-1)&255)) {
+			chunk=next-1;
+			resent++;
+		} else {
+			continue;
+		}
+		off=chunk*STREAM_CHUNK;
+		n=(len-off<STREAM_CHUNK)?len-off:STREAM_CHUNK;
+		if (n<0) n=0;
+		buf[0]=n;
+		buf[1]=chunk;
+		sum=buf[0]+buf[1];
+		for (i=0; i<n; i++) sum+=buf[2+i]=data[off+i];
+		buf[2+n]=sum;
+		if (turnaround) usleep(turnaround*1000);
+		if (write(fd, buf, n+3)!=n+3) {
+			perror("write");
+			exit(1);
+		}
+	}
+	printf("size:           %ld bytes, %ld chunks, %ld sent again\n", len, chunks, resent);
+	printf("stream:         %.1f ms, %.0f bytes/s, %s\n", nowMs()-tStart,
+			len*1000.0/(nowMs()-tStart), (c==1)?"success":"failed");
+	return (c==1);
+}
+
+//Read the file to upload, padded to a whole block with 0xff.
+static unsigned char *loadFile(const char *name, long *len) {
+	unsigned char *data;
+	FILE *f=fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	*len=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data=malloc(*len+128);
+	memset(data, 0xff, *len+128);
+	if (fread(data, 1, *len, f)!=(size_t)*len) {
+		perror(name);
+		exit(1);
+	}
+	fclose(f);
+	return data;
+}
+
+//Have the firmware send the selected slot or the whole flash back.
+static int readBack(int fd, const char *name, int whole, int useCrc) {
+	FILE *out=fopen(name, "wb");
+	char key=whole?'f':'r';
+	double tStart;
+	long len;
+	if (!out) {
+		perror(name);
+		return 1;
+	}
+	if (write(fd, &key, 1)!=1) return 1;
+	usleep(50000); //a 'C' sent while it looks at the flash would get lost
+	tStart=nowMs();
+	len=receive(fd, out, useCrc);
+	fclose(out);
+	if (len<0) {
+		fprintf(stderr, "Receive failed.\n");
+		return 1;
+	}
+	printf("size:           %ld bytes\n", len);
+	printf("readback:       %.1f ms, %.0f bytes/s\n", nowMs()-tStart, len*1000.0/(nowMs()-tStart));
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *statsFile=NULL, *readFile=NULL;
+	unsigned char *data=NULL, blk[132];
+	long len=0, pos, first=128;
+	int fd, opt, c, x, tries, doLog=0, before=0, slot=-1, whole=0, useCrc=1, lz=0, windowed=0, streamed=0;
+	unsigned char block=1, sum;
+	double tStart, tFirstAck=0, tEot, tDone, rate;
+
+	while ((opt=getopt(argc, argv, "s:S:lkzwxd:r:R:"))!=-1) {
+		if (opt=='s') statsFile=optarg;
+		else if (opt=='S') slot=atoi(optarg);
+		else if (opt=='l') doLog=1;
+		else if (opt=='k') useCrc=0;
+		else if (opt=='z') lz=1;
+		else if (opt=='w') windowed=1;
+		else if (opt=='x') streamed=1;
+		else if (opt=='d') turnaround=atoi(optarg);
+		else if (opt=='r' || opt=='R') {
+			readFile=optarg;
+			whole=(opt=='R');
+		} else break;
+	}
+	if (argc-optind!=(readFile?1:2)) {
+		fprintf(stderr, "Usage: %s [-s statsfile] [-S slot] [-l] [-z] [-w] [-d ms] port file.xsvf\n", argv[0]);
+		fprintf(stderr, "       %s [-l] [-d ms] -x port file.xsvf\n", argv[0]);
+		fprintf(stderr, "       %s [-S slot] [-k] -r|-R file port\n", argv[0]);
+		exit(1);
+	}
+	if (!readFile) data=loadFile(argv[optind+1], &len);
+
+	fd=openPort(argv[optind]);
+	if (statsFile) before=statsLines(statsFile);
+
+	//The receiver NAKs once when it starts and then every 3 seconds.
+	fprintf(stderr, "Waiting for receiver...\n");
+	if (waitFor(fd, NAK, NAK, 10000)<0) {
+		fprintf(stderr, "No NAK from receiver.\n");
+		exit(1);
+	}
+	if (slot>=0) {
+		//Select the slot and wait for the firmware to confirm it.
+		c='0'+slot;
+		if (write(fd, &c, 1)!=1 || waitFor(fd, '\n', '\n', 2000)<0) {
+			fprintf(stderr, "Couldn't select slot %d.\n", slot);
+			exit(1);
+		}
+	}
+	if (lz && (write(fd, "z", 1)!=1 || waitFor(fd, '\n', '\n', 2000)<0)) {
+		fprintf(stderr, "Couldn't select a compressed upload.\n");
+		exit(1);
+	}
+	tcflush(fd, TCIFLUSH); //drop older NAKs, they'd look like a NAK on the first block
+	if (readFile) return readBack(fd, readFile, whole, useCrc);
+	if (streamed) {
+		x=stream(fd, data, len);
+		if (doLog && waitFor(fd, NAK, NAK, 10000)>=0) dumpLog(fd);
+		return x?0:1;
+	}
+
+	tStart=nowMs();
+	if (windowed) {
+		tFirstAck=sendWindowed(fd, data, len, &first);
+		if (tFirstAck==0) exit(1);
+		len=(len+WINDOW_BLOCK-1)/WINDOW_BLOCK*WINDOW_BLOCK;
+	}
+	for (pos=0; pos<len && !windowed; pos+=128) {
+		blk[0]=SOH;
+		blk[1]=block;
+		blk[2]=block^0xff;
+		memcpy(&blk[3], &data[pos], 128);
+		sum=0;
+		for (x=0; x<128; x++) sum+=blk[3+x];
+		blk[131]=sum;
+		for (tries=0; tries<RETRIES; tries++) {
+			if (turnaround) usleep(turnaround*1000);
+			if (write(fd, blk, sizeof(blk))!=sizeof(blk)) {
+				perror("write");
+				exit(1);
+			}
+			c=waitFor(fd, ACK, NAK, 10000);
+			if (c==ACK) break;
+			fprintf(stderr, "Block %d: %s, retrying\n", block, (c==NAK)?"NAK":"timeout");
+		}
+		if (tries==RETRIES) {
+			fprintf(stderr, "Giving up on block %d.\n", block);
+			exit(1);
+		}
+		if (pos==0) tFirstAck=nowMs();
+		block++;
+	}
+	tEot=nowMs();
+	//A windowed upload ends with EOT and the number of frames.
+	blk[0]=EOT;
+	blk[1]=len/WINDOW_BLOCK;
+	if (write(fd, blk, windowed?2:1)!=(windowed?2:1) || waitFor(fd, ACK, ACK, 5000)<0) {
+		fprintf(stderr, "No ACK on EOT.\n");
+		exit(1);
+	}
+	tcflush(fd, TCIFLUSH);
+
+	x=windowed?WINDOW_BLOCK:128;
+	printf("size:           %ld bytes, %ld blocks\n", len, (len+x-1)/x);
+	printf("first ACK:      %.1f ms\n", tFirstAck-tStart);
+	printf("upload:         %.1f ms, %.0f bytes/s\n", tEot-tStart, len*1000.0/(tEot-tStart));
+	rate=(len>first)?(len-first)*1000.0/(tEot-tFirstAck):0.0;
+	printf("upload w/o 1st: %.0f bytes/s, %.0f%% of the %d bytes/s of the line\n", rate, rate*100/LINE_RATE, LINE_RATE);
+
+	if (statsFile) {
+		//The firmware reconfigures after its watchdog resets it.
+		while (statsLines(statsFile)<=before && nowMs()-tEot<60000) usleep(10000);
+		tDone=nowMs();
+		if (statsLines(statsFile)>before) {
+			printf("EOT to config:  %.1f ms\n", tDone-tEot);
+		} else {
+			printf("EOT to config:  timed out\n");
+		}
+	}
+
+	if (doLog) {
+		//Wait for the firmware to get back to xmodem, then ask for the log.
+		if (waitFor(fd, NAK, NAK, 10000)>=0) dumpLog(fd);
+	}
+	return 0;
+}
@@ -0,0 +1,631 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Generates synthetic xsvf files to benchmark the player with, in a few shapes
+that stand in for the real thing:
+ fpga    one giant configuration stream of XSDRB/XSDRC/XSDRE records of -l
+         bits, -s bits in all, mostly runs of zeroes like a bitstream, and
+         a readback of the end of it with XSDRTDO.
+ cpld    -n short loops of an XSIR and an XSDRTDO of -l bits, with an
+         XRUNTEST of -w before every XSDRTDO, like programming a CPLD.
+ chain   an IDCODE check of every device in the chain, then -n XSDRTDO
+         scans of -l bits to device -t. The other devices get padded with
+         XHIR/XTIR/XHDR/XTDR, or, with -p, in the scans themselves like
+         svf2xsvf does.
+ churn   -n random steps of XSTATE, XENDIR/XENDDR, XRUNTEST and scans of a
+         few bits, for as much TAP routing per byte as possible.
+Every record gets played on the same model of the chain the emulator has
+(emu/tap.c), routed like jtag.c does, so the TDO the XSDRTDOs expect is what
+the emulated chain really gives back. That also gives the TCKs and scans the
+emulator should count when the firmware plays the file: the numbers in its
+stats line. With -f n, compare n gets a wrong bit, so the file must fail.
+
+emu/corpus.txt is the reference corpus: a list of these workloads with the
+numbers they should give. -C generates all of them and checks them.
+
+Build with:
+gcc -O2 -Wall -o xsvfgen emu/xsvfgen.c emu/tap.c
+
+Usage: xsvfgen [options] shape out.xsvf
+       xsvfgen -C corpus.txt [-o dir]
+ -c chain  the chain, like the emulator's -c (default 0x01414093:6:32:0x09)
+ -t n      the device to talk to, counted from TDI (default 0)
+ -n n      loops or steps (default 200 for cpld, 16 for chain, 1000 for churn)
+ -s bits   length of the fpga stream (default 1048576)
+ -l bits   bits per scan (default 1024 for fpga, 32 otherwise)
+ -w n      XRUNTEST cycles for cpld (default 1)
+ -d pct    percentage of random bytes in the fpga stream (default 20)
+ -p        chain: padding in the scans instead of XHIR/XTIR/XHDR/XTDR
+ -r seed   random seed (default 1)
+ -f n      make compare n (counting from 1) fail
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hw.h"
+
+//xsvf records, see xsvf.c
+#define XCOMPLETE	0x00
+#define XTDOMASK	0x01
+#define XSIR		0x02
+#define XRUNTEST	0x04
+#define XSDRSIZE	0x08
+#define XSDRTDO		0x09
+#define XSDRB		0x0c
+#define XSDRC		0x0d
+#define XSDRE		0x0e
+#define XSTATE		0x12
+#define XENDIR		0x13
+#define XENDDR		0x14
+#define XHIR		0x20
+#define XTIR		0x21
+#define XHDR		0x22
+#define XTDR		0x23
+
+//Same as jtag.h
+#define JTAG_TESTLOGICRESET		0
+#define JTAG_RUNTEST			1
+#define JTAG_SHIFTDR			4
+#define JTAG_PAUSEDR			6
+#define JTAG_SHIFTIR			11
+#define JTAG_PAUSEIR			13
+
+//Same tables as jtag.c
+static const unsigned char nextStates[]={
+	0x01, 0x21, 0x93, 0x54, 0x54, 0x86, 0x76, 0x84,
+	0x21, 0x0A, 0xCB, 0xCB, 0xFD, 0xED, 0xFB, 0x21
+};
+
+static const unsigned int routingTable[]={
+	0x0001, 0xFFFD, 0xFE03, 0xFFE7, 0xFFEF, 0xFF0F, 0xFFBF, 0xFF0F,
+	0xFEFD, 0x01FF, 0xF3FF, 0xF7FF, 0x87FF, 0xDFFF, 0x87FF, 0x7FFD
+};
+
+#define MAXSCAN 1408 //MAXTDOBYTES*8 from arena.h, the longest scan xsvf.c takes
+#define MAXCMP 64 //MAXTDIBYTES*8, the bits of a scan xsvf.c compares
+#define MAXDEVS 16 //same as tap.c
+
+typedef struct {
+	const char *shape, *chain;
+	int target, count, len, wait, density, explicitPad, failAt;
+	long bits;
+	unsigned long seed;
+} Opts;
+
+//The chain, parsed like tap.c does.
+typedef struct {
+	unsigned long idcode, idcodeIns;
+	int irlen;
+	long drlen;
+} Dev;
+
+static Dev devs[MAXDEVS];
+static int noDevs;
+
+static unsigned char *out;
+static long outLen, outSize;
+static int state, endir, enddr, hir, tir, hdr, tdr;
+static long sdrsize, runtest, compares, failRecord, failAt;
+static unsigned long rnd;
+
+static void need(long n) {
+	if (outLen+n<=outSize) return;
+	outSize=(outLen+n)*2;
+	out=realloc(out, outSize);
+	if (!out) {
+		perror("realloc");
+		exit(1);
+	}
+}
+
+static void put(int b) {
+	need(1);
+	out[outLen++]=b;
+}
+
+static void putNum(unsigned long n, int bytes) {
+	while (bytes--) put(n>>(bytes*8));
+}
+
+//Bit n of buf gets shifted out n-th; the xsvf has it msb-first.
+static void putBits(const unsigned char *buf, long bits) {
+	long i;
+	for (i=(bits+7)/8-1; i>=0; i--) put(buf[i]);
+}
+
+#define BIT(buf, n) (((buf)[(n)/8]>>((n)%8))&1)
+#define SETBIT(buf, n, v) do { if (v) (buf)[(n)/8]|=1<<((n)%8); else (buf)[(n)/8]&=~(1<<((n)%8)); } while (0)
+
+//Same numbers on every platform, so the corpus stays the same.
+static int random8(void) {
+	rnd=(rnd*1103515245UL+12345UL)&0xffffffffUL;
+	return (rnd>>16)&0xff;
+}
+
+static void randomBits(unsigned char *buf, long bits) {
+	long i;
+	for (i=0; i<(bits+7)/8; i++) buf[i]=random8();
+}
+
+//One TCK on the emulated chain. Like ioJtagClock(), TDO is what the chain
+//drove since the last falling edge.
+static int clock(int tms, int tdi) {
+	int tdo=tapTdo();
+	tapClock(1, tms, tdi);
+	tapClock(0, tms, tdi);
+	return tdo;
+}
+
+static void step(int tms) {
+	state=tms?(nextStates[state]>>4):(nextStates[state]&15);
+}
+
+static void gotoState(int s) {
+	int tms;
+	while (state!=s) {
+		tms=(routingTable[state]>>s)&1;
+		clock(tms, 1);
+		step(tms);
+	}
+}
+
+//Shifts bits of buf, or of tdi if buf is NULL, raising TMS on the last one if
+//last is set. What comes out goes to tdo if that's given.
+static void shift(const unsigned char *buf, int tdi, long bits, int last, unsigned char *tdo) {
+	long i;
+	int b;
+	for (i=0; i<bits; i++) {
+		b=clock(last && i==bits-1, buf?BIT(buf, i):tdi);
+		if (tdo) SETBIT(tdo, i, b);
+	}
+	if (last && bits) step(1);
+}
+
+//The end of an XSIR or XSDR(TDO): the XRUNTEST wait, or the end state.
+static void finish(int ir) {
+	long i;
+	if (runtest) {
+		gotoState(JTAG_RUNTEST);
+		for (i=0; i<runtest; i++) clock(0, 0);
+	} else {
+		gotoState(ir?endir:enddr);
+	}
+}
+
+static void xsir(const unsigned char *ins, int bits) {
+	put(XSIR);
+	put(bits);
+	putBits(ins, bits);
+	gotoState(JTAG_SHIFTIR);
+	shift(NULL, 1, hir, 0, NULL);
+	shift(ins, 0, bits, tir==0, NULL);
+	shift(NULL, 1, tir, 1, NULL);
+	finish(1);
+}
+
+static void xsdrsize(long bits) {
+	put(XSDRSIZE);
+	putNum(bits, 4);
+	sdrsize=bits;
+}
+
+static void xtdomask(const unsigned char *mask) {
+	put(XTDOMASK);
+	putBits(mask, sdrsize);
+}
+
+//An XSDRTDO expecting what the chain gives back. If this is the compare that
+//has to fail, the first bit mask selects gets flipped.
+static void xsdrtdo(const unsigned char *tdi, const unsigned char *mask) {
+	unsigned char tdo[MAXSCAN/8];
+	long i;
+	gotoState(JTAG_SHIFTDR);
+	shift(NULL, 0, hdr, 0, NULL);
+	shift(tdi, 0, sdrsize, tdr==0, tdo);
+	shift(NULL, 0, tdr, 1, NULL);
+	finish(0);
+	if (++compares==failAt) {
+		for (i=0; i<sdrsize && !BIT(mask, i); i++) ;
+		if (i<sdrsize) {
+			tdo[i/8]^=1<<(i%8);
+			failRecord=outLen;
+		}
+	}
+	put(XSDRTDO);
+	putBits(tdi, sdrsize);
+	putBits(tdo, sdrsize);
+}
+
+static void xsdrbce(int ins, const unsigned char *tdi) {
+	put(ins);
+	putBits(tdi, sdrsize);
+	if (ins==XSDRB) {
+		gotoState(JTAG_SHIFTDR);
+		shift(NULL, 0, hdr, 0, NULL);
+	}
+	shift(tdi, 0, sdrsize, ins==XSDRE && tdr==0, NULL);
+	if (ins==XSDRE) {
+		shift(NULL, 0, tdr, 1, NULL);
+		gotoState(enddr);
+	}
+}
+
+static void xstate(int s) {
+	put(XSTATE);
+	put(s);
+	gotoState(s);
+}
+
+static void xruntest(long cycles) {
+	put(XRUNTEST);
+	putNum(cycles, 4);
+	runtest=cycles;
+}
+
+static void xend(int ins, int pause) {
+	put(ins);
+	put(pause);
+	if (ins==XENDIR) endir=pause?JTAG_PAUSEIR:JTAG_RUNTEST;
+	else enddr=pause?JTAG_PAUSEDR:JTAG_RUNTEST;
+}
+
+static void xpad(int ins, int bits, int *var) {
+	if (*var==bits) return;
+	put(ins);
+	putNum(bits, 2);
+	*var=bits;
+}
+
+//Pads everything but device t: the devices after it come first.
+static void padFor(int t) {
+	int i, h=0, l=0;
+	for (i=t+1; i<noDevs; i++) h+=devs[i].irlen;
+	for (i=0; i<t; i++) l+=devs[i].irlen;
+	xpad(XHIR, h, &hir);
+	xpad(XTIR, l, &tir);
+	xpad(XHDR, noDevs-1-t, &hdr);
+	xpad(XTDR, t, &tdr);
+}
+
+//An instruction of device t that selects its data register.
+static unsigned long dataIns(int t) {
+	unsigned long i, bypass=(1UL<<devs[t].irlen)-1;
+	for (i=2; i==devs[t].idcodeIns || i==bypass; i++) ;
+	return i;
+}
+
+static void setBits(unsigned char *buf, long pos, unsigned long v, int bits) {
+	int i;
+	for (i=0; i<bits; i++) SETBIT(buf, pos+i, (v>>i)&1);
+}
+
+//Sets bits pos up to pos+bits of buf, for a TDO mask.
+static void ones(unsigned char *buf, long pos, long bits) {
+	while (bits--) SETBIT(buf, pos+bits, 1);
+}
+
+//Instruction ins for device t. With explicit padding, the other devices get
+//BYPASS in the same scan; the ones closest to TDO get shifted first.
+static void target(int t, unsigned long ins, int explicitPad) {
+	unsigned char buf[MAXSCAN/8];
+	int i, pos=0;
+	if (!explicitPad) {
+		padFor(t);
+		setBits(buf, 0, ins, devs[t].irlen);
+		xsir(buf, devs[t].irlen);
+		return;
+	}
+	for (i=noDevs-1; i>=0; i--) {
+		setBits(buf, pos, (i==t)?ins:~0UL, devs[i].irlen);
+		pos+=devs[i].irlen;
+	}
+	xsir(buf, pos);
+}
+
+static int fpga(Opts *o) {
+	unsigned char buf[MAXSCAN/8], mask[MAXCMP/8];
+	long pos, n, i, len=o->len?o->len:1024;
+	int r;
+	if (len>MAXSCAN) {
+		fprintf(stderr, "fpga: -l can be %d bits at most\n", MAXSCAN);
+		return 0;
+	}
+	//There has to be at least an XSDRB and an XSDRE.
+	if (o->bits<2) o->bits=2;
+	if (len>=o->bits) len=(o->bits+1)/2;
+	target(o->target, dataIns(o->target), 0);
+	xsdrsize(len);
+	for (pos=0; pos<o->bits; pos+=n) {
+		n=(o->bits-pos<len)?o->bits-pos:len;
+		if (n!=sdrsize) xsdrsize(n);
+		//Mostly zeroes, some ones, a few random bytes.
+		for (i=0; i<(n+7)/8; i++) {
+			r=random8()%100;
+			buf[i]=(r<o->density)?random8():(r<o->density+10)?0xff:0;
+		}
+		xsdrbce((pos==0)?XSDRB:(pos+n==o->bits)?XSDRE:XSDRC, buf);
+	}
+	//Read back the end of the stream, which the data register still holds.
+	n=(devs[o->target].drlen<MAXCMP)?devs[o->target].drlen:MAXCMP;
+	xsdrsize(n);
+	memset(mask, 0, sizeof(mask));
+	ones(mask, 0, n);
+	xtdomask(mask);
+	memset(buf, 0, sizeof(buf));
+	xsdrtdo(buf, mask);
+	return 1;
+}
+
+static int cpld(Opts *o) {
+	unsigned char tdi[MAXCMP/8], mask[MAXCMP/8], ins[4];
+	int i, len=o->len?o->len:32;
+	if (len>MAXCMP) {
+		fprintf(stderr, "cpld: -l can be %d bits at most, xsvf.c compares no more\n", MAXCMP);
+		return 0;
+	}
+	padFor(o->target);
+	setBits(ins, 0, dataIns(o->target), devs[o->target].irlen);
+	xsdrsize(len);
+	memset(mask, 0, sizeof(mask));
+	ones(mask, 0, len);
+	xtdomask(mask);
+	for (i=0; i<(o->count?o->count:200); i++) {
+		if (o->wait) xruntest(0);
+		xsir(ins, devs[o->target].irlen);
+		if (o->wait) xruntest(o->wait);
+		randomBits(tdi, len);
+		xsdrtdo(tdi, mask);
+	}
+	return 1;
+}
+
+static int chain(Opts *o) {
+	unsigned char tdi[MAXCMP/8], mask[MAXCMP/8];
+	int i, d, len=o->len?o->len:32, extra=o->explicitPad?noDevs-1:0;
+	if (len+extra>MAXCMP || 32+extra>MAXCMP) {
+		fprintf(stderr, "chain: scans can be %d bits at most, xsvf.c compares no more\n", MAXCMP);
+		return 0;
+	}
+	//The IDCODE of every device, then the data scans to the target. With
+	//explicit padding, the BYPASS bits of the devices closer to TDO come
+	//out first; those don't get compared.
+	for (d=0; d<=noDevs; d++) {
+		i=(d<noDevs)?d:o->target;
+		target(i, (d<noDevs)?devs[i].idcodeIns:dataIns(i), o->explicitPad);
+		xsdrsize(((d<noDevs)?32:len)+extra);
+		memset(mask, 0, sizeof(mask));
+		ones(mask, o->explicitPad?noDevs-1-i:0, (d<noDevs)?32:len);
+		xtdomask(mask);
+		if (d<noDevs) {
+			memset(tdi, 0, sizeof(tdi));
+			xsdrtdo(tdi, mask);
+		}
+	}
+	for (i=0; i<(o->count?o->count:16); i++) {
+		randomBits(tdi, sdrsize);
+		xsdrtdo(tdi, mask);
+	}
+	return 1;
+}
+
+static int churn(Opts *o) {
+	static const int states[]={JTAG_TESTLOGICRESET, JTAG_RUNTEST, JTAG_PAUSEDR, JTAG_PAUSEIR};
+	unsigned char tdi[1], mask[1], ins[4];
+	unsigned long bypass=(1UL<<devs[o->target].irlen)-1;
+	int i, r;
+	padFor(o->target);
+	for (i=0; i<(o->count?o->count:1000); i++) {
+		r=random8()%16;
+		if (r<4) {
+			xstate(states[random8()%4]);
+		} else if (r<6) {
+			xend((r==4)?XENDIR:XENDDR, random8()&1);
+		} else if (r<7) {
+			//Mostly no wait; they're 1ms each.
+			xruntest((random8()<32)?1:0);
+		} else if (r<10) {
+			r=random8()%3;
+			setBits(ins, 0, (r==0)?bypass:(r==1)?devs[o->target].idcodeIns:dataIns(o->target), devs[o->target].irlen);
+			xsir(ins, devs[o->target].irlen);
+		} else {
+			r=1+random8()%8;
+			if (r!=sdrsize) {
+				xsdrsize(r);
+				mask[0]=0;
+				ones(mask, 0, r);
+				xtdomask(mask);
+			}
+			randomBits(tdi, r);
+			xsdrtdo(tdi, mask);
+		}
+	}
+	return 1;
+}
+
+//Parses the chain like tap.c does.
+static int parseChain(const char *spec) {
+	char *s=strdup(spec), *tok, *save;
+	Dev *d;
+	noDevs=0;
+	for (tok=strtok_r(s, ",", &save); tok; tok=strtok_r(NULL, ",", &save)) {
+		if (noDevs==MAXDEVS) return 0;
+		d=&devs[noDevs++];
+		d->drlen=32;
+		d->idcodeIns=1;
+		if (sscanf(tok, "%li:%i:%li:%li", (long *)&d->idcode, &d->irlen, &d->drlen, (long *)&d->idcodeIns)<2) return 0;
+		if (d->irlen<2 || d->irlen>32 || d->drlen<1) return 0;
+	}
+	free(s);
+	return noDevs>0;
+}
+
+//Generates the xsvf for o into out. Returns 0 on bad options.
+static int generate(Opts *o) {
+	int i, ok;
+	if (!parseChain(o->chain) || !tapInit(o->chain)) {
+		fprintf(stderr, "Can't parse chain %s\n", o->chain);
+		return 0;
+	}
+	if (o->target<0 || o->target>=noDevs) {
+		fprintf(stderr, "There's no device %d in the chain\n", o->target);
+		return 0;
+	}
+	outLen=0;
+	rnd=o->seed;
+	memset(&tapStats, 0, sizeof(tapStats));
+	state=JTAG_TESTLOGICRESET;
+	endir=JTAG_RUNTEST;
+	enddr=JTAG_RUNTEST;
+	hir=tir=hdr=tdr=0;
+	sdrsize=32;
+	runtest=0;
+	compares=0;
+	failRecord=-1;
+	failAt=o->failAt;
+	//What jtagReset() does before the first record.
+	for (i=0; i<32; i++) clock(1, 1);
+	state=JTAG_TESTLOGICRESET;
+
+	if (strcmp(o->shape, "fpga")==0) ok=fpga(o);
+	else if (strcmp(o->shape, "cpld")==0) ok=cpld(o);
+	else if (strcmp(o->shape, "chain")==0) ok=chain(o);
+	else if (strcmp(o->shape, "churn")==0) ok=churn(o);
+	else {
+		fprintf(stderr, "Unknown shape %s\n", o->shape);
+		return 0;
+	}
+	put(XCOMPLETE);
+	return ok;
+}
+
+static void usage(const char *me) {
+	fprintf(stderr, "Usage: %s [-c chain] [-t target] [-n count] [-s bits] [-l bits] [-w cycles]\n"
+			"  [-d pct] [-p] [-r seed] [-f compare] fpga|cpld|chain|churn out.xsvf\n"
+			"       %s -C corpus.txt [-o dir]\n", me, me);
+	exit(1);
+}
+
+//Parses the options of one workload; returns the index of the first
+//argument after them, or -1 if they're bad.
+static int parseOpts(int argc, char **argv, Opts *o) {
+	int c;
+	memset(o, 0, sizeof(Opts));
+	o->chain="0x01414093:6:32:0x09";
+	o->bits=1048576;
+	o->wait=1;
+	o->density=20;
+	o->seed=1;
+	optind=0; //not 1: glibc only forgets the previous argv with 0
+	while ((c=getopt(argc, argv, "c:t:n:s:l:w:d:pr:f:"))!=-1) {
+		if (c=='c') o->chain=optarg;
+		else if (c=='t') o->target=atoi(optarg);
+		else if (c=='n') o->count=atoi(optarg);
+		else if (c=='s') o->bits=atol(optarg);
+		else if (c=='l') o->len=atoi(optarg);
+		else if (c=='w') o->wait=atoi(optarg);
+		else if (c=='d') o->density=atoi(optarg);
+		else if (c=='p') o->explicitPad=1;
+		else if (c=='r') o->seed=strtoul(optarg, NULL, 0);
+		else if (c=='f') o->failAt=atoi(optarg);
+		else return -1;
+	}
+	if (optind>=argc) return -1;
+	o->shape=argv[optind];
+	return optind+1;
+}
+
+static int writeOut(const char *name) {
+	FILE *f=fopen(name, "wb");
+	if (!f || fwrite(out, 1, outLen, f)!=(size_t)outLen || fclose(f)) {
+		perror(name);
+		return 0;
+	}
+	return 1;
+}
+
+//The result column of the corpus: pass, or fail with the offset of the
+//XSDRTDO that should fail.
+static const char *result(char *buf, int size) {
+	if (failRecord<0) snprintf(buf, size, "pass");
+	else snprintf(buf, size, "fail@%lx", failRecord);
+	return buf;
+}
+
+//Every line of the corpus is a name, the expected size, TCKs, IR and DR scans
+//and result, and the options and shape to generate it with. Generates them
+//all into dir and checks them. Returns the number that didn't match.
+static int corpus(const char *list, const char *dir) {
+	char line[1024], name[256], res[64], want[64], file[1024], *argv[64], *save;
+	long bytes, tcks, irs, drs;
+	int argc, n, bad=0;
+	Opts o;
+	FILE *f=fopen(list, "r");
+	if (!f) {
+		perror(list);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0]=='#' || sscanf(line, "%255s %ld %ld %ld %ld %63s %n", name, &bytes, &tcks, &irs, &drs, want, &n)<6) continue;
+		argv[0]="xsvfgen";
+		argc=1;
+		for (argv[argc]=strtok_r(line+n, " \t\n", &save); argv[argc] && argc<62; argv[argc]=strtok_r(NULL, " \t\n", &save)) argc++;
+		if (parseOpts(argc, argv, &o)!=argc || !generate(&o)) {
+			printf("%-16s bad options\n", name);
+			bad++;
+			continue;
+		}
+		snprintf(file, sizeof(file), "%s/%s.xsvf", dir, name);
+		if (!writeOut(file)) exit(1);
+		result(res, sizeof(res));
+		if (bytes!=outLen || tcks!=tapStats.tcks || irs!=tapStats.irScans || drs!=tapStats.drScans || strcmp(want, res)) {
+			printf("%-16s %8ld %10ld %6ld %6ld %-10s MISMATCH, expected %ld %ld %ld %ld %s\n", name, outLen,
+					tapStats.tcks, tapStats.irScans, tapStats.drScans, res, bytes, tcks, irs, drs, want);
+			bad++;
+		} else {
+			printf("%-16s %8ld %10ld %6ld %6ld %-10s -c %s\n", name, outLen, tapStats.tcks, tapStats.irScans,
+					tapStats.drScans, res, o.chain);
+		}
+	}
+	fclose(f);
+	return bad;
+}
+
+int main(int argc, char **argv) {
+	char res[64];
+	Opts o;
+	int i;
+
+	if (argc>=3 && strcmp(argv[1], "-C")==0) {
+		if (argc!=3 && (argc!=5 || strcmp(argv[3], "-o"))) usage(argv[0]);
+		mkdir((argc==5)?argv[4]:".", 0777);
+		i=corpus(argv[2], (argc==5)?argv[4]:".");
+		if (i) printf("%d workloads don't match the corpus\n", i);
+		return i?1:0;
+	}
+	i=parseOpts(argc, argv, &o);
+	if (i!=argc-1) usage(argv[0]);
+	if (!generate(&o) || !writeOut(argv[i])) exit(1);
+	printf("%s: %ld bytes, %ld TCKs, %ld IR/%ld DR scans, %ld compares, %s\n", argv[i], outLen,
+			tapStats.tcks, tapStats.irScans, tapStats.drScans, compares, result(res, sizeof(res)));
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Packs an xsvf into the format unpack.c describes, so it takes less flash and
+plays with fewer flash reads. Runs of 0x00 and 0xFF get run-length encoded,
+and TDI/TDO/mask payloads that occurred before get replaced by a reference
+to the first one. Upload the result like any xsvf.
+
+Build with:
+gcc -O2 -o xsvfpack emu/xsvfpack.c
+
+Usage: xsvfpack in.xsvf out.xsvp
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNMIN 4 //shorter runs are cheaper as literals
+#define MAXRUN 8192
+#define MAXCOPY 16384
+#define MINCOPY 8
+#define MAXLIT 128
+
+static unsigned char *in, *out;
+static long inLen, outLen, litStart=-1;
+
+//Payloads seen so far: where they are in the input and where their tokens
+//start in the output.
+typedef struct {
+	long inPos, len, tokPos;
+} Payload;
+static Payload *seen;
+static int seenCount;
+
+//The pending literals are in[litStart..pos).
+static void flushLiterals(long pos) {
+	long n;
+	while (litStart>=0 && litStart<pos) {
+		n=pos-litStart;
+		if (n>MAXLIT) n=MAXLIT;
+		out[outLen++]=n-1;
+		memcpy(&out[outLen], &in[litStart], n);
+		outLen+=n;
+		litStart+=n;
+	}
+	litStart=-1;
+}
+
+//Encode in[pos..pos+len) with literals and runs.
+static void emit(long pos, long len) {
+	long end=pos+len, run, n;
+	while (pos<end) {
+		run=0;
+		if (in[pos]==0x00 || in[pos]==0xff) {
+			while (pos+run<end && in[pos+run]==in[pos]) run++;
+		}
+		if (run<RUNMIN) {
+			if (litStart<0) litStart=pos;
+			pos++;
+			continue;
+		}
+		flushLiterals(pos);
+		while (run) {
+			n=(run>MAXRUN)?MAXRUN:run;
+			out[outLen++]=((in[pos]==0xff)?0xA0:0x80)|((n-1)>>8);
+			out[outLen++]=n-1;
+			pos+=n;
+			run-=n;
+		}
+	}
+}
+
+//Encode a TDI/TDO/mask payload, as a copy if it's been seen before.
+static void emitPayload(long pos, long len) {
+	int i;
+	long o;
+	if (len>=MINCOPY && len<=MAXCOPY) {
+		for (i=0; i<seenCount; i++) {
+			if (seen[i].len==len && memcmp(&in[seen[i].inPos], &in[pos], len)==0) break;
+		}
+		flushLiterals(pos);
+		if (i<seenCount) {
+			o=seen[i].tokPos;
+			out[outLen++]=0xC0|((len-1)>>8);
+			out[outLen++]=len-1;
+			out[outLen++]=o>>16;
+			out[outLen++]=o>>8;
+			out[outLen++]=o;
+			return;
+		}
+		seen[seenCount].inPos=pos;
+		seen[seenCount].len=len;
+		seen[seenCount].tokPos=outLen-4;
+		seenCount++;
+	}
+	emit(pos, len);
+}
+
+static long getNum(long pos, int bytes) {
+	long r=0;
+	while (bytes--) r=(r<<8)|in[pos++];
+	return r;
+}
+
+//Walks the records and packs them. Anything we don't know how to parse just
+//gets packed without looking for payloads.
+static void pack(void) {
+	long pos=0, sdrBytes=4, n, len, head;
+	int payloads, i;
+	unsigned char ins;
+	while (pos<inLen) {
+		//n is the length of the arguments, the last payloads*len bytes of
+		//which are TDI/TDO/mask payloads.
+		ins=in[pos];
+		n=-1;
+		payloads=0;
+		len=0;
+		if (ins==0x00) { //XCOMPLETE
+			n=0;
+		} else if (ins==0x01 || ins==0x03 || (ins>=0x0C && ins<=0x0E)) { //XTDOMASK, XSDR, XSDR[BCE]
+			payloads=1;
+			len=sdrBytes;
+			n=len;
+		} else if (ins==0x09 || (ins>=0x0F && ins<=0x11)) { //XSDRTDO[BCE]
+			payloads=2;
+			len=sdrBytes;
+			n=len*2;
+		} else if (ins==0x02 && pos+1<inLen) { //XSIR
+			payloads=1;
+			len=(in[pos+1]+7)/8;
+			n=1+len;
+		} else if (ins==0x15 && pos+2<inLen) { //XSIR2
+			payloads=1;
+			len=(getNum(pos+1, 2)+7)/8;
+			n=2+len;
+		} else if (ins==0x04 || ins==0x24) { //XRUNTEST, XIDENT
+			n=4;
+		} else if (ins==0x08 && pos+4<inLen) { //XSDRSIZE
+			n=4;
+			sdrBytes=(getNum(pos+1, 4)+7)/8;
+		} else if (ins==0x07 || (ins>=0x12 && ins<=0x14)) { //XREPEAT, XSTATE, XENDIR, XENDDR
+			n=1;
+		} else if (ins>=0x20 && ins<=0x23) { //X[HT][ID]R
+			n=2;
+		} else if (ins==0x17) { //XWAIT
+			n=6;
+		} else if (ins==0x16) { //XCOMMENT
+			for (n=0; pos+1+n<inLen && in[pos+1+n]; n++) ;
+			n++;
+		}
+		if (n<0 || pos+1+n>inLen) break;
+		head=1+n-payloads*len;
+		emit(pos, head);
+		for (i=0; i<payloads; i++) emitPayload(pos+head+i*len, len);
+		pos+=1+n;
+	}
+	if (pos<inLen) {
+		fprintf(stderr, "Can't parse the xsvf past 0x%lx, packing the rest as is.\n", pos);
+		emit(pos, inLen-pos);
+	}
+	flushLiterals(inLen);
+}
+
+//Same as the firmware does, to make sure the output is right.
+static int check(void) {
+	unsigned char *buf=malloc(inLen+1);
+	long o=0, p=4, ret=0, copyLeft=0, count=0, r;
+	int type=0, c;
+	while (o<inLen) {
+		while (count==0) {
+			if (p>=outLen) return 0;
+			c=out[p++];
+			if (c<0x80) {
+				type=0;
+				count=c+1;
+			} else if (c<0xC0) {
+				type=(c&0x20)?2:1;
+				count=(((c&0x1f)<<8)|out[p++])+1;
+			} else {
+				if (copyLeft) return 0;
+				copyLeft=(((c&0x3f)<<8)|out[p])+1;
+				r=(out[p+1]<<16)|(out[p+2]<<8)|out[p+3];
+				ret=p+4;
+				p=4+r;
+			}
+		}
+		buf[o++]=(type==0)?out[p++]:(type==2)?0xff:0;
+		count--;
+		if (copyLeft && --copyLeft==0) {
+			p=ret;
+			count=0;
+		}
+	}
+	r=(memcmp(buf, in, inLen)==0 && p==outLen);
+	free(buf);
+	return r;
+}
+
+int main(int argc, char **argv) {
+	FILE *f;
+
+	if (argc!=3) {
+		fprintf(stderr, "Usage: %s in.xsvf out.xsvp\n", argv[0]);
+		exit(1);
+	}
+	f=fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	inLen=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	in=malloc(inLen+1);
+	out=malloc(inLen+inLen/MAXLIT+16);
+	seen=malloc((inLen/MINCOPY+1)*sizeof(Payload));
+	if (fread(in, 1, inLen, f)!=(size_t)inLen) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+
+	memcpy(out, "XSVP", 4);
+	outLen=4;
+	pack();
+	if (!check()) {
+		fprintf(stderr, "Internal error: output doesn't unpack.\n");
+		exit(1);
+	}
+	f=fopen(argv[2], "wb");
+	if (!f || fwrite(out, 1, outLen, f)!=(size_t)outLen || fclose(f)) {
+		perror(argv[2]);
+		exit(1);
+	}
+	fprintf(stderr, "%ld -> %ld bytes (%.1fx), %d distinct payloads\n", inLen, outLen, outLen?(double)inLen/outLen:0.0, seenCount);
+	return 0;
+}
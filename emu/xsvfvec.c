@@ -0,0 +1,426 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Compiles an xsvf into the pin vectors vector.c plays or, with -b, into the
+bytecode bytecode.c runs; both formats are described there. It walks the
+records like xsvf.c does and works out the TCKs that would give: the TAP
+routing, chain padding, bit order and end states all get resolved here. TDO
+gets compared for every bit the mask selects, not just the first few bytes.
+An XIDENT check is left out, the result always plays everything.
+
+Build with:
+gcc -O2 -o xsvfvec emu/xsvfvec.c
+
+Usage: xsvfvec [-b] in.xsvf out.xsvv
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Same as jtag.h
+#define JTAG_TESTLOGICRESET		0
+#define JTAG_RUNTEST			1
+#define JTAG_SHIFTDR			4
+#define JTAG_PAUSEDR			6
+#define JTAG_SHIFTIR			11
+#define JTAG_PAUSEIR			13
+
+//Bits of a vector, see vector.c
+#define V_TDO 1
+#define V_TDI 2
+#define V_TMS 4
+#define V_CMP 8
+#define V_SKIP 0x1
+#define V_END 0x01
+#define V_WAIT 0x11
+#define V_CHECK 0x21
+#define V_REPEAT 0x31
+#define RUNMIN 9 //shorter runs are cheaper as plain vectors
+
+//Bytecode, see bytecode.c
+#define B_END 0x00
+#define B_TMS 0x01
+#define B_SHIFT 0x02
+#define B_SHIFTCMP 0x03
+#define B_FILL 0x04
+#define B_WAIT 0x05
+#define B_SHIFTEXP 0x06
+#define B_LASTTMS 0x80
+#define B_MAXBITS 65528 //longest shift in one instruction, a multiple of 8
+
+//Same tables as jtag.c
+static const unsigned char nextStates[]={
+	0x01, 0x21, 0x93, 0x54, 0x54, 0x86, 0x76, 0x84,
+	0x21, 0x0A, 0xCB, 0xCB, 0xFD, 0xED, 0xFB, 0x21
+};
+
+static const unsigned int routingTable[]={
+	0x0001, 0xFFFD, 0xFE03, 0xFFE7, 0xFFEF, 0xFF0F, 0xFFBF, 0xFF0F,
+	0xFEFD, 0x01FF, 0xF3FF, 0xF7FF, 0x87FF, 0xDFFF, 0x87FF, 0x7FFD
+};
+
+static unsigned char *in, *out;
+static long inLen, inPos, outLen, outSize, tcks, checks;
+static int half=-1; //low nibble waiting for its high one, -1 if none
+static int runVec=-1; //vector the pending run repeats, -1 if none
+static long runLen;
+static int state, bytecode;
+static unsigned char tmsBits[65536/8];
+static long tmsLen;
+
+//Makes room for n more bytes of output.
+static void need(long n) {
+	if (outLen+n<=outSize) return;
+	outSize=(outLen+n)*2;
+	out=realloc(out, outSize);
+	if (!out) {
+		perror("realloc");
+		exit(1);
+	}
+}
+
+static void putNibble(int v) {
+	need(1);
+	if (half<0) {
+		half=v;
+	} else {
+		out[outLen++]=half|(v<<4);
+		half=-1;
+	}
+}
+
+static void putRaw(int c) {
+	if (half>=0) putNibble(V_SKIP);
+	need(4);
+	out[outLen++]=c;
+}
+
+//Writes out the pending run of identical vectors.
+static void flushRun(void) {
+	long n;
+	while (runLen>=RUNMIN) {
+		n=(runLen>65535)?65535:runLen;
+		putRaw(V_REPEAT);
+		out[outLen++]=n>>8;
+		out[outLen++]=n;
+		out[outLen++]=runVec;
+		runLen-=n;
+	}
+	while (runLen) {
+		putNibble(runVec);
+		runLen--;
+	}
+	runVec=-1;
+}
+
+static void putCommand(int c) {
+	flushRun();
+	putRaw(c);
+}
+
+static void vecClock(int tms, int tdi, int cmp, int tdo) {
+	int v=(tms?V_TMS:0)|(tdi?V_TDI:0);
+	if (cmp) v|=V_CMP|(tdo?V_TDO:0);
+	if (v!=runVec) {
+		flushRun();
+		runVec=v;
+	}
+	runLen++;
+}
+
+static void putWord(long w) {
+	out[outLen++]=w>>8;
+	out[outLen++]=w;
+}
+
+//Writes out the pending TMS burst.
+static void flushTms(void) {
+	long i, n;
+	for (i=0; i<tmsLen; i+=n) {
+		n=(tmsLen-i>248)?248:tmsLen-i;
+		need(2+(n+7)/8);
+		out[outLen++]=B_TMS;
+		out[outLen++]=n;
+		memcpy(&out[outLen], &tmsBits[i/8], (n+7)/8);
+		outLen+=(n+7)/8;
+	}
+	memset(tmsBits, 0, sizeof(tmsBits));
+	tmsLen=0;
+}
+
+static void putOp(int op) {
+	flushTms();
+	need(4);
+	out[outLen++]=op;
+}
+
+static void step(int tms) {
+	state=(tms?(nextStates[state]>>4):(nextStates[state]&15));
+	tcks++;
+}
+
+//Clocks TMS with TDI high, to move to another TAP state.
+static void tmsClock(int tms) {
+	if (bytecode) {
+		if (tmsLen==sizeof(tmsBits)*8) flushTms();
+		if (tms) tmsBits[tmsLen/8]|=1<<(tmsLen%8);
+		tmsLen++;
+	} else {
+		vecClock(tms, 1, 0, 0);
+	}
+	step(tms);
+}
+
+static void gotoState(int s) {
+	while (state!=s) tmsClock((routingTable[state]>>s)&1);
+}
+
+//XRUNTEST: the cycles are clocked in Run-Test/Idle, 1ms each like xsvf.c does.
+static void wait(long cycles) {
+	long n;
+	while (cycles>0) {
+		n=(cycles>65535)?65535:cycles;
+		if (bytecode) putOp(B_WAIT); else putCommand(V_WAIT);
+		putWord(n);
+		cycles-=n;
+		tcks+=n;
+	}
+}
+
+static int getByte(void) {
+	if (inPos>=inLen) {
+		fprintf(stderr, "Unexpected end of the xsvf\n");
+		exit(1);
+	}
+	return in[inPos++];
+}
+
+static long getNum(int bytes) {
+	long r=0;
+	while (bytes--) r=(r<<8)|getByte();
+	return r;
+}
+
+//Reads a payload of bits. The xsvf has it msb-first; bit n of the result is
+//the n-th one that gets shifted out.
+static void readBits(unsigned char *buf, long bits) {
+	long n=(bits+7)/8, i;
+	for (i=0; i<n; i++) buf[n-1-i]=getByte();
+}
+
+#define BIT(buf, n) (((buf)[(n)/8]>>((n)%8))&1)
+
+//Shifts bits of padding, raising TMS on the last one if last is set.
+static void pad(long bits, int tdi, int last) {
+	long i, n;
+	if (bytecode) {
+		for (i=0; i<bits; i+=n) {
+			n=(bits-i>B_MAXBITS)?B_MAXBITS:bits-i;
+			putOp(B_FILL|((last && i+n==bits)?B_LASTTMS:0));
+			putWord(n);
+			out[outLen++]=tdi?0xff:0;
+		}
+	} else {
+		for (i=0; i<bits; i++) vecClock(last && i==bits-1, tdi, 0, 0);
+	}
+	for (i=0; i<bits; i++) step(last && i==bits-1);
+}
+
+//Byte n of the bits in buf, with the ones past the end cleared.
+static int getBits(unsigned char *buf, long n, long bits) {
+	int b=0, i;
+	for (i=0; i<8 && n*8+i<bits; i++) b|=BIT(buf, n*8+i)<<i;
+	return b;
+}
+
+//Byte n of bits ones.
+static int ones(long n, long bits) {
+	return (bits-n*8>=8)?0xff:(1<<(bits-n*8))-1;
+}
+
+//Shifts the data, comparing TDO against tdo where mask is set if tdo is given.
+static void shift(long bits, unsigned char *tdi, unsigned char *tdo, unsigned char *mask, int last) {
+	long i, j, n;
+	int op, m, all;
+	if (bytecode) {
+		for (i=0; i<bits; i+=n) {
+			n=(bits-i>B_MAXBITS)?B_MAXBITS:bits-i;
+			//Compare nothing, everything, or what the mask says.
+			op=B_SHIFT;
+			all=1;
+			for (j=i/8; tdo && j<(i+n+7)/8; j++) {
+				m=getBits(mask, j, bits);
+				if (m) op=B_SHIFTCMP;
+				if (m!=ones(j, bits)) all=0;
+			}
+			if (op==B_SHIFTCMP && all) op=B_SHIFTEXP;
+			putOp(op|((last && i+n==bits)?B_LASTTMS:0));
+			putWord(n);
+			need((n+7)/8*3);
+			for (j=i/8; j<(i+n+7)/8; j++) {
+				out[outLen++]=getBits(tdi, j, bits);
+				if (op!=B_SHIFT) out[outLen++]=getBits(tdo, j, bits)&getBits(mask, j, bits);
+				if (op==B_SHIFTCMP) out[outLen++]=getBits(mask, j, bits);
+			}
+		}
+	} else {
+		for (i=0; i<bits; i++) {
+			vecClock(last && i==bits-1, BIT(tdi, i), tdo && BIT(mask, i), tdo && BIT(tdo, i));
+		}
+	}
+	for (i=0; i<bits; i++) step(last && i==bits-1);
+}
+
+static void compile(void) {
+	long sdrsize=32, len, runtest=0;
+	unsigned int hir=0, tir=0, hdr=0, tdr=0;
+	int endir=JTAG_RUNTEST, enddr=JTAG_RUNTEST, ins, check;
+	unsigned char *tdi=calloc(65536/8+1, 1);
+	unsigned char *tdo=calloc(65536/8+1, 1);
+	unsigned char *mask=calloc(65536/8+1, 1);
+
+	//jtagReset()
+	for (len=0; len<32; len++) tmsClock(1);
+	state=JTAG_TESTLOGICRESET;
+
+	while (1) {
+		ins=getByte();
+		check=0;
+		if (ins==0x00) { //XCOMPLETE
+			if (bytecode) putOp(B_END); else putCommand(V_END);
+			return;
+		} else if (ins==0x01) { //XTDOMASK
+			readBits(mask, sdrsize);
+		} else if (ins==0x07) { //XREPEAT, unimplemented like in xsvf.c
+			getByte();
+		} else if (ins==0x04) { //XRUNTEST
+			runtest=getNum(4);
+		} else if (ins==0x02 || ins==0x15) { //XSIR, XSIR2
+			len=getNum((ins==0x15)?2:1);
+			readBits(tdi, len);
+			gotoState(JTAG_SHIFTIR);
+			pad(hir, 1, 0);
+			shift(len, tdi, NULL, NULL, tir==0);
+			pad(tir, 1, 1);
+		} else if (ins==0x03 || ins==0x09) { //XSDR, XSDRTDO
+			readBits(tdi, sdrsize);
+			if (ins==0x09) readBits(tdo, sdrsize);
+			gotoState(JTAG_SHIFTDR);
+			pad(hdr, 0, 0);
+			shift(sdrsize, tdi, tdo, mask, tdr==0);
+			pad(tdr, 0, 1);
+			check=1;
+		} else if (ins==0x08) { //XSDRSIZE
+			sdrsize=getNum(4);
+			if (sdrsize>65536) {
+				fprintf(stderr, "XSDRSIZE of %ld bits is too big\n", sdrsize);
+				exit(1);
+			}
+		} else if (ins>=0x0C && ins<=0x11) { //XSDR[BCE], XSDRTDO[BCE]
+			check=(ins>=0x0F);
+			readBits(tdi, sdrsize);
+			if (check) readBits(tdo, sdrsize);
+			if (ins==0x0C || ins==0x0F) {
+				gotoState(JTAG_SHIFTDR);
+				pad(hdr, 0, 0);
+			}
+			if (ins==0x0E || ins==0x11) {
+				shift(sdrsize, tdi, check?tdo:NULL, mask, tdr==0);
+				pad(tdr, 0, 1);
+				gotoState(enddr);
+			} else {
+				shift(sdrsize, tdi, check?tdo:NULL, mask, 0);
+			}
+		} else if (ins==0x12) { //XSTATE
+			gotoState(getByte());
+		} else if (ins==0x13) { //XENDIR
+			endir=getByte()?JTAG_PAUSEIR:JTAG_RUNTEST;
+		} else if (ins==0x14) { //XENDDR
+			enddr=getByte()?JTAG_PAUSEDR:JTAG_RUNTEST;
+		} else if (ins>=0x20 && ins<=0x23) { //X[HT][ID]R
+			len=getNum(2);
+			if (ins==0x20) hir=len;
+			if (ins==0x21) tir=len;
+			if (ins==0x22) hdr=len;
+			if (ins==0x23) tdr=len;
+		} else if (ins==0x24) { //XIDENT
+			inPos+=getNum(4);
+		} else {
+			fprintf(stderr, "Invalid instruction %x at 0x%lx\n", ins, inPos-1);
+			exit(1);
+		}
+		//The bytecode compares as part of the shift.
+		if (check) {
+			if (!bytecode) putCommand(V_CHECK);
+			checks++;
+		}
+
+		//Finish XSIR and XSDR[TDO]
+		if (ins==0x02 || ins==0x15 || ins==0x03 || ins==0x09) {
+			if (runtest) {
+				gotoState(JTAG_RUNTEST);
+				wait(runtest);
+			} else {
+				gotoState((ins==0x02 || ins==0x15)?endir:enddr);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	FILE *f;
+
+	if (argc==4 && strcmp(argv[1], "-b")==0) {
+		bytecode=1;
+		argv++;
+		argc--;
+	}
+	if (argc!=3) {
+		fprintf(stderr, "Usage: %s [-b] in.xsvf out.xsvv\n", argv[0]);
+		exit(1);
+	}
+	f=fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	inLen=ftell(f);
+	fseek(f, 0, SEEK_SET);
+	in=malloc(inLen+1);
+	if (fread(in, 1, inLen, f)!=(size_t)inLen) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+	need(4);
+	memcpy(out, bytecode?"XSVB":"XSVV", 4);
+	outLen=4;
+
+	compile();
+	f=fopen(argv[2], "wb");
+	if (!f || fwrite(out, 1, outLen, f)!=(size_t)outLen || fclose(f)) {
+		perror(argv[2]);
+		exit(1);
+	}
+	fprintf(stderr, "%ld -> %ld bytes, %ld TCKs, %ld compares\n", inLen, outLen, tcks, checks);
+	return 0;
+}
@@ -0,0 +1,616 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Xilinx Virtual Cable server for a board in bridge mode (see bridge.c), so
+Vivado, openocd and friends can use the board as a JTAG cable. It listens on
+localhost for one XVC client at a time.
+
+XVC sends TMS and TDI for every TCK and wants TDO for every one back. That
+gets turned into the firmware's commands by following the TAP state here:
+bits in Shift-DR/IR become BRIDGE_SHIFT, the rest BRIDGE_TMS, and long runs
+in a stable state BRIDGE_RUN. The commands of all shifts the client has sent
+so far get packed into batches as big as the firmware takes, so the serial
+line only turns around once per batch instead of once per shift.
+
+A batch may only end where the firmware can park the TAP (bridge.c), so the
+bits after the last such place wait for the next shift. They're never in a
+Shift state, so their TDO means nothing and gets answered right away as 1s,
+like an undriven TDO with a pull-up.
+
+Build with:
+gcc -O2 -Wall -o xvcd emu/xvcd.c
+
+Usage: xvcd [-p port] [-v] serialport
+-p is the TCP port to listen on (default 2542).
+-v prints every batch and a summary for every client.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define NAK 0x15
+#define SYNC 0xff
+
+#define BRIDGE_BUF 256 //same as arena.h
+#define BRIDGE_TMS 0x01 //same as bridge.h
+#define BRIDGE_SHIFT 0x02
+#define BRIDGE_RUN 0x03
+#define BRIDGE_EXIT 0x10
+#define BRIDGE_TDO 0x20
+
+#define MAXVECTOR 8192 //bytes of TMS (and of TDI) in one XVC shift
+#define MAXJOB (1<<20) //bits of shifts packed together at most
+#define RUNMIN 24 //identical bits in a stable state that become a BRIDGE_RUN
+#define TCK_BASE_NS 2000 //about the TCK period without delay, at the normal clock
+#define RETRIES 10
+#define ANSWERTIME 5000 //ms to wait for the answer to a batch
+
+//TAP states, numbered like jtag.h
+enum {
+	TLR=0, RTI, SELDR, CAPDR, SHIFTDR, EXIT1DR, PAUSEDR, EXIT2DR, UPDDR,
+	SELIR, CAPIR, SHIFTIR, EXIT1IR, PAUSEIR, EXIT2IR, UPDIR
+};
+
+static const unsigned char next[16][2]={
+	{RTI, TLR}, {RTI, SELDR}, {CAPDR, SELIR}, {SHIFTDR, EXIT1DR},
+	{SHIFTDR, EXIT1DR}, {PAUSEDR, UPDDR}, {PAUSEDR, EXIT2DR}, {SHIFTDR, UPDDR},
+	{RTI, SELDR}, {CAPIR, TLR}, {SHIFTIR, EXIT1IR}, {SHIFTIR, EXIT1IR},
+	{PAUSEIR, UPDIR}, {PAUSEIR, EXIT2IR}, {SHIFTIR, UPDIR}, {RTI, SELDR}
+};
+
+//A batch being packed. op is where the open command starts, -1 if none.
+typedef struct {
+	unsigned char buf[BRIDGE_BUF+8];
+	int len, op, n, tdo, opTdo, run;
+} Batch;
+
+//One XVC shift, waiting for its TDO.
+typedef struct {
+	int bits, start;
+	unsigned char *tdo;
+} Shift;
+
+static int serial, verbose;
+static unsigned char seq;
+static volatile int quit;
+
+//The bits of the shifts being run (and in front, the ones left over from
+//before), and where their TDO ends up in the answers.
+static unsigned char *jobTms, *jobTdi;
+static long *jobTdo;
+static int jobBits;
+static Shift shifts[64];
+static int shiftCount;
+static int tapState=TLR; //after the bits the firmware ran
+
+//Packed batches and their answers.
+static Batch *batches;
+static int batchCount, batchAlloc;
+static unsigned char *answers;
+static long answerLen;
+
+static struct {
+	long shifts, bits, batches, lineBytes;
+	double ms;
+} stats;
+
+static double nowMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e3+ts.tv_nsec/1e6;
+}
+
+static int readTimed(int fd, int timeout) {
+	struct pollfd p;
+	unsigned char c;
+	p.fd=fd;
+	p.events=POLLIN;
+	if (poll(&p, 1, timeout)<=0) return -1;
+	if (read(fd, &c, 1)!=1) return -1;
+	stats.lineBytes++;
+	return c;
+}
+
+static void serialWrite(const unsigned char *buf, int len) {
+	if (write(serial, buf, len)!=len) {
+		perror("serial write");
+		exit(1);
+	}
+	stats.lineBytes+=len;
+}
+
+static int openPort(const char *name) {
+	struct termios tio;
+	int fd=open(name, O_RDWR|O_NOCTTY);
+	if (fd<0) {
+		perror(name);
+		exit(1);
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, B38400);
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIFLUSH);
+	return fd;
+}
+
+//Reads the next 0xFF type n ~n the firmware sends, skipping the garbage TCK
+//makes on TXD. For 'R', also reads the rest into buf and checks it: *len
+//gets the TDO bytes, or -1 if the answer didn't arrive intact. Returns the
+//type, or -1 on timeout.
+static int readFrame(int timeout, int *n, unsigned char *buf, int *len) {
+	static unsigned char scratch[BRIDGE_BUF];
+	double end=nowMs()+timeout;
+	int c, inv, ok, i, l;
+	unsigned char sum;
+	if (!buf) buf=scratch;
+	while (1) {
+		do {
+			c=readTimed(serial, end-nowMs());
+		} while (c>=0 && c!=SYNC);
+		if (c<0) return -1;
+		//The line idles high, so there may be more 0xFFs in front.
+		do {
+			c=readTimed(serial, 100);
+		} while (c==SYNC);
+		*n=readTimed(serial, 100);
+		inv=readTimed(serial, 100);
+		if (c<0 || *n<0 || inv!=(*n^0xff)) continue;
+		if (c!='R') return c;
+		ok=readTimed(serial, 100);
+		l=readTimed(serial, 100);
+		l|=readTimed(serial, 100)<<8;
+		*len=-1;
+		if (ok<0 || l<0 || l>BRIDGE_BUF) return c;
+		sum=ok+l+(l>>8);
+		for (i=0; i<l; i++) {
+			c=readTimed(serial, 100);
+			if (c<0) return 'R';
+			sum+=buf[i]=c;
+		}
+		if (readTimed(serial, 100)!=sum) return 'R';
+		if (!ok) fprintf(stderr, "xvcd: the firmware couldn't run batch %d\n", *n);
+		*len=l;
+		return 'R';
+	}
+}
+
+//Sends a batch and gets its TDO into answers. Returns 0 if the firmware
+//stopped answering.
+static int runBatch(Batch *b) {
+	unsigned char msg[BRIDGE_BUF+5], tdo[BRIDGE_BUF];
+	int tries, type, n, len, i, send=1;
+	msg[0]='B';
+	msg[1]=seq;
+	msg[2]=b->len;
+	msg[3]=b->len>>8;
+	memcpy(msg+4, b->buf, b->len);
+	msg[4+b->len]=0;
+	for (i=1; i<4+b->len; i++) msg[4+b->len]+=msg[i];
+	for (tries=0; tries<RETRIES; tries++) {
+		if (send) serialWrite(msg, b->len+5);
+		send=0;
+		type=readFrame(ANSWERTIME, &n, tdo, &len);
+		if (type=='R' && n==seq) {
+			if (len==b->tdo) {
+				memcpy(answers+answerLen, tdo, len);
+				answerLen+=len;
+				seq++;
+				return 1;
+			}
+			//Damaged on the way, have it sent again.
+			serialWrite((unsigned char *)"A", 1);
+		} else if (type=='J' && n==seq) {
+			//The batch didn't arrive.
+			send=1;
+		} else if (type=='J' && n==((seq+1)&255)) {
+			//It ran, but the answer didn't arrive.
+			serialWrite((unsigned char *)"A", 1);
+		} else if (type<0) {
+			//The firmware asks again when it gets nothing for a while.
+			serialWrite((unsigned char *)"A", 1);
+		} else {
+			tries--;
+		}
+	}
+	return 0;
+}
+
+static void closeOp(Batch *b) {
+	if (b->op<0) return;
+	b->buf[b->op+1]=b->n;
+	b->buf[b->op+2]=b->n>>8;
+	if ((b->buf[b->op]&0x0f)==BRIDGE_SHIFT) b->tdo+=(b->n+7)>>3;
+	b->op=-1;
+}
+
+static void openOp(Batch *b, unsigned char cmd) {
+	closeOp(b);
+	b->op=b->len;
+	b->buf[b->len]=cmd;
+	b->len+=3;
+	b->n=0;
+	b->run=0;
+	b->opTdo=b->tdo;
+}
+
+//Appends bit i of the job, which is clocked in TAP state s. Returns 0 if
+//the batch got too big.
+static int addBit(Batch *b, int i, int s, long tdoBase) {
+	int tms=jobTms[i], loop=(next[s][tms]==s);
+	unsigned char cmd=(b->op>=0)?b->buf[b->op]:0;
+	if (s==SHIFTDR || s==SHIFTIR) {
+		if (cmd!=(BRIDGE_SHIFT|BRIDGE_TDO)) openOp(b, BRIDGE_SHIFT|BRIDGE_TDO);
+		if (!(b->n&7)) b->buf[b->len++]=0;
+		b->buf[b->len-1]|=jobTdi[i]<<(b->n&7);
+		jobTdo[i]=(tdoBase+b->opTdo+(b->n>>3))*8+(b->n&7);
+		b->n++;
+		if (tms) {
+			b->buf[b->op]|=BRIDGE_EXIT;
+			closeOp(b);
+		}
+	} else if (loop && cmd==(BRIDGE_RUN|(tms?BRIDGE_EXIT:0)) && b->n<65535) {
+		b->n++;
+		jobTdo[i]=-1;
+	} else {
+		if (cmd!=BRIDGE_TMS || b->n==65535) openOp(b, BRIDGE_TMS);
+		if (!(b->n&7)) b->buf[b->len++]=0;
+		b->buf[b->len-1]|=tms<<(b->n&7);
+		b->n++;
+		jobTdo[i]=-1;
+		//The same bit over and over in a stable state: make that a run.
+		if (loop && (b->run==0 || (b->run>0)==(tms==1))) b->run+=tms?1:-1;
+		else b->run=loop?(tms?1:-1):0;
+		if (b->run==RUNMIN || b->run==-RUNMIN) {
+			b->n-=RUNMIN;
+			if (b->n==0) {
+				b->len=b->op;
+				b->op=-1;
+			} else {
+				b->len=b->op+3+((b->n+7)>>3);
+				b->buf[b->len-1]&=(1<<(((b->n-1)&7)+1))-1;
+			}
+			openOp(b, BRIDGE_RUN|(tms?BRIDGE_EXIT:0));
+			b->n=RUNMIN;
+		}
+	}
+	return b->len<=BRIDGE_BUF;
+}
+
+static Batch *newBatch(void) {
+	Batch *b;
+	if (batchCount==batchAlloc) {
+		batchAlloc=batchAlloc?batchAlloc*2:16;
+		batches=realloc(batches, batchAlloc*sizeof(Batch));
+	}
+	b=&batches[batchCount++];
+	b->len=0;
+	b->op=-1;
+	b->tdo=0;
+	return b;
+}
+
+//A batch can end after bit i if the firmware can park the TAP there.
+static int canEnd(int pre, int post) {
+	if (post==RTI || post==TLR || post==PAUSEDR || post==PAUSEIR) return 1;
+	return (pre==SHIFTDR || pre==SHIFTIR);
+}
+
+//Adds the bits from start on up to where a batch can end; returns the state
+//the TAP is in after them and sets *last to the last bit added. Returns -1
+//if they didn't fit.
+static int addUnit(Batch *b, int start, int s, long tdoBase, int *last) {
+	int i, pre;
+	for (i=start; ; i++) {
+		pre=s;
+		s=next[pre][jobTms[i]];
+		if (!addBit(b, i, pre, tdoBase)) return -1;
+		if (canEnd(pre, s)) break;
+	}
+	*last=i;
+	return s;
+}
+
+//Runs the job up to the last bit a batch can end after, and answers the
+//shifts. The bits after that stay for the next job.
+static void runJob(void) {
+	int i, j, s, start, end=-1, ok=1;
+	long src, tdoBase=0;
+	double t=nowMs();
+	Batch saved, *b;
+	unsigned char *tdo;
+	for (i=0, s=tapState; i<jobBits; i++) {
+		if (canEnd(s, next[s][jobTms[i]])) end=i;
+		s=next[s][jobTms[i]];
+	}
+	batchCount=0;
+	b=newBatch();
+	s=tapState;
+	for (start=0; start<=end; start=i+1) {
+		saved=*b;
+		j=addUnit(b, start, s, tdoBase, &i);
+		if (j<0) {
+			//Doesn't fit, so it starts the next batch.
+			*b=saved;
+			closeOp(b);
+			tdoBase+=b->tdo;
+			b=newBatch();
+			j=addUnit(b, start, s, tdoBase, &i);
+		}
+		s=j;
+	}
+	closeOp(b);
+	answerLen=0;
+	answers=realloc(answers, tdoBase+b->tdo+1);
+	for (i=0; i<batchCount && ok; i++) {
+		if (batches[i].len) ok=runBatch(&batches[i]);
+	}
+	if (!ok) {
+		fprintf(stderr, "xvcd: the firmware stopped answering\n");
+		exit(1);
+	}
+	tapState=s;
+	for (j=0; j<shiftCount; j++) {
+		tdo=shifts[j].tdo;
+		memset(tdo, 0, (shifts[j].bits+7)/8);
+		for (i=0; i<shifts[j].bits; i++) {
+			src=jobTdo[shifts[j].start+i];
+			if (src<0 || (answers[src>>3]>>(src&7))&1) tdo[i>>3]|=1<<(i&7);
+		}
+	}
+	if (verbose) {
+		fprintf(stderr, "xvcd: %d shifts, %d bits in %d batches, %.1f ms\n",
+			shiftCount, end+1, batchCount, nowMs()-t);
+	}
+	stats.batches+=batchCount;
+	stats.ms+=nowMs()-t;
+	//What's left goes to the front of the next job.
+	memmove(jobTms, jobTms+end+1, jobBits-end-1);
+	memmove(jobTdi, jobTdi+end+1, jobBits-end-1);
+	jobBits-=end+1;
+}
+
+//Reads exactly len bytes from the client. Returns 0 if it went away.
+static int readAll(int fd, unsigned char *buf, int len) {
+	int n;
+	while (len>0) {
+		n=read(fd, buf, len);
+		if (n<0 && errno==EINTR && !quit) continue;
+		if (n<=0) return 0;
+		buf+=n;
+		len-=n;
+	}
+	return 1;
+}
+
+//Reads an XVC command up to and including the ':'. Returns 0 if the client
+//went away or doesn't speak XVC.
+static int readCommand(int fd, char *cmd, int size) {
+	int i;
+	for (i=0; i<size-1; i++) {
+		if (!readAll(fd, (unsigned char *)&cmd[i], 1)) return 0;
+		if (cmd[i]==':') {
+			cmd[i+1]=0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int readLong(int fd, long *v) {
+	unsigned char b[4];
+	if (!readAll(fd, b, 4)) return 0;
+	*v=b[0]|(b[1]<<8)|(b[2]<<16)|((long)b[3]<<24);
+	return 1;
+}
+
+static int hasInput(int fd) {
+	struct pollfd p;
+	p.fd=fd;
+	p.events=POLLIN;
+	return poll(&p, 1, 0)>0;
+}
+
+//Sets the TCK delay closest to the period the client wants, without going
+//faster. Returns the period we think that gives.
+static long setTck(long ns) {
+	int d=0, n, len, type;
+	unsigned char msg[2];
+	if (ns>TCK_BASE_NS) d=(ns-TCK_BASE_NS+1999)/2000;
+	if (d>255) d=255;
+	msg[0]='T';
+	msg[1]=d;
+	serialWrite(msg, 2);
+	do {
+		type=readFrame(ANSWERTIME, &n, NULL, &len);
+	} while (type>=0 && (type!='T' || n!=d));
+	if (type<0) fprintf(stderr, "xvcd: no answer to the TCK delay\n");
+	return TCK_BASE_NS+2000L*d;
+}
+
+//Serves one client until it goes away.
+static void serve(int fd) {
+	char cmd[16];
+	unsigned char *tms, *tdi, buf[32];
+	long bits, v;
+	int len, i, j, have=0;
+	memset(&stats, 0, sizeof(stats));
+	//The firmware parked the TAP where the last client's bits allowed; the
+	//ones after that are dropped.
+	jobBits=0;
+	while (!quit) {
+		if (!have && !readCommand(fd, cmd, sizeof(cmd))) break;
+		have=0;
+		if (!strcmp(cmd, "getinfo:")) {
+			len=sprintf((char *)buf, "xvcServer_v1.0:%d\n", MAXVECTOR);
+			if (write(fd, buf, len)!=len) break;
+		} else if (!strcmp(cmd, "settck:")) {
+			if (!readLong(fd, &v)) break;
+			v=setTck(v);
+			for (i=0; i<4; i++) buf[i]=v>>(i*8);
+			if (write(fd, buf, 4)!=4) break;
+		} else if (!strcmp(cmd, "shift:")) {
+			//Take all the shifts the client has sent so far.
+			shiftCount=0;
+			while (1) {
+				if (!readLong(fd, &bits) || bits<0 || bits>MAXVECTOR*8) return;
+				len=(bits+7)/8;
+				tms=malloc(len*3+1);
+				tdi=tms+len;
+				if (!readAll(fd, tms, len*2)) return;
+				for (i=0; i<bits; i++) {
+					j=jobBits+i;
+					jobTms[j]=(tms[i>>3]>>(i&7))&1;
+					jobTdi[j]=(tdi[i>>3]>>(i&7))&1;
+					jobTdo[j]=-1;
+				}
+				shifts[shiftCount].bits=bits;
+				shifts[shiftCount].start=jobBits;
+				shifts[shiftCount].tdo=tdi+len;
+				shiftCount++;
+				jobBits+=bits;
+				stats.shifts++;
+				stats.bits+=bits;
+				if (shiftCount==sizeof(shifts)/sizeof(shifts[0]) || jobBits+MAXVECTOR*8>MAXJOB || !hasInput(fd)) break;
+				if (!readCommand(fd, cmd, sizeof(cmd))) return;
+				if (strcmp(cmd, "shift:")) {
+					have=1;
+					break;
+				}
+			}
+			runJob();
+			for (i=0; i<shiftCount; i++) {
+				len=(shifts[i].bits+7)/8;
+				j=write(fd, shifts[i].tdo, len);
+				free(shifts[i].tdo-2*len);
+				if (j!=len) return;
+			}
+		} else {
+			fprintf(stderr, "xvcd: unknown command %s\n", cmd);
+			break;
+		}
+	}
+	if (verbose && stats.bits) {
+		fprintf(stderr, "xvcd: %ld shifts, %ld bits in %ld batches, %.0f bits/s, %.1f line bytes per 8 bits\n",
+			stats.shifts, stats.bits, stats.batches, stats.bits*1000.0/stats.ms, stats.lineBytes*8.0/stats.bits);
+	}
+}
+
+//Waits for the firmware in xmodem mode (or still bridging, if we ran
+//before) and puts it in bridge mode.
+static void attach(void) {
+	double end=nowMs()+10000;
+	int c, n, len, type;
+	unsigned char reset[]={BRIDGE_TMS, 5, 0, 0x1f};
+	Batch *b;
+	fprintf(stderr, "xvcd: waiting for the board...\n");
+	while (nowMs()<end) {
+		c=readTimed(serial, end-nowMs());
+		if (c==NAK) {
+			serialWrite((unsigned char *)"j", 1);
+			break;
+		}
+		if (c==SYNC) {
+			//Already bridging; it repeats its request every second.
+			c=readTimed(serial, 100);
+			if (c=='J') break;
+		}
+	}
+	type=readFrame(3000, &n, NULL, &len);
+	if (type!='J') {
+		fprintf(stderr, "xvcd: no board in xmodem or bridge mode\n");
+		exit(1);
+	}
+	seq=n;
+	//Start from Test-Logic-Reset.
+	batchCount=0;
+	b=newBatch();
+	memcpy(b->buf, reset, sizeof(reset));
+	b->len=sizeof(reset);
+	answers=realloc(answers, 1);
+	answerLen=0;
+	if (!runBatch(b)) {
+		fprintf(stderr, "xvcd: the board doesn't answer\n");
+		exit(1);
+	}
+	tapState=TLR;
+}
+
+static void stop(int sig) {
+	quit=1;
+}
+
+int main(int argc, char **argv) {
+	int opt, port=2542, ls, fd, one=1;
+	struct sockaddr_in addr;
+	struct sigaction sa;
+	while ((opt=getopt(argc, argv, "p:v"))!=-1) {
+		if (opt=='p') port=atoi(optarg);
+		else if (opt=='v') verbose=1;
+		else break;
+	}
+	if (argc-optind!=1) {
+		fprintf(stderr, "Usage: %s [-p port] [-v] serialport\n", argv[0]);
+		exit(1);
+	}
+	jobTms=malloc(MAXJOB);
+	jobTdi=malloc(MAXJOB);
+	jobTdo=malloc(MAXJOB*sizeof(long));
+	serial=openPort(argv[optind]);
+	attach();
+
+	ls=socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_port=htons(port);
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	if (bind(ls, (struct sockaddr *)&addr, sizeof(addr))<0 || listen(ls, 1)<0) {
+		perror("xvcd: listen");
+		exit(1);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler=stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	fprintf(stderr, "xvcd: listening on localhost:%d\n", port);
+	while (!quit) {
+		fd=accept(ls, NULL, NULL);
+		if (fd<0) continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		serve(fd);
+		close(fd);
+	}
+	//Hand the board back to xmodem mode.
+	serialWrite((unsigned char *)"Q", 1);
+	return 0;
+}
@@ -33,6 +33,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define FINS_BE		0xC7
 #define FINS_DP		0xB9
 #define FINS_RES	0xAB
+#define FINS_RDID	0x9F
+#define FINS_RDSFDP	0x5A
+#define FINS_EN4B	0xB7
 
 //Status register bits
 #define FSR_SRWD	7
@@ -79,32 +82,171 @@ static unsigned char shiftRead() {
 }
 #endif
 
-//Start programming a page (=256 bytes) of flash. Less can be programmed and
-//programming can start in the middle of the page, but bytes written will
-//be in one page only.
-void f25cxxPageProgramStart(long addr) {
+//Geometry of the flash, see f25cxxInit(). The defaults are a 25P40, which
+//predates JEDEC IDs and SFDP.
+unsigned long f25cxxSize=0x80000L;
+unsigned long f25cxxJedecId; //0 or 0xFFFFFF for parts without one, like the 25P40
+static unsigned int pageSize=256;
+static unsigned char addrBytes=3;
+static unsigned char eraseTypes=1;
+static unsigned char eraseShift[4]={16}; //log2 of the size, biggest first
+static unsigned char eraseOp[4]={FINS_SE};
+
+static long pageAddr; //next byte to program
+static unsigned int pageLeft; //bytes left in its page
+static long eraseNext, eraseEnd; //what f25cxxEraseLater() left to erase
+
+//Send an address, msb first. 4 bytes for parts over 16MiB.
+static void shiftAddr(long addr) {
+	if (addrBytes==4) shiftWrite(addr>>24);
+	shiftWrite(addr>>16);
+	shiftWrite(addr>>8);
+	shiftWrite(addr);
+}
+
+static void command(unsigned char ins) {
 	ioF25cxxSetS(0);
-	shiftWrite(FINS_WREN);
+	shiftWrite(ins);
+	ioF25cxxSetS(1);
+}
+
+//SFDP is read with a 3-byte address and 8 dummy clocks, whatever the part.
+static void sfdpRead(long addr, unsigned char *buff, unsigned char len) {
+	ioF25cxxSetS(0);
+	shiftWrite(FINS_RDSFDP);
+	shiftWrite(addr>>16);
+	shiftWrite(addr>>8);
+	shiftWrite(addr);
+	shiftWrite(0); //dummy
+	while (len--) *buff++=shiftRead();
 	ioF25cxxSetS(1);
+}
+
+//Dword n of a parameter table at addr; SFDP is little-endian.
+static unsigned long sfdpDword(long addr, unsigned char n) {
+	unsigned char b[4];
+	sfdpRead(addr+n*4, b, 4);
+	return ((unsigned long)b[3]<<24)|((unsigned long)b[2]<<16)|((unsigned int)b[1]<<8)|b[0];
+}
+
+//Find out what flash is attached: its size from the JEDEC ID and, if it has
+//SFDP, the size, page size and erase sizes from the basic parameter table.
+//Parts over 16MiB get switched to 4-byte addresses. Fast reads stay the
+//single-bit 0x0B with 8 dummy clocks; that's the only one every part has and
+//the only one the USI can do. The flash should be enabled.
+void f25cxxInit(void) {
+	unsigned char b[16], i, j, n, len;
+	unsigned long dw, dw1;
+	long bfpt;
+
+	f25cxxGetID(); //wakes the chip up from a deep power-down
+	dw=f25cxxGetJedecID();
+	f25cxxJedecId=dw;
+	if ((dw&0xff)>=0x10 && (dw&0xff)<=0x1e) f25cxxSize=1UL<<(dw&0xff);
+
+	//The SFDP header and the first parameter header, which has to be the
+	//JEDEC basic flash parameter table.
+	sfdpRead(0, b, 16);
+	if (b[0]!='S' || b[1]!='F' || b[2]!='D' || b[3]!='P' || b[8]!=0x00 || b[10]!=1 || b[15]!=0xff) return;
+	len=b[11];
+	bfpt=b[12]|((unsigned int)b[13]<<8)|((long)b[14]<<16);
+	if (len<9) return;
+
+	//Density: bits-1, or log2(bits) with bit 31 set. Up to 1GiB.
+	dw=sfdpDword(bfpt, 1);
+	if (dw&0x80000000UL) {
+		dw&=0x7fffffffUL;
+		f25cxxSize=(dw>=33)?0x40000000UL:(1UL<<(dw-3));
+	} else {
+		f25cxxSize=(dw>=0x1fffffffUL)?0x40000000UL:(dw+1)>>3;
+	}
+
+	//Erase types, 4 of them in dwords 8 and 9 as size/instruction pairs.
+	//Keep the ones between 4K and 64K, sorted biggest first.
+	eraseTypes=0;
+	for (i=0; i<4; i++) {
+		dw=sfdpDword(bfpt, 7+i/2)>>((i&1)*16);
+		n=dw&0xff;
+		if (n<12 || n>16) continue;
+		for (j=eraseTypes; j>0 && eraseShift[j-1]<n; j--) {
+			eraseShift[j]=eraseShift[j-1];
+			eraseOp[j]=eraseOp[j-1];
+		}
+		eraseShift[j]=n;
+		eraseOp[j]=dw>>8;
+		eraseTypes++;
+	}
+	if (eraseTypes==0) {
+		eraseTypes=1;
+		eraseShift[0]=16;
+		eraseOp[0]=FINS_SE;
+	}
+
+	//Page size, log2 in bits 7:4 of dword 11.
+	if (len>=11) pageSize=1<<((sfdpDword(bfpt, 10)>>4)&15);
+
+	//Bits 18:17 of dword 1: 3-byte only, 3 or 4, or 4 only. For 3 or 4, dword
+	//16 says how to switch: B7, or B7 after a WREN. WEL mustn't stay set
+	//after that, f25cxxWaitReady() would take it for busy.
+	if (f25cxxSize>0x1000000UL) {
+		dw1=sfdpDword(bfpt, 0);
+		dw=(len>=16)?sfdpDword(bfpt, 15)>>24:0;
+		if (((dw1>>17)&3)==2) {
+			addrBytes=4;
+		} else if (((dw1>>17)&3)==1 && (dw&3)) {
+			if (!(dw&1)) command(FINS_WREN);
+			command(FINS_EN4B);
+			command(FINS_WRDI);
+			addrBytes=4;
+		} else {
+			f25cxxSize=0x1000000UL;
+		}
+	}
+}
+
+//Start programming at addr. As many bytes as needed can be written; a new page
+//gets started when one is full.
+void f25cxxPageProgramStart(long addr) {
+	f25cxxEraseThrough(addr);
+	pageAddr=addr;
+	pageLeft=pageSize-(addr&(pageSize-1));
+	command(FINS_WREN);
 
 	ioF25cxxSetS(0);
 	shiftWrite(FINS_PP);
-	shiftWrite((addr>>16)*0xff);
-	shiftWrite((addr>>8)*0xff);
-	shiftWrite((addr>>0)*0xff);
+	shiftAddr(addr);
 }
 
 //Write a byte to the page.
 void f25cxxPageProgramWrite(unsigned char c) {
+	if (pageLeft==0) {
+		f25cxxPageProgramEnd();
+		f25cxxPageProgramStart(pageAddr);
+	}
 	shiftWrite(c);
+	pageAddr++;
+	pageLeft--;
 }
 
 //Finished writing (part of) the page. Make the flash commit it to memory.
 void f25cxxPageProgramEnd(void) {
+	f25cxxPageProgramCommit();
+	f25cxxWaitReady();
+}
+
+//Like f25cxxPageProgramEnd(), but doesn't wait for the flash to be done. It
+//ignores everything until it is, so call f25cxxWaitReady() before the next
+//command or make sure the maximum page program time has passed.
+void f25cxxPageProgramCommit(void) {
 	ioF25cxxSetS(1);
+}
+
+//Wait till the flash is done programming. This reads the status, so the
+//flash drives Q while it does.
+void f25cxxWaitReady(void) {
 	ioF25cxxSetS(0);
 	shiftWrite(FINS_RDSR);
-	while (shiftRead()&(1<<FSR_WIP)) ; //wait till write is done
+	while (shiftRead()&(1<<FSR_WIP)) wdt_reset(); //wait till write or erase is done
 	ioF25cxxSetS(1);
 }
 
@@ -123,14 +265,62 @@ void f25cxxEraseChip(void) {
 	ioF25cxxSetS(1);
 }
 
+//Erase at addr with the biggest erase the part has that's aligned and not
+//longer than len. Returns the size erased.
+static long eraseOne(long addr, long len) {
+	unsigned char i;
+	long size;
+	for (i=0; i<eraseTypes-1; i++) {
+		size=1L<<eraseShift[i];
+		if (!(addr&(size-1)) && len>=size) break;
+	}
+	command(FINS_WREN);
+
+	ioF25cxxSetS(0);
+	shiftWrite(eraseOp[i]);
+	shiftAddr(addr);
+	ioF25cxxSetS(1);
+	f25cxxWaitReady();
+	return 1L<<eraseShift[i];
+}
+
+//Erase len bytes from addr on, both multiples of the smallest erase size.
+void f25cxxErase(long addr, long len) {
+	long size;
+	while (len>0) {
+		size=eraseOne(addr, len);
+		addr+=size;
+		len-=size;
+	}
+}
+
+//Like f25cxxErase(), but the erasing only happens as the area gets
+//programmed: f25cxxPageProgramStart() erases up to where it programs first.
+//On a big part, erasing a whole slot up front takes longer than an xmodem
+//sender waits for its first ACK.
+void f25cxxEraseLater(long addr, long len) {
+	eraseNext=addr;
+	eraseEnd=addr+len;
+}
+
+//Returns 1 if programming at addr would have to erase first.
+char f25cxxEraseDue(long addr) {
+	return (addr>=eraseNext && addr<eraseEnd);
+}
+
+//Do the erases f25cxxEraseLater() left up to and including addr.
+void f25cxxEraseThrough(long addr) {
+	if (!f25cxxEraseDue(addr)) return;
+	f25cxxWaitReady();
+	while (eraseNext<=addr) eraseNext+=eraseOne(eraseNext, eraseEnd-eraseNext);
+}
+
 //Read a single byte
 unsigned char f25cxxRead(long addr) {
 	unsigned char r;
 	ioF25cxxSetS(0);
 	shiftWrite(FINS_READ);
-	shiftWrite((addr>>16)*0xff);
-	shiftWrite((addr>>8)*0xff);
-	shiftWrite((addr)&0xff);
+	shiftAddr(addr);
 	r=shiftRead();
 	ioF25cxxSetS(1);
 	return r;
@@ -139,19 +329,44 @@ unsigned char f25cxxRead(long addr) {
 //Read a number of bytes into a buffer.
 void f25cxxReadBuff(long addr, unsigned char *buff, int len) {
 	int x;
-	ioF25cxxSetS(0);
-	shiftWrite(FINS_FREAD);
-	shiftWrite((addr>>16)*0xff);
-	shiftWrite((addr>>8)*0xff);
-	shiftWrite((addr)&0xff);
-	shiftWrite(0); //dummy
+	f25cxxReadStart(addr);
 	for (x=0; x<len; x++) {
 		buff[x]=shiftRead();
 	}
+	f25cxxReadEnd();
+}
+
+//Start reading at addr. f25cxxReadNext() then returns one byte after another,
+//as many as needed, until f25cxxReadEnd() is called.
+void f25cxxReadStart(long addr) {
+	ioF25cxxSetS(0);
+	shiftWrite(FINS_FREAD);
+	shiftAddr(addr);
+	shiftWrite(0); //dummy
+}
+
+unsigned char f25cxxReadNext(void) {
+	return shiftRead();
+}
+
+void f25cxxReadEnd(void) {
+	ioF25cxxSetS(1);
+}
+
+//Get the JEDEC manufacturer, memory type and capacity, 0xFFFFFF or 0 on old
+//parts that don't know the command.
+unsigned long f25cxxGetJedecID(void) {
+	unsigned long id;
+	ioF25cxxSetS(0);
+	shiftWrite(FINS_RDID);
+	id=(unsigned long)shiftRead()<<16;
+	id|=(unsigned int)shiftRead()<<8;
+	id|=shiftRead();
 	ioF25cxxSetS(1);
+	return id;
 }
 
-//Get flash id. Usually is 0x12 for 25p40
+//Get the electronic signature. Usually is 0x12 for 25p40
 unsigned char f25cxxGetID(void) {
 	unsigned char r;
 	ioF25cxxSetS(0);
@@ -1,9 +1,23 @@
 
 void f25cxxPageProgramStart(long addr);
-void f25cxxPageProgramWrite(unsigned char c); //Need to call this 256 times.
+void f25cxxPageProgramWrite(unsigned char c); //Goes on to the next page by itself.
 void f25cxxPageProgramEnd(void);
+void f25cxxPageProgramCommit(void);
+void f25cxxWaitReady(void);
 void f25cxxEraseChip(void);
+void f25cxxErase(long addr, long len);
+void f25cxxEraseLater(long addr, long len);
+char f25cxxEraseDue(long addr);
+void f25cxxEraseThrough(long addr);
 unsigned char f25cxxRead(long addr);
 void f25cxxReadBuff(long addr, unsigned char *buff, int len);
+void f25cxxReadStart(long addr);
+unsigned char f25cxxReadNext(void);
+void f25cxxReadEnd(void);
 unsigned char f25cxxGetID(void);
+unsigned long f25cxxGetJedecID(void);
+void f25cxxInit(void);
+
+extern unsigned long f25cxxSize; //bytes, see f25cxxInit()
+extern unsigned long f25cxxJedecId; //read by f25cxxInit()
 
@@ -0,0 +1,158 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Image slot handling. After a complete xmodem upload, a header with the
+length and CRC32 of the image gets written to the first page of its slot. At
+boot, the image in the boot slot is checked against that before we try to
+play it. Which slot that is lives in EEPROM, so switching between uploaded
+images doesn't need another upload.
+*/
+
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <avr/eeprom.h>
+#include "eeconf.h"
+#include "io.h"
+#include "flash25cxx.h"
+#include "overclock.h"
+#include "image.h"
+#include "debug.h"
+
+#define HDRSIZE 12
+#define BUFSZ 32
+
+//CRC32 (the zip/ethernet one), a nibble at a time. A byte-wide table would
+//be twice as fast, but is 1K of our 8K of flash.
+static const unsigned long crcTable[16] PROGMEM={
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+unsigned long imageCrc32Init(void) {
+	return 0xFFFFFFFFUL;
+}
+
+unsigned long imageCrc32Update(unsigned long crc, unsigned char b) {
+	crc=(crc>>4)^pgm_read_dword(&crcTable[(crc^b)&0xf]);
+	crc=(crc>>4)^pgm_read_dword(&crcTable[(crc^(b>>4))&0xf]);
+	return crc;
+}
+
+unsigned long imageCrc32Final(unsigned long crc) {
+	return crc^0xFFFFFFFFUL;
+}
+
+static void putLong(unsigned long l) {
+	f25cxxPageProgramWrite(l>>24);
+	f25cxxPageProgramWrite(l>>16);
+	f25cxxPageProgramWrite(l>>8);
+	f25cxxPageProgramWrite(l);
+}
+
+static unsigned long getLong(unsigned char *p) {
+	return ((unsigned long)p[0]<<24)|((unsigned long)p[1]<<16)|((unsigned int)p[2]<<8)|p[3];
+}
+
+//Erase a slot, leaving the other slots alone. Only the part with the header
+//gets erased right away, the rest as the upload gets programmed.
+void imageErase(char slot) {
+	f25cxxEraseLater(IMAGE_BASE(slot), IMAGE_SLOTSIZE);
+	f25cxxEraseThrough(IMAGE_BASE(slot)+IMAGE_HDR);
+}
+
+//Write the header for an image of len bytes at IMAGE_DATA(slot). The flash
+//should be enabled and the slot erased.
+void imageWriteHeader(char slot, unsigned long len, unsigned long crc) {
+	f25cxxPageProgramStart(IMAGE_BASE(slot)+IMAGE_HDR);
+	putLong(IMAGE_MAGIC);
+	putLong(len);
+	putLong(crc);
+	f25cxxPageProgramEnd();
+}
+
+//Reads the header of a slot into buff. Returns the image length, or 0 if
+//there's no valid header. The flash should be enabled.
+static unsigned long readHeader(char slot, unsigned char *buff) {
+	unsigned long len;
+	f25cxxReadBuff(IMAGE_BASE(slot)+IMAGE_HDR, buff, HDRSIZE);
+	len=getLong(&buff[4]);
+	if (getLong(&buff[0])!=IMAGE_MAGIC || len>IMAGE_MAXLEN) return 0;
+	return len;
+}
+
+//Length of the image in a slot according to its header, 0 if empty.
+unsigned long imageLength(char slot) {
+	unsigned char buff[HDRSIZE];
+	ioFlashEnable();
+	return readHeader(slot, buff);
+}
+
+//Returns true if the slot has a header and the image matches its CRC.
+char imageCheck(char slot) {
+	unsigned char buff[BUFSZ];
+	unsigned long len, expected, crc, pos, end;
+	int x, n=BUFSZ;
+	ioFlashEnable();
+	len=readHeader(slot, buff);
+	expected=getLong(&buff[8]);
+	if (len==0) {
+		dputs("Image ");
+		ddec(slot);
+		dputs(": no valid header\n");
+		return 0;
+	}
+
+	crc=imageCrc32Init();
+	end=IMAGE_DATA(slot)+len;
+	for (pos=IMAGE_DATA(slot); pos<end; pos+=n) {
+		wdt_reset();
+		overclockStopwatchPoll();
+		if (end-pos<BUFSZ) n=end-pos;
+		f25cxxReadBuff(pos, buff, n);
+		for (x=0; x<n; x++) crc=imageCrc32Update(crc, buff[x]);
+	}
+	crc=imageCrc32Final(crc);
+	if (crc!=expected) {
+		dputs("Image ");
+		ddec(slot);
+		dputs(": CRC ");
+		dhex(crc, 8);
+		dputs(", expected ");
+		dhex(expected, 8);
+		dputc('\n');
+		return 0;
+	}
+	return 1;
+}
+
+//Slot to play at boot. Defaults to 0 when the EEPROM doesn't hold a valid one.
+char imageBootSlot(void) {
+	unsigned char s=eeprom_read_byte((uint8_t *)EE_BOOTSLOT);
+	if (s>=IMAGE_SLOTS || s!=(unsigned char)~eeprom_read_byte((uint8_t *)EE_BOOTSLOTCHK)) return 0;
+	return s;
+}
+
+void imageSetBootSlot(char slot) {
+	eeprom_update_byte((uint8_t *)EE_BOOTSLOT, slot);
+	eeprom_update_byte((uint8_t *)EE_BOOTSLOTCHK, ~slot);
+	eeprom_busy_wait();
+}
@@ -0,0 +1,25 @@
+//Flash layout: the flash is split into IMAGE_SLOTS sector-aligned slots that
+//each hold one xsvf image. The first page of a slot holds a header describing
+//the image, the image itself starts at IMAGE_START into the slot. The header
+//is only written after an upload completed, so an interrupted upload leaves
+//it erased.
+#define IMAGE_SLOTS		4
+#define IMAGE_SLOTSIZE	((long)(f25cxxSize/IMAGE_SLOTS)) //128KiB on a 25P40, see f25cxxInit()
+#define IMAGE_HDR		0
+#define IMAGE_START		0x100
+#define IMAGE_MAXLEN	(IMAGE_SLOTSIZE-IMAGE_START)
+
+#define IMAGE_BASE(slot)	((long)(slot)*IMAGE_SLOTSIZE)
+#define IMAGE_DATA(slot)	(IMAGE_BASE(slot)+IMAGE_START)
+
+#define IMAGE_MAGIC		0x58535646UL //'XSVF'
+
+unsigned long imageCrc32Init(void);
+unsigned long imageCrc32Update(unsigned long crc, unsigned char b);
+unsigned long imageCrc32Final(unsigned long crc);
+void imageErase(char slot);
+void imageWriteHeader(char slot, unsigned long len, unsigned long crc);
+unsigned long imageLength(char slot);
+char imageCheck(char slot);
+char imageBootSlot(void);
+void imageSetBootSlot(char slot);
@@ -34,6 +34,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 static unsigned char jtagState=(1<<JTAG_TMS)|(1<<JTAG_TDI)|(1<<JTAG_TCK);
 static unsigned char prevState;
+static unsigned char jtagDelay; //extra us per TCK edge, see ioJtagSetDelay()
 
 #define IO_JTAG 0
 #define IO_UART 1
@@ -60,15 +61,13 @@ void ioUartEnable(void) {
 void ioJtagEnable(void) {
 	if (prevState==IO_UART) swUartDisable();
 	USICR=0;
-	PORTB=jtagState;
+	PORTB=jtagState|(1<<F25CXX_S); //keep the flash deselected, it'd see TMS/TDI as commands
 	DDRB|=(1<<JTAG_TMS)|(1<<JTAG_TDI)|(1<<JTAG_TCK);
 	DDRB&=~(1<<JTAG_TDO);
 	prevState=IO_JTAG;
 }
 
-void ioFlashEnable(void) {
-	if (prevState==IO_UART) swUartDisable();
-	if (prevState==IO_JTAG) jtagState=PORTB;
+static void flashPins(void) {
 	DDRB|=(1<<F25CXX_D)|(1<<F25CXX_C)|(1<<F25CXX_S);
 	DDRB&=~(1<<F25CXX_Q);
 	PORTB|=(1<<F25CXX_Q)|(1<<F25CXX_S);
@@ -76,6 +75,30 @@ void ioFlashEnable(void) {
 	prevState=IO_FLASH;
 }
 
+void ioFlashEnable(void) {
+	if (prevState==IO_UART) swUartDisable();
+	if (prevState==IO_JTAG) jtagState=PORTB;
+	flashPins();
+}
+
+//Flash access from UART mode, with the transmitter still running: TXD isn't
+//shared with the flash, only RXD is. Wait for swUartFlush() before going back
+//with ioUartEnable().
+void ioFlashEnableTx(void) {
+	swUartDisableRx();
+	flashPins();
+}
+
+//Flash programming from UART mode, with the receiver still running. The flash
+//only drives Q (RXD) while it's read from, so page programs can be sent while
+//bytes come in, as long as nothing reads the flash, not even its status.
+//What's still being sent goes out first, the transmitter shares PORTB.
+void ioFlashEnableRx(void) {
+	swUartFlush();
+	DDRB|=(1<<F25CXX_D)|(1<<F25CXX_C)|(1<<F25CXX_S);
+	PORTB&=~((1<<F25CXX_D)|(1<<F25CXX_C));
+}
+
 //Shift a byte in and out using the USI, which is connected to the flash.
 unsigned char ioSpiShift(unsigned char d) {
 	USIDR=d;
@@ -92,13 +115,31 @@ unsigned char ioSpiShift(unsigned char d) {
 	return USIDR;
 }
 
+//Slow down every TCK edge by us microseconds, for targets (or cables) that
+//can't keep up with the CPU. See speed.c. 0 is as fast as we can.
+void ioJtagSetDelay(unsigned char us) {
+	jtagDelay=us;
+}
+
+unsigned char ioJtagGetDelay(void) {
+	return jtagDelay;
+}
+
+//Wait the delay of one TCK edge.
+void ioJtagWait(void) {
+	unsigned char x;
+	for (x=jtagDelay; x; x--) _delay_us(1);
+}
+
 //Generate one JTAG TCK pulse, with given tdi and tms values.
 //Returns the state of the tdo pin.
 unsigned char ioJtagClock(unsigned char tdi, unsigned char tms) {
 	unsigned char ret;
 	if (tms) PORTB|=(1<<JTAG_TMS); else PORTB&=~(1<<JTAG_TMS);
 	if (tdi) PORTB|=(1<<JTAG_TDI); else PORTB&=~(1<<JTAG_TDI);
+	if (jtagDelay) ioJtagWait();
 	PORTB|=(1<<JTAG_TCK);
+	if (jtagDelay) ioJtagWait();
 	ret=PINB&(1<<JTAG_TDO);
 	PORTB&=~(1<<JTAG_TCK);
 	return ret;
@@ -109,8 +150,46 @@ unsigned char ioJtagClock(unsigned char tdi, unsigned char tms) {
 void ioJtagClockOutOnly(unsigned char tdi) {
 	if (tdi) PORTB|=(1<<JTAG_TDI); else PORTB&=~(1<<JTAG_TDI);
 //	PORTB&=~(1<<JTAG_TMS);
+	if (jtagDelay) ioJtagWait();
 	PORTB|=(1<<JTAG_TCK);
+	if (jtagDelay) ioJtagWait();
 	PORTB&=~(1<<JTAG_TCK);
 }
 
+//Whole bytes, lsb first, with TMS staying low. These are unrolled, so there's
+//no call or loop per bit; with a TCK delay, they fall back to the ones above.
+#define OUTBIT(n) \
+	if (d&(1<<(n))) PORTB|=(1<<JTAG_TDI); else PORTB&=~(1<<JTAG_TDI); \
+	PORTB|=(1<<JTAG_TCK); \
+	PORTB&=~(1<<JTAG_TCK)
+#define SHIFTBIT(n) \
+	if (d&(1<<(n))) PORTB|=(1<<JTAG_TDI); else PORTB&=~(1<<JTAG_TDI); \
+	PORTB|=(1<<JTAG_TCK); \
+	if (PINB&(1<<JTAG_TDO)) ret|=(1<<(n)); \
+	PORTB&=~(1<<JTAG_TCK)
+
+void ioJtagClockOutByte(unsigned char d) {
+	unsigned char x;
+	if (jtagDelay) {
+		for (x=0; x<8; x++) ioJtagClockOutOnly(d&(1<<x));
+		return;
+	}
+	OUTBIT(0); OUTBIT(1); OUTBIT(2); OUTBIT(3);
+	OUTBIT(4); OUTBIT(5); OUTBIT(6); OUTBIT(7);
+}
+
+//Returns the TDO bits.
+unsigned char ioJtagShiftByte(unsigned char d) {
+	unsigned char ret=0, x;
+	if (jtagDelay) {
+		for (x=0; x<8; x++) {
+			if (ioJtagClock(d&(1<<x), 0)) ret|=(1<<x);
+		}
+		return ret;
+	}
+	SHIFTBIT(0); SHIFTBIT(1); SHIFTBIT(2); SHIFTBIT(3);
+	SHIFTBIT(4); SHIFTBIT(5); SHIFTBIT(6); SHIFTBIT(7);
+	return ret;
+}
+
 
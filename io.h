@@ -29,8 +29,15 @@
 void ioInit(void);
 unsigned char ioJtagClock(unsigned char tdi, unsigned char tms);
 void ioJtagClockOutOnly(unsigned char tdi);
+void ioJtagClockOutByte(unsigned char d);
+unsigned char ioJtagShiftByte(unsigned char d);
+void ioJtagSetDelay(unsigned char us);
+unsigned char ioJtagGetDelay(void);
+void ioJtagWait(void);
 void ioInit(void);
 void ioUartEnable(void);
 void ioJtagEnable(void);
 void ioFlashEnable(void);
+void ioFlashEnableTx(void);
+void ioFlashEnableRx(void);
 unsigned char ioSpiShift(unsigned char d);
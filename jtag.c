@@ -86,6 +86,10 @@ void jtagReset(void) {
 	jtagCurrState=JTAG_TESTLOGICRESET;
 }
 
+unsigned char jtagGetState(void) {
+	return jtagCurrState;
+}
+
 void jtagGotoState(unsigned char state) {
 	unsigned char tms;
 	while (state!=jtagCurrState) {
@@ -97,6 +101,15 @@ void jtagGotoState(unsigned char state) {
 //	dprintf("Arrived in state %i.\n", jtagCurrState);
 }
 
+//One TCK with the given TMS, following the state machine wherever that goes.
+//For hosts that drive TMS themselves, see bridge.c; jtagGotoState() picks
+//its own path.
+unsigned char jtagClockTms(unsigned char tdi, unsigned char tms) {
+	unsigned char b=ioJtagClock(tdi, tms);
+	jtagCurrState=nextState(tms);
+	return b;
+}
+
 unsigned char jtagShift(unsigned char data, unsigned char bits, unsigned char endraisetms) {
 	//Can be only shift-dr or shift-ir; we need tms=0 to stay there.
 	unsigned char x, b;
@@ -104,7 +117,9 @@ unsigned char jtagShift(unsigned char data, unsigned char bits, unsigned char en
 	unsigned char msk=1;
 #ifdef DEBUG
 	if (jtagCurrState!=JTAG_SHIFTIR && jtagCurrState!=JTAG_SHIFTDR && jtagCurrState!=JTAG_RUNTEST) {
-		dprintf("Warning: shifting in incompatible state %i\n", (int)jtagCurrState);
+		dputs("Warning: shifting in incompatible state ");
+		ddec(jtagCurrState);
+		dputc('\n');
 	}
 #endif
 	for (x=0; x<bits; x++) {
@@ -122,14 +137,22 @@ unsigned char jtagShift(unsigned char data, unsigned char bits, unsigned char en
 	return out;
 }
 
-//Quicker version of the above, for complete bytes only & restricted to outputting.
+//Clock out a number of identical bits, eg the BYPASS padding for the other
+//devices in the chain. These get generated here instead of being stored in
+//the xsvf. Like jtagShift(), TMS is raised on the last bit if endraisetms is set.
+void jtagShiftPad(unsigned int bits, unsigned char tdi, unsigned char endraisetms) {
+	if (bits==0) return;
+	while (--bits) ioJtagClockOutOnly(tdi);
+	jtagShift(tdi?1:0, 1, endraisetms);
+}
+
+//Quicker version of jtagShift, for complete bytes only & restricted to outputting.
 void jtagShiftOutByte(unsigned char data) {
-	ioJtagClockOutOnly(data&1);
-	ioJtagClockOutOnly(data&2);
-	ioJtagClockOutOnly(data&4);
-	ioJtagClockOutOnly(data&8);
-	ioJtagClockOutOnly(data&16);
-	ioJtagClockOutOnly(data&32);
-	ioJtagClockOutOnly(data&64);
-	ioJtagClockOutOnly(data&128);
+	ioJtagClockOutByte(data);
+}
+
+//Quicker version of jtagShift for a complete byte in the middle of a scan, so
+//with TMS low.
+unsigned char jtagShiftByte(unsigned char data) {
+	return ioJtagShiftByte(data);
 }
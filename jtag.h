@@ -19,5 +19,9 @@
 
 unsigned char jtagShift(unsigned char data, unsigned char bits, unsigned char endraisetms);
 void jtagShiftOutByte(unsigned char data);
+unsigned char jtagShiftByte(unsigned char data);
+void jtagShiftPad(unsigned int bits, unsigned char tdi, unsigned char endraisetms);
 void jtagGotoState(unsigned char state);
+unsigned char jtagClockTms(unsigned char tdi, unsigned char tms);
+unsigned char jtagGetState(void);
 void jtagReset(void);
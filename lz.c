@@ -0,0 +1,155 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Decompressor for compressed uploads. After an 'z' in xmodem mode, the blocks
+carry an LZ77 stream (emu/lzpack.c makes one) instead of the xsvf itself. It
+gets decompressed as the blocks come in: the output collects in a small
+buffer that gets programmed whenever it fills up a chunk of a flash page.
+Matches get copied from what has been decompressed so far, from the buffer
+or from the flash itself, so the whole image is the window without needing
+any RAM for it.
+
+The stream is a series of:
+0x00-0x7F: the next 1-128 bytes are literals.
+0x80-0xFF dH dL: copy 3-130 bytes from d bytes back. d=0 ends the stream;
+anything after it (the padding of the last block) gets ignored.
+*/
+
+#include <avr/wdt.h>
+#include "flash25cxx.h"
+#include "image.h"
+#include "arena.h"
+#include "lz.h"
+
+#define ST_CTRL 0
+#define ST_LIT 1
+#define ST_DISTH 2
+#define ST_DISTL 3
+#define ST_DONE 4
+
+static unsigned char outPos, count, state;
+static unsigned int dist;
+static long outAddr, start, end;
+static unsigned long crc;
+
+//Program the buffer. Once erased, a chunk that's all 0xff is already
+//there; long runs of them are common in bitstreams. The slot gets erased
+//as it gets programmed though (see imageErase()), so do that first: copy()
+//reads these bytes back.
+static void flush(void) {
+	unsigned char i;
+	for (i=0; i<outPos; i++) crc=imageCrc32Update(crc, arena.upload.lz[i]);
+	if (outPos) f25cxxEraseThrough(outAddr+outPos-1);
+	for (i=0; i<outPos && arena.upload.lz[i]==0xff; i++) ;
+	if (i<outPos) {
+		f25cxxPageProgramStart(outAddr);
+		for (i=0; i<outPos; i++) f25cxxPageProgramWrite(arena.upload.lz[i]);
+		f25cxxPageProgramEnd();
+	}
+	outAddr+=outPos;
+	outPos=0;
+	wdt_reset();
+}
+
+static char put(unsigned char b) {
+	if (outAddr+outPos>=end) return 0;
+	arena.upload.lz[outPos++]=b;
+	if (outPos==LZ_CHUNK) flush();
+	return 1;
+}
+
+//Copy len bytes from d bytes back. What's still in the buffer gets copied a
+//byte at a time, as it may overlap with what we write; what's in flash
+//already gets read in one go.
+static char copy(unsigned int d, unsigned char len) {
+	long src;
+	unsigned char n;
+	if (outAddr+outPos-d<start) return 0;
+	while (len) {
+		src=outAddr+outPos-d;
+		if (src>=outAddr) {
+			if (!put(arena.upload.lz[src-outAddr])) return 0;
+			len--;
+		} else {
+			n=LZ_CHUNK-outPos;
+			if (n>len) n=len;
+			if (src+n>outAddr) n=outAddr-src;
+			if (outAddr+outPos+n>end) return 0;
+			f25cxxReadBuff(src, &arena.upload.lz[outPos], n);
+			outPos+=n;
+			len-=n;
+			if (outPos==LZ_CHUNK) flush();
+		}
+	}
+	return 1;
+}
+
+//Start decompressing to addr. The output may not go past lim, and the flash
+//between them should be erased.
+void lzStart(long addr, long lim) {
+	outAddr=addr;
+	start=addr;
+	end=lim;
+	outPos=0;
+	state=ST_CTRL;
+	crc=imageCrc32Init();
+}
+
+//Decompress the next byte of the stream. The flash should be enabled.
+//Returns 0 if the stream is bad or doesn't fit.
+char lzFeed(unsigned char b) {
+	if (state==ST_CTRL) {
+		if (b&0x80) {
+			count=(b&0x7f)+3;
+			state=ST_DISTH;
+		} else {
+			count=b+1;
+			state=ST_LIT;
+		}
+	} else if (state==ST_LIT) {
+		if (!put(b)) return 0;
+		if (--count==0) state=ST_CTRL;
+	} else if (state==ST_DISTH) {
+		dist=b<<8;
+		state=ST_DISTL;
+	} else if (state==ST_DISTL) {
+		dist|=b;
+		if (dist==0) {
+			state=ST_DONE;
+		} else {
+			if (!copy(dist, count)) return 0;
+			state=ST_CTRL;
+		}
+	}
+	return 1;
+}
+
+//Program what's left. Returns the length of the decompressed image, or 0 if
+//the stream didn't end properly.
+unsigned long lzEnd(void) {
+	flush();
+	if (state!=ST_DONE) return 0;
+	return outAddr-start;
+}
+
+//CRC32 of the decompressed image, after lzEnd().
+unsigned long lzCrc(void) {
+	return imageCrc32Final(crc);
+}
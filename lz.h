@@ -0,0 +1,4 @@
+void lzStart(long addr, long lim);
+char lzFeed(unsigned char b);
+unsigned long lzEnd(void);
+unsigned long lzCrc(void);
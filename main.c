@@ -25,73 +25,127 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "debug.h"
 #include <avr/io.h>
 #include <avr/wdt.h>
+#include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <stdio.h>
 #include "overclock.h"
+#include "image.h"
+#include "sample.h"
+#include "unpack.h"
+#include "vector.h"
+#include "bytecode.h"
+#include "stream.h"
+#include "speed.h"
+#include "bridge.h"
+#include "print.h"
+#include "arena.h"
+#include "eeconf.h"
 
-static long addr=0;
-
-//Byte read handler for the XSVF parser. Reads from flash, but does it
-//CACHESIZE bytes at a time and will return bytes from that cache.
-
-//CACHESIZE needs to be power of 2
-#define CACHESIZE 32
-unsigned char xsvfGetByte(void) {
-	unsigned char data;
-	static char cache[CACHESIZE];
-	wdt_reset();
-	if ((addr&(CACHESIZE-1))==0) {
-		//refill cache
-		ioFlashEnable();
-		f25cxxReadBuff(addr, cache, CACHESIZE);
-		ioJtagEnable();
-	}
-	data=cache[addr&(CACHESIZE-1)];
-	addr++;
-	return data;
-}
+//Buffers of the playing, uploading and sampling phases, see arena.h.
+Arena arena;
+//Doesn't compile if a phase grew past the budget. Whether the budget and
+//everything else fit in the SRAM, the AVR build checks, see the Makefile.
+typedef char arenaFits[(sizeof(Arena)<=ARENA_SIZE)?1:-1];
 
 //Main routine
 int main(void) {
 	int i=0;
+	unsigned long ms;
+	char ok, slot, done=0;
+	unsigned char (*play)(void)=xsvfRun;
 	ioInit();
 	overclockInit();
+	//Time from power-on to done configuring, see below.
+	overclockStopwatchStart();
 	wdt_enable(WDTO_1S);
 
-	//Test flash.
+	//Find out what flash we have.
 	ioFlashEnable();
-	i=f25cxxGetID();
+	f25cxxInit();
 
-	stdoutInitEeprom(); //log to eeprom
-	dprintf("Pwr-on\n");
+	//Log to eeprom, but not before we're done configuring: every byte
+	//written there takes ms the target would have to wait.
+	stdoutInitDeferred();
+
+	//First boot: find out how fast this chip can go.
+	if (!overclockIsCalibrated()) {
+		overclockCalibrate();
+		dputs("Calibrated: ");
+		ddec(overclockMaxKhz());
+		dputs(" KHz\n");
+	}
 
 	overclockCpu(OVERCLOCK_MAX); //UPLOAD MORE QUICKER NAU!!!!!11
-	//Retry uploading config a few times.
-	for (i=0; i<5; i++) {
-		if (i==3) {
-			//We had a few retries. Perhaps try again at a lower speed?
-			overclockCpu(OVERCLOCK_STD);
+	//Don't bother playing an image that didn't upload completely or got
+	//corrupted; go to xmodem straight away. Check at normal speed too before
+	//giving up, in case the flash just can't keep up.
+	slot=imageBootSlot();
+	ok=imageCheck(slot);
+	if (!ok) {
+		overclockCpu(OVERCLOCK_STD);
+		ok=imageCheck(slot);
+		overclockCpu(OVERCLOCK_MAX);
+	}
+	//Find out how fast TCK can go on this chain, see speed.c.
+	if (ok) {
+		speedSetup();
+		if (vectorOpen(IMAGE_DATA(slot))) play=vectorRun;
+		else if (bytecodeOpen(IMAGE_DATA(slot))) play=bytecodeRun;
+	}
+	//If the image has an identity check and the target passes it, it kept
+	//its configuration (non-volatile part, or only we got reset): nothing
+	//to do. Vector and bytecode images don't have one.
+	if (ok && play==xsvfRun) {
+		unpackOpen(IMAGE_DATA(slot));
+		if (xsvfIdentify()) {
+			dputs("Target already configured.\n");
+			ok=0;
 		}
-		addr=0;
-		if (xsvfRun()) {
+	}
+	//Retry uploading config a few times.
+	//xsvfRun() drops the clock by itself for records that fail at full speed,
+	//on top of that every retry goes one TCK speed slower.
+	for (i=0; i<5 && ok; i++) {
+		if (i) speedSlower();
+		if (play==xsvfRun) xsvfSeek(IMAGE_DATA(slot));
+		if (play()) {
 			//Success! All done.
-			dprintf("Done configuring: success.\n");
+			done=1;
 			break;
 		}
 	}
 
+	//Keep how long that took for xmodem to show, then catch up on logging.
+	ms=overclockStopwatchStop();
+	if (ms>0xffff) ms=0xffff;
+	eeprom_update_word((uint16_t *)EE_BOOTMS, ms);
+	stdoutFlushDeferred();
+	dputs("Pwr-on, slot ");
+	ddec(slot);
+	dputs(", ");
+	ddec(ms);
+	dputs(" ms\n");
+	if (done) dputs("Done configuring: success.\n");
+
 	//then drop to xmodem upload
 	overclockCpu(OVERCLOCK_STD); //Serial needs normal clock speeds...
 	stdoutInit(52-1); //19200 baud = 104, 38400 baud = 52
 	ioUartEnable();
 	sei(); //sw uart is interrupt driven, so enable interrupts
-	dprintf("Dropping to xmodem.\r\n");
-	ioFlashEnable();
-	i=f25cxxGetID();
-	ioUartEnable();
-	printf("Flash ID=%i\r\n", i);
-	xmodemWriteFlash();
+	dputs("Dropping to xmodem.\r\n");
+	printStr("Flash ID=");
+	printHex(f25cxxJedecId, 6);
+	printStr(", ");
+	printDec(f25cxxSize>>10);
+	printStr(" KiB, boot took ");
+	printDec(eeprom_read_word((uint16_t *)EE_BOOTMS));
+	printStr(" ms\r\n");
+	while ((ok=xmodemWriteFlash())!=XMODEM_DONE) {
+		if (ok==XMODEM_SAMPLE) sampleRun();
+		if (ok==XMODEM_STREAM) streamRun();
+		if (ok==XMODEM_BRIDGE) bridgeRun();
+	}
 
 	while(1);
 }
@@ -20,10 +20,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 /*
 Routines to try and overclock the ATTiny85, and to reset to
-the factory 16MHz value if needed.
+the factory 16MHz value if needed. Because every chip overclocks differently,
+the max speed is found by overclockCalibrate() once and stored in EEPROM.
 */
 
 #include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include "io.h"
+#include "flash25cxx.h"
+#include "eeconf.h"
 #include "overclock.h"
 #define nop() asm("nop")
 
@@ -33,10 +40,23 @@ the factory 16MHz value if needed.
 //it works :)
 //I don't give any guarantees on this code anyway, but I'll give even
 //less than that if you have this define uncommented.
+//With this undefined, calibration won't go further than about 20MHz.
 #define OVERCLOCK_DANGEROUSLY
 
+//Calibration parameters: the amount of flash bytes to CRC at every step, and
+//how many times the CRC needs to come out right before a step is OK.
+#define CAL_BYTES 256
+#define CAL_READS 8
+#define CAL_BUFSZ 32
+
 static unsigned char origOsccal, maxOsccal;
 static char currState;
+static char calibrated;
+
+//Stopwatch, see overclockStopwatchStart(). swTime is in 1/16 ms.
+static unsigned int swOverflows;
+static unsigned long swTime;
+static char swRunning;
 
 //I seem to remember that OSCCAL[7]=0 gives a range half of that of OSCCAL[7]=1;
 //and that they intersect ar OSCCAL[6..0]=0x40, so the speed of 
@@ -62,24 +82,208 @@ static void slideClockTo(unsigned char clock) {
 	OSCCAL=clock;
 }
 
-//Get osccal value, calculate the value to write when we want to overclock
-void overclockInit(void) {
-	origOsccal=OSCCAL; //This is the OSCCAL value required for 16MHz exactly.
+//Highest OSCCAL value we're willing to try.
+static unsigned char topOsccal(void) {
 #ifdef OVERCLOCK_DANGEROUSLY
-	maxOsccal=0xff; //I'm giving her all she's got, Captain! 
+	return 0xff; //I'm giving her all she's got, Captain! 
 #else
 	//Overclock to a resonable 20MHz, by setting osccal to 125% of its original value.
-	maxOsccal=toMaxRange(OSCCAL)&0x7F; //and with 0x7f to cut off range bit
-	maxOsccal=maxOsccal+(maxOsccal>>2); //aka: maxOsccal*1.25
-	maxOsccal|=0x80; //reset range bit
+	unsigned char top;
+	top=toMaxRange(origOsccal)&0x7F; //and with 0x7f to cut off range bit
+	top=top+(top>>2); //aka: top*1.25
+	return top|0x80; //reset range bit
 #endif
+}
+
+//Get osccal value, and the value to write when we want to overclock. That one
+//comes from EEPROM if the chip has been calibrated already.
+void overclockInit(void) {
+	unsigned char cal;
+	origOsccal=OSCCAL; //This is the OSCCAL value required for 16MHz exactly.
+	cal=eeprom_read_byte((uint8_t *)EE_OSCCAL);
+	if ((cal&0x80) && cal==(unsigned char)~eeprom_read_byte((uint8_t *)EE_OSCCALCHK)) {
+		maxOsccal=cal;
+		calibrated=1;
+	} else {
+		maxOsccal=topOsccal();
+		calibrated=0;
+	}
 	currState=OVERCLOCK_STD;
 }
 
+//Read the first CAL_BYTES of flash and return the CRC of that. What's in
+//there doesn't matter, as long as it reads the same every time.
+static unsigned int calFlashCrc(void) {
+	unsigned char buff[CAL_BUFSZ];
+	unsigned int crc=0xffff;
+	int a, x;
+	ioFlashEnable();
+	for (a=0; a<CAL_BYTES; a+=CAL_BUFSZ) {
+		wdt_reset();
+		f25cxxReadBuff(a, buff, CAL_BUFSZ);
+		for (x=0; x<CAL_BUFSZ; x++) crc=_crc_ccitt_update(crc, buff[x]);
+	}
+	return crc;
+}
+
+//Measure the CPU clock against the watchdog oscillator by counting Timer1
+//ticks (CK/256) during one 16ms watchdog period. The watchdog oscillator
+//isn't accurate at all, so only the ratio between two measurements means
+//something.
+static unsigned int calMeasureClock(void) {
+	unsigned int ticks=0;
+	TCCR1=(1<<CS13)|(1<<CS10);
+	//Watchdog to interrupt mode, 16ms, so we can poll its flag; interrupts
+	//are off. Only the interrupt handler clears WDIE, so while it is set the
+	//watchdog never resets: we put it back in reset mode when done.
+	wdt_reset();
+	WDTCR=(1<<WDCE)|(1<<WDE);
+	WDTCR=(1<<WDIF)|(1<<WDIE)|(1<<WDE);
+	while (!(WDTCR&(1<<WDIF))) ; //sync to the start of a period
+	WDTCR=(1<<WDIF)|(1<<WDIE)|(1<<WDE);
+	TCNT1=0;
+	TIFR=(1<<TOV1);
+	while (!(WDTCR&(1<<WDIF))) {
+		if (TIFR&(1<<TOV1)) {
+			TIFR=(1<<TOV1);
+			ticks+=256;
+		}
+	}
+	ticks+=TCNT1;
+	TCCR1=0;
+	wdt_enable(WDTO_1S);
+	return ticks;
+}
+
+static void calStore(unsigned char cal, unsigned int khz) {
+	eeprom_update_byte((uint8_t *)EE_OSCCAL, cal);
+	eeprom_update_byte((uint8_t *)EE_OSCCALCHK, ~cal);
+	eeprom_update_word((uint16_t *)EE_OSCKHZ, khz);
+	eeprom_busy_wait();
+}
+
+//Find the fastest OSCCAL this specific chip still reliably works at. Sweeps
+//OSCCAL upwards from the factory value; every step the clock is measured and
+//the start of the flash is CRC'ed a few times. When that fails or the clock
+//stops going up, we back off until we're 1/16th below the fastest good clock
+//and store that in EEPROM, so next boots can go there straight away.
+//Needs the flash; leaves the watchdog enabled at 1S.
+void overclockCalibrate(void) {
+	unsigned char good, cal, x;
+	unsigned int refCrc, refClk, clk, goodClk;
+	char ok;
+
+	//Needs Timer1 to itself.
+	overclockStopwatchStop();
+	slideClockTo(origOsccal);
+	//Store the factory value first. If we crash somewhere in the sweep, the
+	//watchdog resets us and we'll just run at the normal speed from then on.
+	good=toMaxRange(origOsccal);
+	calStore(good, 16000);
+	refCrc=calFlashCrc();
+	refClk=calMeasureClock();
+	goodClk=refClk;
+	while (good<topOsccal()) {
+		cal=good+1;
+		slideClockTo(cal);
+		clk=calMeasureClock();
+		ok=(clk>=goodClk);
+		for (x=0; x<CAL_READS && ok; x++) {
+			if (calFlashCrc()!=refCrc) ok=0;
+		}
+		if (!ok) break;
+		good=cal;
+		goodClk=clk;
+	}
+	//Back off for some safety margin.
+	clk=refClk;
+	while (good>toMaxRange(origOsccal)) {
+		slideClockTo(good);
+		clk=calMeasureClock();
+		if (clk<=goodClk-(goodClk>>4)) break;
+		good--;
+		clk=refClk;
+	}
+	slideClockTo(origOsccal);
+
+	maxOsccal=good;
+	calibrated=1;
+	calStore(good, (16000UL*clk)/refClk);
+	overclockStopwatchStart(); //so the first boot leaves out the calibration
+}
+
+//Returns true if maxOsccal comes from an earlier calibration.
+char overclockIsCalibrated(void) {
+	return calibrated;
+}
+
+//Returns the clock speed in KHz of OVERCLOCK_MAX, as measured by the calibration.
+unsigned int overclockMaxKhz(void) {
+	return eeprom_read_word((uint16_t *)EE_OSCKHZ);
+}
+
+//Clock in KHz of the state we're in. Halfway in OSCCAL is about halfway in
+//speed too.
+static unsigned int currKhz(void) {
+	unsigned int max=calibrated?overclockMaxKhz():16000;
+	if (currState==OVERCLOCK_MAX) return max;
+	if (currState==OVERCLOCK_MID) return (16000+max)>>1;
+	return 16000;
+}
+
+//Timer1 runs off the CPU clock, so its ticks only mean something together
+//with the clock they were counted at. Add what was counted since the last
+//lap to swTime, at the clock we've been running at, and start counting again.
+static void stopwatchLap(void) {
+	unsigned long ticks;
+	TCCR1=0;
+	ticks=TCNT1;
+	overclockStopwatchPoll();
+	ticks+=(unsigned long)swOverflows<<8;
+	swOverflows=0;
+	TCNT1=0;
+	TCCR1=(1<<CS13)|(1<<CS12)|(1<<CS11)|(1<<CS10); //CK/16384
+	swTime+=(ticks<<11)/(currKhz()>>7);
+}
+
+//Start measuring time in ms, whatever the clock does in between. Takes
+//Timer1, but no interrupts: those would mess up the TCK timing of the
+//players. Instead, overclockStopwatchPoll() has to be called now and then.
+void overclockStopwatchStart(void) {
+	swOverflows=0;
+	swTime=0;
+	swRunning=1;
+	TCNT1=0;
+	TIFR=(1<<TOV1);
+	TCCR1=(1<<CS13)|(1<<CS12)|(1<<CS11)|(1<<CS10); //CK/16384
+}
+
+//Timer1 only counts to 255, which at CK/16384 is 4M CPU cycles: 260ms at
+//the normal clock, about half that overclocked. While the stopwatch runs,
+//this needs to get called at least that often, so no overflow gets lost.
+void overclockStopwatchPoll(void) {
+	if (TIFR&(1<<TOV1)) {
+		TIFR=(1<<TOV1);
+		swOverflows++;
+	}
+}
+
+//Stop measuring and return the ms since overclockStopwatchStart(). Frees
+//Timer1 again.
+unsigned long overclockStopwatchStop(void) {
+	if (!swRunning) return swTime>>4;
+	stopwatchLap();
+	TCCR1=0;
+	swRunning=0;
+	return swTime>>4;
+}
+
 //Set the CPU speed
 void overclockCpu(char toWhat) {
+	if (swRunning) stopwatchLap();
 	if (toWhat==OVERCLOCK_STD) slideClockTo(origOsccal);
 	if (toWhat==OVERCLOCK_MAX) slideClockTo(maxOsccal);
+	if (toWhat==OVERCLOCK_MID) slideClockTo((toMaxRange(origOsccal)+maxOsccal)>>1);
 	currState=toWhat;
 }
 
@@ -1,6 +1,13 @@
 void overclockInit(void);
 void overclockCpu(char toWhat);
 char overclockGetState();
+void overclockCalibrate(void);
+char overclockIsCalibrated(void);
+unsigned int overclockMaxKhz(void);
+void overclockStopwatchStart(void);
+unsigned long overclockStopwatchStop(void);
+void overclockStopwatchPoll(void);
 
 #define OVERCLOCK_STD 0
-#define OVERCLOCK_MAX 1
\ No newline at end of file
+#define OVERCLOCK_MAX 1
+#define OVERCLOCK_MID 2 //halfway between the two, see speed.c
\ No newline at end of file
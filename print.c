@@ -0,0 +1,64 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Formatting for the log and the xmodem mode, instead of printf(). avr-libc's
+vfprintf takes a big bite out of the 8KiB of flash and needs a deep stack,
+and all the firmware ever prints is text, hex and decimal numbers. Everything
+goes out through putchar(), so to wherever stdout points (the UART or the
+EEPROM log, see stdout.c).
+*/
+
+#include <stdio.h>
+#include <avr/pgmspace.h>
+#include "print.h"
+
+//Print a string from program memory; printStr() puts it there.
+void printStrP(const char *s) {
+	char c;
+	while ((c=pgm_read_byte(s++))!=0) putchar(c);
+}
+
+//Print v as digits hex digits, or with as many as it needs if digits is 0.
+void printHex(unsigned long v, unsigned char digits) {
+	unsigned char c;
+	if (digits==0) {
+		digits=8;
+		while (digits>1 && (v>>((digits-1)*4))==0) digits--;
+	}
+	while (digits--) {
+		c=(v>>(digits*4))&0xf;
+		putchar((c<10)?'0'+c:'a'-10+c);
+	}
+}
+
+void printDec(long v) {
+	char buf[10];
+	unsigned char n=0;
+	unsigned long u=v;
+	if (v<0) {
+		putchar('-');
+		u=-v;
+	}
+	do {
+		buf[n++]='0'+u%10;
+		u/=10;
+	} while (u);
+	while (n) putchar(buf[--n]);
+}
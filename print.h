@@ -0,0 +1,7 @@
+#include <avr/pgmspace.h>
+
+#define printStr(s) printStrP(PSTR(s))
+
+void printStrP(const char *s);
+void printHex(unsigned long v, unsigned char digits);
+void printDec(long v);
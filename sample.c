@@ -0,0 +1,214 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Boundary scan sampler. Loads SAMPLE/PRELOAD into the target and then keeps
+capturing its boundary register, so the host can watch the pins of a running
+board. JTAG and the UART share pins, so captures are taken in batches: fill
+the buffer in JTAG mode, then switch to the UART and send it all.
+
+Parameters, sent by the host right after the 'p' key, 16-bit ones msb-first:
+irlen (8 bit), SAMPLE instruction, hir, tir, hdr, tdr, boundary register
+length in bits and the sample period in 64us ticks (0 = as fast as possible).
+
+Output frames, each starting with a 0xFF sync byte. TXD doubles as TCK, so the
+host receives garbage (mostly zeroes) while we capture, and needs something to
+find the next frame by:
+0xFF 'D' n lenH lenL data: n captures. Every capture is the XOR with the previous
+one, run-length encoded: 0x00-0x7F is a run of 1-128 unchanged bytes, 0x80-0xFF
+is 1-128 changed bytes following it. Bytes are in shift order, lsb first.
+0xFF 'S' rateH rateL droppedH droppedL: sent about once a second; the samples/sec
+achieved and the sample times missed because we were busy sending. After
+this, the next capture is compared against all zeroes again, so a host can
+sync up.
+
+Sampling stops when the host sends anything.
+*/
+
+#include <stdio.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include "io.h"
+#include "jtag.h"
+#include "swuart.h"
+#include "arena.h"
+#include "sample.h"
+
+#define WORSTCASE (MAXBSBYTES+MAXBSBYTES/2+1) //encoded size of the worst capture
+#define TICKSPERSEC 15625 //Timer1 at CK/1024
+#define MAXBATCH 255
+#define SYNC 0xff
+#define BYTETICKS 4 //a character at 38400 baud takes 260us
+#define FRAMEBYTES 6 //idle character, sync and header
+
+static unsigned long now;
+static unsigned char lastTcnt;
+
+//Timer1 only counts to 255 (16ms), so keep track of the time in software.
+//Needs to get called at least that often.
+static void tick(void) {
+	unsigned char t=TCNT1;
+	now+=(unsigned char)(t-lastTcnt);
+	lastTcnt=t;
+}
+
+//Read a parameter byte. Returns -1 if the host takes too long.
+static int getParam(void) {
+	unsigned int t;
+	for (t=0; t<10000; t++) {
+		if (swUartHasRecved()) return getchar()&0xff;
+		wdt_reset();
+		_delay_us(100);
+	}
+	return -1;
+}
+
+static unsigned int getParamWord(void) {
+	unsigned int r=getParam()<<8;
+	return r|getParam();
+}
+
+//Capture the boundary register and append it to buff, encoded as described
+//above. Returns the new length of the buffer.
+static int capture(unsigned char *buff, int pos, unsigned char *prev, unsigned int bits, unsigned int hdr, unsigned int tdr) {
+	unsigned char in, d, bytes=(bits+7)>>3, i, n, cnt=0;
+	int hdrPos=0;
+	char zero, type=-1;
+	jtagGotoState(JTAG_SHIFTDR);
+	jtagShiftPad(hdr, 0, 0);
+	for (i=0; i<bytes; i++) {
+		n=(i==bytes-1)?bits-(i*8):8;
+		if (n==8 && (i<bytes-1 || tdr)) in=jtagShiftByte(0);
+		else in=jtagShift(0, n, (i==bytes-1 && tdr==0));
+		d=in^prev[i];
+		prev[i]=in;
+		zero=(d==0);
+		if (zero!=type || cnt==128) {
+			hdrPos=pos++;
+			type=zero;
+			cnt=0;
+		}
+		cnt++;
+		buff[hdrPos]=(zero?0x00:0x80)|(cnt-1);
+		if (!zero) buff[pos++]=d;
+	}
+	jtagShiftPad(tdr, 0, 1);
+	return pos;
+}
+
+static void sendWord(unsigned int w) {
+	swUartXmit(w>>8);
+	swUartXmit(w);
+}
+
+void sampleRun(void) {
+	unsigned char *buff=arena.sample.buff, *prev=arena.sample.prev;
+	unsigned char irlen, n, i;
+	unsigned int ins, hir, tir, hdr, tdr, bits, period, samples=0, dropped=0;
+	unsigned long next, statsStart;
+	int pos;
+
+	irlen=getParam();
+	ins=getParamWord();
+	hir=getParamWord();
+	tir=getParamWord();
+	hdr=getParamWord();
+	tdr=getParamWord();
+	bits=getParamWord();
+	period=getParamWord();
+	if (irlen<1 || irlen>16 || bits<1 || bits>MAXBSBYTES*8) return;
+	for (i=0; i<MAXBSBYTES; i++) prev[i]=0;
+
+	//Load SAMPLE/PRELOAD, then park in Run-Test/Idle. That's where the
+	//TAP stays while the UART wiggles TCK, because TMS is low.
+	ioJtagEnable();
+	jtagReset();
+	jtagGotoState(JTAG_SHIFTIR);
+	jtagShiftPad(hir, 1, 0);
+	jtagShift(ins, (irlen>8)?8:irlen, (irlen<=8 && tir==0));
+	if (irlen>8) jtagShift(ins>>8, irlen-8, (tir==0));
+	jtagShiftPad(tir, 1, 1);
+	jtagGotoState(JTAG_RUNTEST);
+
+	TCCR1=(1<<CS13)|(1<<CS11)|(1<<CS10);
+	lastTcnt=TCNT1;
+	now=0;
+	next=0;
+	statsStart=0;
+	while(1) {
+		//Take captures until the buffer may not fit the next one, or until
+		//there's time to send it before the next sample is due.
+		ioJtagEnable();
+		pos=0;
+		n=0;
+		while (pos<=SAMPLE_BUFSIZE-WORSTCASE && n<MAXBATCH) {
+			tick();
+			if (period) {
+				if ((long)(now-next)<0) {
+					//Too early. Send what we have if that's done in time
+					//to not miss the next sample (it may be a bit late),
+					//else wait.
+					if (n && next-now+period>(unsigned long)(pos+FRAMEBYTES)*BYTETICKS) break;
+					wdt_reset();
+					continue;
+				}
+				//Sample times that passed while we were busy are lost.
+				while (now-next>=period) {
+					next+=period;
+					dropped++;
+				}
+				next+=period;
+			}
+			pos=capture(buff, pos, prev, bits, hdr, tdr);
+			n++;
+			if (now-statsStart>=TICKSPERSEC) break;
+		}
+		jtagGotoState(JTAG_RUNTEST);
+		samples+=n;
+
+		ioUartEnable();
+		wdt_reset();
+		if (n) {
+			swUartXmit(SYNC);
+			swUartXmit('D');
+			swUartXmit(n);
+			sendWord(pos);
+			for (i=0; i<pos; i++) {
+				swUartXmit(buff[i]);
+				if ((i&15)==0) tick();
+			}
+		}
+		tick();
+		if (now-statsStart>=TICKSPERSEC) {
+			swUartXmit(SYNC);
+			swUartXmit('S');
+			sendWord((unsigned long)samples*TICKSPERSEC/(now-statsStart));
+			sendWord(dropped);
+			samples=0;
+			dropped=0;
+			statsStart=now;
+			for (i=0; i<MAXBSBYTES; i++) prev[i]=0;
+		}
+		swUartFlush();
+		if (swUartHasRecved()) break;
+	}
+	getchar();
+	TCCR1=0;
+}
@@ -0,0 +1 @@
+void sampleRun(void);
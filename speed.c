@@ -0,0 +1,204 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Finds out how fast the JTAG chain can be clocked. The CPU clock overclock.c
+calibrates is the fastest the flash can be read at, which says nothing about
+whether the target, its cable and level shifters keep up with a TCK that
+fast. So before the first play on a chain, all devices get put in BYPASS and
+pseudo-random patterns are shifted through them at every speed, fastest
+first. The first speed that gets every bit back is the one we play at.
+
+The speeds, fastest first:
+0: CPU at OVERCLOCK_MAX
+1: CPU at OVERCLOCK_MID
+2: CPU at OVERCLOCK_STD
+3-7: OVERCLOCK_STD and 1, 2, 4, 8 or 16us more on every TCK edge, see io.c
+
+The speed is stored in EEPROM with the IDCODE the chain shows after a reset,
+for the last SPEED_ENTRIES chains, so a board only sweeps the first time it
+sees a target. Erase the EEPROM to sweep again.
+*/
+
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include "io.h"
+#include "jtag.h"
+#include "overclock.h"
+#include "eeconf.h"
+#include "arena.h"
+#include "debug.h"
+#include "speed.h"
+
+#define SPEED_ENTRIES 3 //chains remembered; 6 bytes each: IDCODE, speed, ~speed
+#define BYPASSBITS 512 //ones to shift into the IRs, more than the chain has
+#define MAXCHAIN 64 //devices we look for
+#define PATTERN_BYTES 128 //bits shifted per round
+#define ROUNDS 4 //rounds that have to come back right
+
+static unsigned char current;
+static unsigned int lfsr;
+
+void speedApply(unsigned char speed) {
+	if (speed==0) overclockCpu(OVERCLOCK_MAX);
+	else if (speed==1) overclockCpu(OVERCLOCK_MID);
+	else overclockCpu(OVERCLOCK_STD);
+	ioJtagSetDelay((speed<3)?0:(1<<(speed-3)));
+	current=speed;
+}
+
+//One step slower than we are, if there is one.
+void speedSlower(void) {
+	if (current<SPEED_SLOWEST) speedApply(current+1);
+}
+
+//Reads the 32 bits the chain shows after a reset: the IDCODE of the device
+//nearest to TDO, if it has one.
+static unsigned long readIdcode(void) {
+	unsigned long id=0;
+	unsigned char x;
+	jtagReset();
+	jtagGotoState(JTAG_SHIFTDR);
+	for (x=0; x<32; x+=8) id|=(unsigned long)jtagShift(0xff, 8, 0)<<x;
+	jtagReset();
+	return id;
+}
+
+//Puts every device in BYPASS and goes to Shift-DR. The bypass registers
+//capture a 0, so the first bits that come out are zeroes. This is done at
+//the slowest speed: a bit going wrong here could load any instruction.
+static void bypass(void) {
+	speedApply(SPEED_SLOWEST);
+	jtagReset();
+	jtagGotoState(JTAG_SHIFTIR);
+	jtagShiftPad(BYPASSBITS, 1, 1);
+	jtagGotoState(JTAG_SHIFTDR);
+}
+
+//Counts the devices in the chain, by how long a 1 takes to come out again.
+//Returns 0 if it doesn't come out at all.
+static unsigned char chainLength(void) {
+	unsigned char n;
+	bypass();
+	for (n=0; n<=MAXCHAIN; n++) {
+		if (jtagShift(n==0, 1, 0)) break;
+	}
+	jtagReset();
+	return (n<=MAXCHAIN)?n:0;
+}
+
+//Shifts ROUNDS rounds of PATTERN_BYTES random bytes through the devices
+//(which take n bits) at this speed. Returns 1 if they all came out right.
+//Only the shifting in Shift-DR is done at the speed under test, so a wrong
+//bit can't do more than come out wrong.
+static unsigned char test(unsigned char speed, unsigned char n) {
+	unsigned char *buf=arena.play.tdi;
+	unsigned char r, b, x, in, want, ok=1;
+	unsigned int i, j, len=PATTERN_BYTES+(n>>3)+1;
+	for (r=0; r<ROUNDS && ok; r++) {
+		for (i=0; i<len; i++) {
+			b=0;
+			if (i<PATTERN_BYTES) {
+				for (x=0; x<8; x++) {
+					lfsr=(lfsr>>1)^(-(lfsr&1)&0xb400);
+					b=(b<<1)|(lfsr&1);
+				}
+			}
+			buf[i]=b;
+		}
+		bypass();
+		speedApply(speed);
+		for (i=0; i<len; i++) {
+			wdt_reset();
+			overclockStopwatchPoll();
+			in=jtagShiftByte(buf[i]);
+			//What went in n bits earlier.
+			for (x=0; x<8; x++) {
+				j=i*8+x;
+				want=(j<n)?0:(buf[(j-n)>>3]>>((j-n)&7))&1;
+				if (((in>>x)&1)!=want) ok=0;
+			}
+		}
+		speedApply(SPEED_SLOWEST);
+		jtagReset();
+	}
+	return ok;
+}
+
+//Entry i of the EEPROM table.
+#define ENTRY(i) ((uint8_t *)EE_SPEED+(i)*6)
+
+static unsigned char lookup(unsigned long id) {
+	unsigned char i, e[6];
+	for (i=0; i<SPEED_ENTRIES; i++) {
+		eeprom_read_block(e, ENTRY(i), 6);
+		if (e[4]!=(unsigned char)~e[5] || e[4]>SPEED_SLOWEST) continue;
+		if (id==((unsigned long)e[3]<<24|(unsigned long)e[2]<<16|(unsigned int)e[1]<<8|e[0])) return e[4];
+	}
+	return 0xff;
+}
+
+//Puts the chain first in the table, the others move down.
+static void store(unsigned long id, unsigned char speed) {
+	unsigned char i, e[6];
+	char oldOverclockState=overclockGetState();
+	overclockCpu(OVERCLOCK_STD); //EEPROM writes may fail overclocked
+	for (i=SPEED_ENTRIES-1; i>0; i--) {
+		eeprom_read_block(e, ENTRY(i-1), 6);
+		eeprom_update_block(e, ENTRY(i), 6);
+	}
+	for (i=0; i<4; i++) e[i]=id>>(i*8);
+	e[4]=speed;
+	e[5]=~speed;
+	eeprom_update_block(e, ENTRY(0), 6);
+	eeprom_busy_wait();
+	overclockCpu(oldOverclockState);
+}
+
+//Picks the speed for the chain that's connected: the stored one if we've
+//seen this chain before, else the fastest one the sweep finds. Without a
+//chain that answers, it's the fastest. Returns the speed, see speedApply().
+unsigned char speedSetup(void) {
+	unsigned long id;
+	unsigned char speed, n;
+	ioJtagEnable();
+	speedApply(SPEED_SLOWEST);
+	id=readIdcode();
+	speed=lookup(id);
+	if (speed==0xff) {
+		n=chainLength();
+		if (n==0) {
+			dputs("TCK: no chain\n");
+			speedApply(0);
+			return 0;
+		}
+		lfsr=0xace1;
+		for (speed=0; speed<SPEED_SLOWEST; speed++) {
+			if (test(speed, n)) break;
+		}
+		store(id, speed);
+	}
+	dputs("TCK speed ");
+	ddec(speed);
+	dputs(" for ");
+	dhex(id, 8);
+	dputc('\n');
+	speedApply(speed);
+	return speed;
+}
@@ -0,0 +1,5 @@
+#define SPEED_SLOWEST 7
+
+unsigned char speedSetup(void);
+void speedApply(unsigned char speed);
+void speedSlower(void);
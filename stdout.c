@@ -25,46 +25,79 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <avr/eeprom.h>
 #include "swuart.h"
 #include "overclock.h"
+#include "eeconf.h"
 
 //When JTAG and flash are connected, the device doesn't have a serial port
 //to write stuff to. Instead, it will write it to an EEPROM ring buffer. The 
 //format of the EEPROM ring buffer is that the last byte written always
 //is 0xFF. Skip that and all the following 0xFFs, wrap around if needed, and
-//you'll arrive at the first byte written (and not overwritten yet).
+//you'll arrive at the first byte written (and not overwritten yet). The
+//ring buffer is EE_LOGSIZE bytes; the rest of the EEPROM is for settings.
 
-//Write a character to the EEPROM, to later read out.
+//Where the next log byte goes, i.e. the 0xFF that ends the log. Found once,
+//-1 until then.
+static int logEnd=-1;
+
+//Write n characters to the EEPROM, to later read out.
 //We need to set the CPU clock to normal values while writing, else the
-//write may fail.
-static int eeprom_putchar(char c, FILE *stream) {
-	int pos=0;
+//write may fail. That and the writes themselves (a few ms each) are why
+//the boot logs to RAM first, see stdoutInitDeferred().
+static void eepromWrite(const char *s, unsigned char n) {
 	//Save CPU sped and reset to normal speed
 	char oldOverclockState=overclockGetState();
 	overclockCpu(OVERCLOCK_STD);
 	//Find the last written byte
-	while (eeprom_read_byte(pos)!=0xff && pos<512) pos++;
-	if (pos==512) pos=0;  //Shouldn't happen.
-	//Write the byte and the following 0xFF
-	eeprom_update_byte(pos, c);
-	eeprom_update_byte(pos+1, 0xff);
+	if (logEnd<0) {
+		logEnd=0;
+		while (eeprom_read_byte(logEnd)!=0xff && logEnd<EE_LOGSIZE) logEnd++;
+		if (logEnd==EE_LOGSIZE) logEnd=0;  //Shouldn't happen.
+	}
+	//Write the bytes and the following 0xFF
+	while (n--) {
+		eeprom_update_byte(logEnd, *s++);
+		if (++logEnd==EE_LOGSIZE) logEnd=0;
+	}
+	eeprom_update_byte(logEnd, 0xff);
 	eeprom_busy_wait();
 	//Reset CPU speed.
 	overclockCpu(oldOverclockState);
+}
+
+static int eeprom_putchar(char c, FILE *stream) {
+	eepromWrite(&c, 1);
+	return 0;
+}
+
+//Boot log lines wait in RAM until the target is configured. Only when this
+//fills up before that, the EEPROM gets written early. SRAM is tight, so
+//this only holds what a normal boot logs: the TCK speed and the start and
+//end of the play. The first boot, with its calibration, writes early.
+#define DEFER_SIZE 64
+static char deferBuf[DEFER_SIZE];
+static unsigned char deferLen;
+
+static int defer_putchar(char c, FILE *stream) {
+	if (deferLen==DEFER_SIZE) {
+		eepromWrite(deferBuf, deferLen);
+		deferLen=0;
+	}
+	deferBuf[deferLen++]=c;
 	return 0;
 }
 
 //Dump whatever we've stored to EEPROM to stdout.
 void stdoutDumpEepromLog(void) {
-	int pos=511;
+	int pos=EE_LOGSIZE-1;
 	int x;
 	unsigned char b;
 	//Find start of buffer
 	while (eeprom_read_byte(pos)!=0xff && pos>0) pos--;
 	//Write bytes to stdout
-	for (x=0; x<512; x++) {
+	for (x=0; x<EE_LOGSIZE; x++) {
 		b=eeprom_read_byte(pos++);
 		if (b=='\n') putchar('\r');
 		if (b<128) putchar(b);
-		if (pos>=512) pos=0;
+		if (pos>=EE_LOGSIZE) pos=0;
 	}
 }
 
@@ -79,6 +112,8 @@ static int uart_getchar(FILE *stream) {
 	return i&255;
 }
 
+//Logging to the EEPROM, straight away or deferred; stdoutInitDeferred()
+//and stdoutFlushDeferred() switch its put function.
 static FILE eepstdout = FDEV_SETUP_STREAM(eeprom_putchar, NULL, _FDEV_SETUP_WRITE);
 static FILE mystdout = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
 static FILE mystdin = FDEV_SETUP_STREAM(NULL, uart_getchar, _FDEV_SETUP_READ);
@@ -93,3 +128,26 @@ void stdoutInitEeprom(void) {
 	stdout = &eepstdout;
 }
 
+//Log to the EEPROM, but keep it in RAM until stdoutFlushDeferred(). What's
+//still in RAM is lost if we crash or get reset.
+void stdoutInitDeferred(void) {
+	deferLen=0;
+	fdev_setup_stream(&eepstdout, defer_putchar, NULL, _FDEV_SETUP_WRITE);
+	stdout = &eepstdout;
+}
+
+//Write what stdoutInitDeferred() kept back to the EEPROM in one go and log
+//straight to the EEPROM from now on.
+void stdoutFlushDeferred(void) {
+	if (deferLen) eepromWrite(deferBuf, deferLen);
+	deferLen=0;
+	fdev_setup_stream(&eepstdout, eeprom_putchar, NULL, _FDEV_SETUP_WRITE);
+	stdout = &eepstdout;
+}
+
+//Back to the UART stdoutInit() set up, after logging to the EEPROM for a
+//while.
+void stdoutRestoreUart(void) {
+	stdout = &mystdout;
+}
+
@@ -1,4 +1,7 @@
 void stdoutInit(int ubr);
 char uart_getchar(void);
 void stdoutInitEeprom(void);
+void stdoutInitDeferred(void);
+void stdoutFlushDeferred(void);
+void stdoutRestoreUart(void);
 void stdoutDumpEepromLog(void);
@@ -0,0 +1,162 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Plays an xsvf straight from the serial port, without erasing and programming
+the flash first. Meant for bring-up, where every try is a new image. Started
+with 'x' in xmodem mode; emu/xmbench.c -x is the other side.
+
+JTAG and the UART share pins (TXD is TCK, RXD is TDO), so the xsvf comes in
+chunks of STREAM_CHUNK bytes. When the parser has used up a chunk, the TAP
+gets parked where toggling TCK doesn't move it (xsvfPark()), we switch to the
+UART, ask for the next chunk and switch back to JTAG to play it.
+
+We ask for chunk n (counted mod 256) with 0xFF 'C' n ~n. The host answers with
+len n data[len] sum, sum being the 8-bit sum of everything before it. len=0
+means there's nothing more. If the chunk doesn't come in time or doesn't check
+out, we wait for the line to go quiet and ask for chunk n again. When done,
+we send 0xFF 'E' followed by 1 if the xsvf played fine, 0 if not. TXD
+wiggles while we play, so like with sample.c, the host receives garbage in
+between and has to look for the 0xFF.
+
+The parser can't go back to retry a record, but that only happens when
+overclocked, and streaming happens at the normal speed the UART needs.
+*/
+
+#include <stdio.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include "io.h"
+#include "swuart.h"
+#include "stdout.h"
+#include "xsvf.h"
+#include "unpack.h"
+#include "arena.h"
+#include "debug.h"
+#include "stream.h"
+
+#define SYNC 0xff
+#define TRIES 5 //requests for the same chunk before giving up on the host
+#define CHUNKTIME 10000 //100us ticks to wait for the host to answer
+#define BYTETIME 200 //100us ticks to wait for the next byte of a chunk
+
+static unsigned char len, pos, seq, failed;
+static long streamPos;
+
+//Receive a byte, or return -1 after ticks*100us.
+static int getTimed(unsigned int ticks) {
+	while (ticks--) {
+		if (swUartHasRecved()) return getchar()&0xff;
+		wdt_reset();
+		_delay_us(100);
+	}
+	return -1;
+}
+
+//Gets the next chunk. Returns 0 if the host has no more or doesn't answer.
+static unsigned char fetch(void) {
+	unsigned char *chunk=arena.play.chunk;
+	unsigned char i, tries, sum;
+	int n, c;
+	if (!xsvfPark()) {
+		dputs("Stream: can't pause in XSDRTDOB/C\n");
+		return 0;
+	}
+	ioUartEnable();
+	for (tries=0; tries<TRIES; tries++) {
+		swUartXmit(SYNC);
+		swUartXmit('C');
+		swUartXmit(seq);
+		swUartXmit(~seq);
+		swUartFlush();
+		n=getTimed(CHUNKTIME);
+		c=getTimed(BYTETIME);
+		if (n>=0 && n<=STREAM_CHUNK && c==seq) {
+			sum=n+c;
+			for (i=0; i<n; i++) {
+				c=getTimed(BYTETIME);
+				if (c<0) break;
+				chunk[i]=c;
+				sum+=c;
+			}
+			if (i==n && getTimed(BYTETIME)==sum) {
+				len=n;
+				pos=0;
+				seq++;
+				break;
+			}
+		}
+		//Wait for the rest of whatever this was to pass.
+		while (getTimed(BYTETIME)>=0) ;
+	}
+	ioJtagEnable();
+	return (tries<TRIES && len);
+}
+
+//Byte read handler for the xsvf parser. If the stream breaks off, it gets
+//XCOMPLETE (0x00) bytes so it stops soon, and the run fails.
+unsigned char streamGetByte(void) {
+	if (pos==len) {
+		len=0;
+		if (failed || !fetch()) {
+			failed=1;
+			return 0;
+		}
+	}
+	streamPos++;
+	return arena.play.chunk[pos++];
+}
+
+long streamTell(void) {
+	return streamPos;
+}
+
+//Only forward: what's been played is gone.
+void streamSeek(long p) {
+	if (p<streamPos) failed=1;
+	while (streamPos<p && !failed) streamGetByte();
+}
+
+//Plays the xsvf the host streams, then reports how that went.
+void streamRun(void) {
+	unsigned char ok;
+	len=0;
+	pos=0;
+	seq=0;
+	failed=0;
+	streamPos=0;
+	unpackOpenStream();
+	//The UART only gets the pins between chunks, so log to the EEPROM
+	//like a normal boot does.
+	stdoutInitEeprom();
+	ioJtagEnable();
+	ok=xsvfRun();
+	if (failed) ok=0;
+	dputs("Stream: ");
+	ddec(streamPos);
+	if (ok) dputs(" bytes, success\n");
+	else dputs(" bytes, failed\n");
+	xsvfPark();
+	stdoutRestoreUart();
+	ioUartEnable();
+	swUartXmit(SYNC);
+	swUartXmit('E');
+	swUartXmit(ok);
+	swUartFlush();
+}
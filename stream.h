@@ -0,0 +1,4 @@
+void streamRun(void);
+unsigned char streamGetByte(void);
+long streamTell(void);
+void streamSeek(long p);
@@ -60,8 +60,13 @@ void swUartInit(char mydivider) {
 	flags=F_TXDEMPTY|F_TXDDONE;
 }
 
+//Wait till UART is idle and nothing is queued
+void swUartFlush(void) {
+	while((flags&(F_TXDDONE|F_TXDEMPTY))!=(F_TXDDONE|F_TXDEMPTY)) ;
+}
+
 void swUartDisable() {
-	while(!(flags&F_TXDDONE)) ; //Wait till UART is idle
+	swUartFlush();
 	//Disable interrupts
 	TIMSK&=~((1<<4)|(1<<3));
 	GIMSK&=~(1<<5);
@@ -70,10 +75,30 @@ void swUartDisable() {
 	flags=F_TXDEMPTY|F_TXDDONE;
 }
 
+//Stop receiving but keep transmitting, for when RXD gets used for something
+//else.
+void swUartDisableRx(void) {
+	TIMSK&=~(1<<3);
+	GIMSK&=~(1<<5);
+	rxState=0;
+}
+
+//Turn the receiver back on, without touching the transmitter.
+void swUartEnableRx(void) {
+	GIFR=(1<<5); //forget about the wiggling RXD did in the mean time
+	GIMSK|=(1<<5);
+}
+
 void swUartEnable() {
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
 		//Enable interrupts
 		TIMSK|=(1<<4); //enable OC0A, not yet OC0B
+		//TXD is TCK as well, so the other side may be halfway into a
+		//garbage character. Keep the line high for a character time
+		//before the first start bit, so it's idle by then.
+		byteSending=0xff;
+		txState=UART_DATA0;
+		flags&=~F_TXDDONE;
 		GIMSK|=(1<<5); //enable PC ints
 		//Clear flags
 		TIFR=(1<<4)|(1<<3);
@@ -4,4 +4,7 @@ char swUartRecv(void);
 char swUartHasRecved(void);
 char swUartCanXmit(void);
 void swUartDisable(void);
+void swUartDisableRx(void);
+void swUartEnableRx(void);
+void swUartFlush(void);
 void swUartEnable(void);
@@ -0,0 +1,232 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Byte source for the xsvf parser. Images can be stored packed (emu/xsvfpack.c
+makes them), which means less of them has to be read from the flash while
+playing, and bigger ones fit in a slot. Those get unpacked on the fly here;
+plain xsvf images are read as they are.
+
+A packed image starts with "XSVP", followed by a series of:
+0x00-0x7F: the next 1-128 bytes are literals.
+0x80-0x9F n: a run of ((c&0x1f)<<8|n)+1 0x00 bytes.
+0xA0-0xBF n: the same, but of 0xFF bytes.
+0xC0-0xFF n o2 o1 o0: ((c&0x3f)<<8|n)+1 bytes that are unpacked from offset o
+(counted from the first token on) again. Used for payloads that occur more
+than once. The tokens there can't be copies themselves.
+
+Positions (xsvfTell/xsvfSeek) count unpacked bytes from the start of the
+image, so the parser doesn't know the difference. The state at the last two
+positions asked for is kept: those are the start of the current record and
+the one before, which is where the parser usually goes back to to retry a
+record. Going back further means unpacking from the start again.
+
+unpackOpenStream() plugs in stream.c instead, which gets the xsvf over the
+UART.
+
+While the TAP waits in Run-Test/Idle, xsvf.c has unpackPrefetch() read the
+flash ahead of the parser, so the records after the wait don't have to.
+*/
+
+#include <avr/wdt.h>
+#include "io.h"
+#include "flash25cxx.h"
+#include "overclock.h"
+#include "arena.h"
+#include "unpack.h"
+#include "stream.h"
+
+#define MAGIC 0x58535650UL //'XSVP'
+
+#define T_LIT 0
+#define T_ZERO 1
+#define T_ONES 2
+
+typedef struct {
+	long pos; //unpacked position
+	long addr; //next byte to read from flash
+	long ret; //where to continue after a copy
+	unsigned int count; //bytes left in the token
+	unsigned int copyLeft; //bytes left in the copy, 0 if not copying
+	unsigned char type;
+} UnpackState;
+
+static UnpackState cur, marks[2];
+static unsigned char nextMark, packed, streaming;
+static long base, tokens;
+
+//Two cache lines in arena.play.cache: one for the tokens being played, one
+//for the ones a copy reads from, so a copy doesn't throw out the line we
+//return to. Outside of copies, the second one holds the line after the one
+//being played if unpackPrefetch() got to it. A byte is taken from whichever
+//line has it.
+static long cacheLine[2];
+
+static void fill(unsigned char l, long line) {
+	cacheLine[l]=line;
+	ioFlashEnable();
+	f25cxxReadBuff(line, arena.play.cache[l], CACHESIZE);
+	ioJtagEnable();
+}
+
+//Byte read handler for the flash. Reads CACHESIZE bytes at a time and will
+//return bytes from that cache.
+static unsigned char flashByte(long a) {
+	long line=a&~(CACHESIZE-1);
+	unsigned char l;
+	if (line==cacheLine[0]) {
+		l=0;
+	} else if (line==cacheLine[1]) {
+		l=1;
+	} else {
+		l=(cur.copyLeft!=0);
+		fill(l, line);
+	}
+	return arena.play.cache[l][a&(CACHESIZE-1)];
+}
+
+static void restart(void) {
+	cur.pos=base;
+	cur.addr=tokens;
+	cur.count=0;
+	cur.copyLeft=0;
+}
+
+//Get ready to play the image at addr.
+void unpackOpen(long addr) {
+	unsigned char i;
+	unsigned long magic=0;
+	cacheLine[0]=-1;
+	cacheLine[1]=-1;
+	cur.copyLeft=0;
+	streaming=0;
+	for (i=0; i<4; i++) magic=(magic<<8)|flashByte(addr+i);
+	packed=(magic==MAGIC);
+	base=addr;
+	tokens=addr+(packed?4:0);
+	marks[0].pos=-1;
+	marks[1].pos=-1;
+	restart();
+}
+
+static unsigned char getByte(void) {
+	unsigned char c, b;
+	unsigned int n;
+	long o;
+	if (!packed) return flashByte(cur.pos++);
+	while (cur.count==0) {
+		c=flashByte(cur.addr++);
+		if (c<0x80) {
+			cur.type=T_LIT;
+			cur.count=c+1;
+		} else if (c<0xC0) {
+			cur.type=(c&0x20)?T_ONES:T_ZERO;
+			cur.count=(((c&0x1f)<<8)|flashByte(cur.addr++))+1;
+		} else {
+			n=(((c&0x3f)<<8)|flashByte(cur.addr++))+1;
+			o=(long)flashByte(cur.addr++)<<16;
+			o|=(unsigned int)flashByte(cur.addr++)<<8;
+			o|=flashByte(cur.addr++);
+			cur.copyLeft=n;
+			cur.ret=cur.addr;
+			cur.addr=tokens+o;
+		}
+	}
+	if (cur.type==T_LIT) {
+		b=flashByte(cur.addr++);
+	} else {
+		b=(cur.type==T_ONES)?0xff:0;
+	}
+	cur.count--;
+	cur.pos++;
+	if (cur.copyLeft && --cur.copyLeft==0) {
+		cur.addr=cur.ret;
+		cur.count=0;
+	}
+	return b;
+}
+
+//Get the line the parser reads next and the one after it into the cache,
+//if they aren't there yet. The flash clock is on TMS and TCK stays low
+//meanwhile, so the TAP doesn't notice. Not while a copy runs: its line
+//would be thrown out. Returns 0 if there was nothing to read.
+unsigned char unpackPrefetch(void) {
+	long line;
+	unsigned char l, n=0;
+	if (streaming || cur.copyLeft) return 0;
+	line=(packed?cur.addr:cur.pos)&~(CACHESIZE-1);
+	if (line==cacheLine[1]) {
+		l=1;
+	} else {
+		l=0;
+		if (line!=cacheLine[0]) {
+			fill(0, line);
+			n++;
+		}
+	}
+	line+=CACHESIZE;
+	if (line!=cacheLine[l^1]) {
+		fill(l^1, line);
+		n++;
+	}
+	return n;
+}
+
+//Play from the UART, until the next unpackOpen().
+void unpackOpenStream(void) {
+	streaming=1;
+}
+
+//Byte read handler for the XSVF parser.
+unsigned char xsvfGetByte(void) {
+	wdt_reset();
+	overclockStopwatchPoll();
+	if (streaming) return streamGetByte();
+	return getByte();
+}
+
+//Position handlers for the XSVF parser, so it can go back and re-execute
+//records.
+long xsvfTell(void) {
+	if (streaming) return streamTell();
+	marks[nextMark]=cur;
+	nextMark^=1;
+	return cur.pos;
+}
+
+void xsvfSeek(long pos) {
+	unsigned char i;
+	if (streaming) {
+		streamSeek(pos);
+		return;
+	}
+	if (!packed) {
+		cur.pos=pos;
+		return;
+	}
+	if (pos<cur.pos) restart();
+	for (i=0; i<2; i++) {
+		if (marks[i].pos<=pos && marks[i].pos>cur.pos) cur=marks[i];
+	}
+	while (cur.pos<pos) {
+		wdt_reset();
+		overclockStopwatchPoll();
+		getByte();
+	}
+}
@@ -0,0 +1,6 @@
+void unpackOpen(long addr);
+void unpackOpenStream(void);
+unsigned char unpackPrefetch(void);
+unsigned char xsvfGetByte(void);
+long xsvfTell(void);
+void xsvfSeek(long pos);
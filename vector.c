@@ -0,0 +1,158 @@
+/*
+Firmware for an ATTiny85 to be able to receive and execute xsvf files
+to a JTAG-enabled device.
+(C) 2012 Jeroen Domburg (jeroen AT spritesmods.com)
+
+This program is free software: you can redistribute it and/or modify
+t under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Player for pin vector images, which emu/xsvfvec.c compiles from an xsvf.
+Everything the xsvf parser works out while playing (the TAP state routing,
+the bit order, the chain padding, when to raise TMS) is done by the compiler
+already. What's left is a list of TMS/TDI values to clock out, so every TCK
+takes the same few instructions. A vector image is about four times the size
+of the xsvf though, so this is meant for small images where timing matters.
+
+The image starts with "XSVV". Every byte after that holds two vectors, low
+nibble first, with the bits where they are in PORTB:
+bit 0: expected TDO (PB0)
+bit 1: TDI (PB1)
+bit 2: TMS (PB2)
+bit 3: compare TDO to bit 0
+A nibble of 0x1, an expected TDO without a compare, isn't a vector. In the
+high nibble it just gets skipped; in the low nibble, the byte is a command:
+0x01: end of the image.
+0x11 nH nL: n TCKs with TMS and TDI low, 1ms each (XRUNTEST).
+0x21: fail if a compare since the last 0x21 didn't match.
+0x31 nH nL v: the vector in the low nibble of v, n times. Saves flash reads
+for the long runs of zeroes and ones in bitstreams.
+*/
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+#include "io.h"
+#include "flash25cxx.h"
+#include "overclock.h"
+#include "debug.h"
+#include "arena.h"
+#include "vector.h"
+
+#define MAGIC 0x58535656UL //'XSVV'
+
+#define VEC_SKIP 0x1
+#define VEC_END 0x01
+#define VEC_WAIT 0x11
+#define VEC_CHECK 0x21
+#define VEC_REPEAT 0x31
+
+#define VEC_CMP (1<<3)
+#define VEC_PINS ((1<<JTAG_TMS)|(1<<JTAG_TDI))
+
+static long start, addr;
+static unsigned char pos; //next byte in the chunk; wraps to 0 when it's used up
+
+//Put out TMS and TDI, pulse TCK and remember a TDO mismatch if it gets
+//compared. The flash stays deselected. slow is the TCK delay of speed.c.
+#define CLOCK(v) do { \
+	o=((v)&VEC_PINS)|(1<<F25CXX_S); \
+	PORTB=o; \
+	if (slow) ioJtagWait(); \
+	PORTB=o|(1<<JTAG_TCK); \
+	if (slow) ioJtagWait(); \
+	in=PINB; \
+	PORTB=o; \
+	if ((v)&VEC_CMP) err|=(in^(v))&(1<<JTAG_TDO); \
+} while (0)
+
+static unsigned char nextByte(void) {
+	if (pos==0) {
+		wdt_reset();
+		overclockStopwatchPoll();
+		ioFlashEnable();
+		f25cxxReadBuff(addr, arena.vector.chunk, VECTOR_CHUNK);
+		ioJtagEnable();
+		addr+=VECTOR_CHUNK;
+	}
+	return arena.vector.chunk[pos++];
+}
+
+//Returns 1 if the image at addr is a vector image, and gets ready to play it.
+unsigned char vectorOpen(long a) {
+	unsigned char i, buff[4];
+	unsigned long magic=0;
+	ioFlashEnable();
+	f25cxxReadBuff(a, buff, 4);
+	ioJtagEnable();
+	for (i=0; i<4; i++) magic=(magic<<8)|buff[i];
+	start=a+4;
+	return (magic==MAGIC);
+}
+
+//Plays the vectors. Returns 1 if all compares matched.
+unsigned char vectorRun(void) {
+	unsigned char b, o, in, err=0, slow=ioJtagGetDelay();
+	unsigned int n;
+	addr=start;
+	pos=0;
+	dputs("Vectors start\n");
+	ioJtagEnable();
+	while (1) {
+		b=nextByte();
+		if ((b&0x0f)==VEC_SKIP) {
+			if (b==VEC_END) {
+				dputs("Vectors done!\n");
+				return 1;
+			} else if (b==VEC_CHECK) {
+				if (err) {
+					dputs("Vectors: compare failed @");
+					dhex(addr-VECTOR_CHUNK+(unsigned char)(pos-1), 0);
+					dputc('\n');
+					return 0;
+				}
+			} else if (b==VEC_WAIT) {
+				n=nextByte()<<8;
+				n|=nextByte();
+				while (n--) {
+					wdt_reset();
+					overclockStopwatchPoll();
+					CLOCK(0);
+					_delay_ms(1);
+				}
+			} else if (b==VEC_REPEAT) {
+				n=nextByte()<<8;
+				n|=nextByte();
+				b=nextByte();
+				//At a slow TCK, this can take longer than the watchdog.
+				while (n--) {
+					if (!(n&0xff)) {
+						wdt_reset();
+						overclockStopwatchPoll();
+					}
+					CLOCK(b);
+				}
+			} else {
+				dputs("Vectors: invalid command ");
+				dhex(b, 2);
+				dputc('\n');
+				return 0;
+			}
+			continue;
+		}
+		CLOCK(b);
+		b>>=4;
+		if (b!=VEC_SKIP) CLOCK(b);
+	}
+}
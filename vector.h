@@ -0,0 +1,2 @@
+unsigned char vectorOpen(long addr);
+unsigned char vectorRun(void);
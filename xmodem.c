@@ -20,9 +20,33 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 /*
 Xmodem handler. This will receive data over the software UART and write it
-into the flash chip. As a hack, you can also press 'l' and the code
+into a slot of the flash chip. As a hack, you can also press 'l' and the code
 will emit whatever message was printf()'ed during the last few jtag upload
-tries.
+tries. Before the upload starts, a few more keys manage the image slots:
+'s' lists them, a digit selects the slot the upload goes to and 'b' makes
+the selected slot the boot slot and reboots into it. 'r' sends the image in
+the selected slot back and 'f' the whole flash, both using xmodem. 'p' starts
+the boundary scan sampler and 'x' plays an xsvf streamed over the serial
+port without storing it, see stream.c. 'j' hands the JTAG pins to the host,
+see bridge.c. 'z' means the upload is compressed, see lz.c.
+
+Xmodem waits for an ACK after every block, so the line sits idle for the
+flash write and the turnaround of the host. Instead of the first block, the
+host can answer the NAK with a SYN to do a windowed upload. After erasing the
+slot, we answer with a SYN and the window size: the number of frames we have
+room for. The host then sends up to that many frames in one go:
+0x12 seq data[WINDOW_BLOCK] crcH crcL
+with the xmodem CRC16 over seq and data. A frame that comes in order gets
+programmed right away, while the next one is being received. When the last
+frame of the window is in or the host pauses, we answer with
+ACK next bitmap
+where next is the sequence number of the first frame still missing and bit n
+of the bitmap is set if frame next+1+n is already here. The host sends the
+next window from there on, skipping the frames that are here already. The
+upload ends with
+EOT frames
+as the first thing after an ACK, with the number of frames modulo 256. That
+way a 0x04 in the data of a frame we lost track of can't end it early.
 */
 
 #include <stdio.h>
@@ -33,12 +57,22 @@ tries.
 #include "debug.h"
 #include "io.h"
 #include "xmodem.h"
+#include "image.h"
+#include "lz.h"
+#include "arena.h"
 #include <util/delay.h>
+#include <util/crc16.h>
 
 #define SOH 0x01
+#define STX 0x02
 #define ACK 0x06
 #define NAK 0x15
 #define EOT 0x04
+#define CAN 0x18
+#define SYN 0x16
+#define WBLK 0x12
+
+#define WIN_GAP 50 //getcharTimed() ticks without a byte that end a burst of frames
 
 static int xmodemTimer;
 #define MAXTIME 30000
@@ -55,12 +89,228 @@ char getcharTimed() {
 	return getchar()&0xff;
 }
 
-void xmodemWriteFlash() {
+//Send len bytes of flash from addr on. If the receiver asks for CRCs ('C'),
+//this uses xmodem-1K, else plain xmodem with 128-byte blocks and checksums.
+//Blocks get streamed straight from flash: the next byte is read while the
+//UART is still shifting out the previous one, so there's no need for a block
+//buffer and the line doesn't idle within a block. On a NAK, the block just gets
+//read again. The last block is padded with whatever comes after the range.
+static void xmodemSend(long addr, long len) {
+	unsigned char block=1, tries=0, b;
+	unsigned int crc, n, x;
+	char useCrc;
+	int y;
+
+	//Wait for the receiver to start.
+	do {
+		xmodemTimer=0;
+		y=getcharTimed();
+		if (++tries==20) return;
+	} while (y!='C' && y!=NAK);
+	useCrc=(y=='C');
+	n=useCrc?1024:128;
+
+	tries=0;
+	while (len>0) {
+		wdt_reset();
+		ioFlashEnableTx();
+		f25cxxReadStart(addr);
+		swUartXmit(useCrc?STX:SOH);
+		swUartXmit(block);
+		swUartXmit(~block);
+		crc=0;
+		for (x=0; x<n; x++) {
+			b=f25cxxReadNext();
+			if (useCrc) crc=_crc_xmodem_update(crc, b); else crc+=b;
+			swUartXmit(b);
+		}
+		f25cxxReadEnd();
+		swUartEnableRx(); //the answer may start right after the last byte
+		if (useCrc) swUartXmit(crc>>8);
+		swUartXmit(crc);
+		swUartFlush();
+		ioUartEnable();
+
+		xmodemTimer=0;
+		y=getcharTimed();
+		if (y==ACK) {
+			addr+=n;
+			len-=n;
+			block++;
+			tries=0;
+		} else if (y==CAN || ++tries==10) {
+			return;
+		}
+	}
+	for (tries=0; tries<10; tries++) {
+		putchar(EOT);
+		xmodemTimer=0;
+		if (getcharTimed()==ACK) break;
+	}
+}
+
+//Upload complete: write the header and make this the boot slot, so the
+//image will be played at boot. addr is where the image ends and crc its CRC
+//so far, for an upload that isn't compressed.
+static void finishUpload(char slot, char lz, long addr, unsigned long crc) {
+	unsigned long len;
+	ioFlashEnable();
+	if (lz) {
+		len=lzEnd();
+		crc=lzCrc();
+	} else {
+		len=addr-IMAGE_DATA(slot);
+		crc=imageCrc32Final(crc);
+	}
+	//A compressed stream that got cut off has no length; leave the slot
+	//empty then.
+	if (len) imageWriteHeader(slot, len, crc);
+	ioUartEnable();
+	if (len) imageSetBootSlot(slot);
+}
+
+static unsigned char winSize, winNext, winFilled, crcLeft;
+static unsigned char *crcData;
+static long winAddr, winEnd;
+static unsigned long winCrc;
+
+//The image CRC of a frame that got programmed while receiving is done a
+//byte at a time while waiting for the next bytes.
+static void winCrcStep(void) {
+	winCrc=imageCrc32Update(winCrc, *crcData++);
+	crcLeft--;
+}
+
+static unsigned char winGetchar(void) {
+	if (crcLeft) winCrcStep();
+	xmodemTimer=MAXTIME-WIN_GAP;
+	return getcharTimed();
+}
+
+//Write frame winNext to flash and move the window on. Returns 0 if it doesn't
+//fit. With wait=0 the page program only gets started and the CRC is left to
+//winGetchar(), so it's done before the next byte comes in; the flash has to
+//be idle then and may not be read from until it is again.
+static char winStore(char lz, char wait) {
+	unsigned char x, *frame=arena.window.frame[winNext&(winSize-1)];
+	while (crcLeft) winCrcStep();
+	if (lz) {
+		for (x=0; x<WINDOW_BLOCK; x++) {
+			if (!lzFeed(frame[x])) return 0;
+		}
+	} else {
+		if (winAddr>=winEnd) return 0;
+		f25cxxPageProgramStart(winAddr);
+		for (x=0; x<WINDOW_BLOCK; x++) f25cxxPageProgramWrite(frame[x]);
+		crcData=frame;
+		crcLeft=WINDOW_BLOCK;
+		if (wait) {
+			f25cxxPageProgramEnd();
+			while (crcLeft) winCrcStep();
+		} else {
+			f25cxxPageProgramCommit();
+		}
+		winAddr+=WINDOW_BLOCK;
+	}
+	winFilled&=~(1<<(winNext&(winSize-1)));
+	winNext++;
+	return 1;
+}
+
+//Windowed upload, see the top of this file.
+static char windowWriteFlash(char slot, char lz) {
+	unsigned char seq, last, bit, x, b, tries=0, *frame;
+	unsigned int crc;
+	char ok=1, end;
+	int y;
+
+	//Compressed uploads need arena.upload.lz, so they get a smaller window.
+	winSize=lz?WINDOW_FRAMES_LZ:WINDOW_FRAMES;
+	winNext=0;
+	winFilled=0;
+	crcLeft=0;
+	winAddr=IMAGE_DATA(slot);
+	winEnd=IMAGE_BASE(slot+1);
+	winCrc=imageCrc32Init();
+	ioFlashEnable();
+	imageErase(slot);
+	lzStart(winAddr, winEnd);
+	ioUartEnable();
+	putchar(SYN);
+	putchar(winSize);
+
+	while (ok) {
+		//Receive a burst of frames.
+		last=winNext+winSize-1;
+		ioFlashEnableRx();
+		xmodemTimer=0;
+		y=getcharTimed();
+		end=(y==EOT && (unsigned char)getcharTimed()==winNext);
+		while (xmodemTimer<MAXTIME && !end) {
+			if (y==WBLK) {
+				tries=0;
+				seq=winGetchar();
+				bit=1<<(seq&(winSize-1));
+				//Only keep frames that are in the window and not here yet.
+				frame=NULL;
+				if ((unsigned char)(seq-winNext)<winSize && !(winFilled&bit)) frame=arena.window.frame[seq&(winSize-1)];
+				crc=_crc_xmodem_update(0, seq);
+				for (x=0; x<WINDOW_BLOCK; x++) {
+					b=winGetchar();
+					if (frame) frame[x]=b;
+					crc=_crc_xmodem_update(crc, b);
+				}
+				crc^=winGetchar()<<8;
+				crc^=winGetchar();
+				if (crc==0 && frame && xmodemTimer<MAXTIME) {
+					winFilled|=bit;
+					//Program at most one frame per frame received: that's
+					//the time it takes the flash to finish the last one.
+					//Frames that need an erase first wait for the end of
+					//the burst.
+					if (!lz && (winFilled&(1<<(winNext&(winSize-1)))) && !f25cxxEraseDue(winAddr)) ok=winStore(0, 0);
+				}
+				if (seq==last || !ok) break;
+			}
+			y=winGetchar();
+		}
+
+		//Write what can be written and tell the host where we are.
+		ioFlashEnable();
+		f25cxxWaitReady();
+		while (ok && (winFilled&(1<<(winNext&(winSize-1))))) ok=winStore(lz, 1);
+		while (crcLeft) winCrcStep();
+		ioUartEnable();
+		if (!ok) break;
+		if (end) {
+			finishUpload(slot, lz, winAddr, winCrc);
+			putchar(ACK);
+			return XMODEM_DONE;
+		}
+		if (xmodemTimer>=MAXTIME && ++tries==10) return XMODEM_DONE;
+		b=0;
+		for (x=1; x<winSize; x++) {
+			if (winFilled&(1<<((winNext+x)&(winSize-1)))) b|=1<<(x-1);
+		}
+		putchar(ACK);
+		putchar(winNext);
+		putchar(b);
+	}
+	//Doesn't fit or bad compressed data. The header never gets written, so
+	//the slot stays empty.
+	putchar(CAN);
+	return XMODEM_DONE;
+}
+
+char xmodemWriteFlash() {
 	unsigned char block, invBlock, oldBlock=0;
-	char data[128], byte, chsum;
+	unsigned char *data=arena.upload.block;
+	char byte, chsum;
 	int x, y;
-	char first=1;
+	char first=1, slot=imageBootSlot(), lz=0;
 	long addr=0;
+	unsigned long len;
+	unsigned long crc=imageCrc32Init();
 
 	ioFlashEnable();
 	ioUartEnable();
@@ -72,15 +322,57 @@ void xmodemWriteFlash() {
 			y=getcharTimed();
 			if (xmodemTimer==MAXTIME) putchar(NAK); //timeout
 			if (y=='l') { //Debug: press 'l' to read out the log.
-				dprintf("----LOG----\r\n");
+				dputs("----LOG----\r\n");
 				stdoutDumpEepromLog();
-				dprintf("----END----\r\n");
+				dputs("----END----\r\n");
+			}
+			if (first && y=='s') {
+				for (x=0; x<IMAGE_SLOTS; x++) {
+					len=imageLength(x);
+					ioUartEnable();
+					dputc((x==slot)?'*':' ');
+					ddec(x);
+					dputs(": ");
+					ddec(len);
+					dputs(" bytes\r\n");
+				}
+			}
+			if (first && y>='0' && y<'0'+IMAGE_SLOTS) {
+				slot=y-'0';
+				dputs("Slot ");
+				ddec(slot);
+				dputs("\r\n");
+			}
+			if (first && y=='r') {
+				len=imageLength(slot);
+				ioUartEnable();
+				xmodemSend(IMAGE_DATA(slot), len);
+			}
+			if (first && y=='f') {
+				xmodemSend(0, f25cxxSize);
+			}
+			if (first && y=='p') return XMODEM_SAMPLE;
+			if (first && y=='x') return XMODEM_STREAM;
+			if (first && y=='j') return XMODEM_BRIDGE;
+			if (first && y=='z') {
+				lz=1;
+				dputs("Compressed\r\n");
+			}
+			if (first && y==SYN) return windowWriteFlash(slot, lz);
+			if (first && y=='b') {
+				//Reboot (main() waits for the watchdog) into the selected slot.
+				imageSetBootSlot(slot);
+				dputs("Booting slot ");
+				ddec(slot);
+				dputs("\r\n");
+				return XMODEM_DONE;
 			}
 		} while (y!=SOH && y!=EOT);
 		if (y==EOT) {
 			//All done.
+			if (!first) finishUpload(slot, lz, addr, crc);
 			putchar(ACK);
-			return;
+			return XMODEM_DONE;
 		}
 
 		//Start receiving an xmodem block.
@@ -97,25 +389,44 @@ void xmodemWriteFlash() {
 			chsum+=byte; //Update checksum
 		}
 		byte=getcharTimed(); //checksum should be this.
-		if (byte==chsum && block==invBlock^0xff && block==((oldBlock+1)&255) && xmodemTimer<MAXTIME) {
+		if (byte==chsum && block==(invBlock^0xff) && block==((oldBlock+1)&255) && xmodemTimer<MAXTIME) {
 			//Block seems OK. Commit to flash.
-			//If this is the first sector, also erase the chip.
+			//If this is the first block, also erase the slot.
 			ioFlashEnable();
 			if (first) {
-				f25cxxEraseChip();
+				imageErase(slot);
+				addr=IMAGE_DATA(slot);
+				lzStart(addr, IMAGE_BASE(slot+1));
 				first=0;
 			}
-			//Program the page
-			f25cxxPageProgramStart(addr);
-			for (x=0; x<128; x++) {
-				f25cxxPageProgramWrite(data[x]);
+			if (lz) {
+				for (x=0; x<128 && lzFeed(data[x]); x++) ;
+			} else if (addr<IMAGE_BASE(slot+1)) {
+				//Program the page
+				f25cxxPageProgramStart(addr);
+				for (x=0; x<128; x++) {
+					f25cxxPageProgramWrite(data[x]);
+					crc=imageCrc32Update(crc, data[x]);
+				}
+				f25cxxPageProgramEnd();
+			} else {
+				x=0;
+			}
+			if (x<128) {
+				//Doesn't fit or bad compressed data; don't overwrite the next
+				//slot. The header never gets written, so the slot stays empty.
+				ioUartEnable();
+				putchar(CAN);
+				return XMODEM_DONE;
 			}
-			f25cxxPageProgramEnd();
 			ioUartEnable();
 			//Yay, block is written!
 			putchar(ACK);
 			addr+=128;
 			oldBlock=block;
+		} else if (!first && byte==chsum && block==(invBlock^0xff) && block==oldBlock && xmodemTimer<MAXTIME) {
+			//The previous block again: our ACK got lost. It's written already.
+			putchar(ACK);
 		} else {
 			//Something went wron. Try again okplzthx.
 			putchar(NAK);
@@ -1 +1,7 @@
-void xmodemWriteFlash(void);
+//xmodemWriteFlash() return values
+#define XMODEM_DONE		0
+#define XMODEM_SAMPLE	1 //Host wants the boundary scan sampler, see sample.c
+#define XMODEM_STREAM	2 //Host wants to stream an xsvf, see stream.c
+#define XMODEM_BRIDGE	3 //Host wants to drive the JTAG pins, see bridge.c
+
+char xmodemWriteFlash(void);
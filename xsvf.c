@@ -23,13 +23,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //as references.
 
 #include "jtag.h"
-#include "debug.h" //for dprintf
+#include "debug.h" //for dputs
 #include "io.h"
+#include "overclock.h"
+#include "arena.h" //MAXTDOBYTES and MAXTDIBYTES are in there
 #include <util/delay.h>
 
 
-#define MAXTDOBYTES 128 //Bytes the AVR is able to shift out
-#define MAXTDIBYTES 8 //Bytes the AVR is able to check against clocked in bytes.
+#define CLEANRECORDS 64 //Records that need to go OK at a lower clock before going full speed again
 
 //xsvf instructions
 #define XCOMPLETE	0x00
@@ -55,14 +56,43 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define XCOMMENT	0x16
 #define XWAIT		0x17
 
+//Extensions to xsvf, not in XAPP503. These set the amount of header and trailer
+//padding bits for the other devices in the chain, like SVF's HIR/TIR/HDR/TDR do.
+//The argument is a 16-bit bitcount, msb first. IR padding is shifted as ones
+//(=BYPASS), DR padding as zeroes, so the image only has to carry the bits for
+//the device we're actually talking to.
+#define XHIR		0x20
+#define XTIR		0x21
+#define XHDR		0x22
+#define XTDR		0x23
+//Identity check, followed by a 32-bit msb-first length and that many bytes of
+//records. These should read something that tells whether the target already
+//runs this image, like an XSIR selecting USERCODE and an XSDRTDO with the
+//value the image sets it to. xsvfRun() skips the records; xsvfIdentify() runs
+//only them.
+#define XIDENT		0x24
+
 //This needs to be defined somewhere else. It should return 'the next' byte read
 //from the xsvf file.
 extern unsigned char xsvfGetByte(void);
+//These too. They return and set the position of the next byte xsvfGetByte
+//returns.
+extern long xsvfTell(void);
+extern void xsvfSeek(long pos);
+//And one to read ahead while waiting in Run-Test/Idle; returns 0 if it
+//had nothing to do.
+extern unsigned char unpackPrefetch(void);
 
 static unsigned char *tdiData;
 static unsigned char *tdoExpected;
+//XSDRB and XSDRC shift all but their last bit; the next record shifts that
+//first. See xsvfPark().
+static unsigned char pending, pendingBit;
 static unsigned char *tdoMask;
 static unsigned long sdrsize;
+static unsigned int hir, tir, hdr, tdr;
+//Set while running an identity check: a mismatch there isn't an error.
+static char identifying;
 
 static unsigned long getLong(void) {
 	int x;
@@ -90,7 +120,8 @@ static char shiftBits(int noBits, char checkTdo, char checkTdoMask, char endrais
 	bpos=0;
 	while (left>0) {
 		bitcount=(left>8)?8:left;
-		in=jtagShift(tdiData[bpos], (left<8)?left:8, ((left<=8) && endraisetms));
+		if (left>8 || (left==8 && !endraisetms)) in=jtagShiftByte(tdiData[bpos]);
+		else in=jtagShift(tdiData[bpos], bitcount, endraisetms);
 		if (bpos<MAXTDIBYTES) {
 			tdiData[bpos]=in; //for display if fail
 			if (checkTdo && bpos<MAXTDIBYTES) {
@@ -105,12 +136,20 @@ static char shiftBits(int noBits, char checkTdo, char checkTdoMask, char endrais
 		left-=8;
 		bpos++;
 	}
-	if (!ret) {
-		dprintf("Shift fail. Expected: ");
-		for (x=0; x<((noBits+7)>>3); x++) dprintf("%02x ", tdoExpected[x]);
-		dprintf("got ");
-		for (x=0; x<((noBits+7)>>3); x++) dprintf("%02x ", tdiData[x]);
-		dprintf("\n");
+	if (!ret && !identifying) {
+		//Only the first MAXTDIBYTES got checked and kept.
+		if (bpos>MAXTDIBYTES) bpos=MAXTDIBYTES;
+		dputs("Shift fail. Expected: ");
+		for (x=0; x<bpos; x++) {
+			dhex(tdoExpected[x], 2);
+			dputc(' ');
+		}
+		dputs("got ");
+		for (x=0; x<bpos; x++) {
+			dhex(tdiData[x], 2);
+			dputc(' ');
+		}
+		dputc('\n');
 	}
 	return ret;
 }
@@ -142,107 +181,258 @@ static void readBuffer(unsigned char *dest, int bits) {
 	}
 }
 
-unsigned char xsvfRun(void) {
+//Runs the xsvf from the current position on. If identEnd is non-zero, we're
+//running an identity check; it's done when we get there.
+static unsigned char run(long identEnd) {
 	const int doExplain=0;
-	int x=0, len=0;
+	int len=0;
 	unsigned char ins;
 	unsigned long runtestcycles=0;
 	unsigned char endirstate=1, enddrstate=1;
-	unsigned char localdata1[MAXTDOBYTES];
-	unsigned char localdata2[MAXTDIBYTES*2];
+	long insPos, sirPos=-1, retryPos=-1, skip;
+	char fullSpeed=overclockGetState(); //the clock speed.c picked
+	unsigned char clean=0;
+	char ok;
+	//What the last XSIR ran with, and what we were at when a record failed,
+	//see below.
+	unsigned long sirRuntest=0, keepRuntest=0;
+	unsigned char sirEndir=1, keepEndir=1;
+	unsigned int sirHir=0, sirTir=0, keepHir=0, keepTir=0;
 	sdrsize=32;
+	hir=0; tir=0; hdr=0; tdr=0;
+	pending=0;
+	identifying=(identEnd!=0);
 
-	tdiData=&localdata1[0];
-	tdoExpected=&localdata2[0];
-	tdoMask=&localdata2[MAXTDIBYTES];
+	tdiData=arena.play.tdi;
+	tdoExpected=arena.play.tdo;
+	tdoMask=arena.play.mask;
 
-	dprintf("Xsvf parse start\n");
+	if (!identEnd) dputs("Xsvf parse start\n");
 	jtagReset();
 	while(1) {
+		insPos=xsvfTell();
+		if (identEnd && insPos>=identEnd) return 1;
 		ins=xsvfGetByte();
-		if (doExplain) dprintf("Xsvf: %x ", (int)ins);
+		ok=1;
+		if (doExplain) {
+			dputs("Xsvf: ");
+			dhex(ins, 2);
+			dputc(' ');
+		}
 		if (ins==XTDOMASK) {
-			if (doExplain) dprintf("XTDOMASK\n");
+			if (doExplain) dputs("XTDOMASK\n");
 			readBuffer(tdoMask, sdrsize);
 		} else if (ins==XREPEAT) {
-			if (doExplain) dprintf("XREPEAT\n");
+			if (doExplain) dputs("XREPEAT\n");
 			xsvfGetByte(); //Unimplemented.
 		} else if (ins==XRUNTEST) {
-			if (doExplain) dprintf("XRUNTEST\n");
+			if (doExplain) dputs("XRUNTEST\n");
 			runtestcycles=getLong();
 		} else if (ins==XSIR || ins==XSIR2) {
-			if (doExplain) dprintf("XSIR[2]\n");
+			if (doExplain) dputs("XSIR[2]\n");
+			sirPos=insPos;
+			sirRuntest=runtestcycles;
+			sirEndir=endirstate;
+			sirHir=hir;
+			sirTir=tir;
 			len=xsvfGetByte();
 			if (ins==XSIR2) len|=(xsvfGetByte()<<8);
 			readBuffer(tdiData, len);
 			jtagGotoState(JTAG_SHIFTIR);
-			shiftBits(len, 0, 0, 1);
+			jtagShiftPad(hir, 1, 0);
+			shiftBits(len, 0, 0, (tir==0));
+			jtagShiftPad(tir, 1, 1);
 		} else if (ins==XSDR || ins==XSDRTDO) {
-			if (doExplain) dprintf("XSDR[TDO]\n");
-			jtagGotoState(JTAG_SHIFTDR);
+			if (doExplain) dputs("XSDR[TDO]\n");
 			readBuffer(tdiData, sdrsize);
 			if (ins==XSDRTDO) readBuffer(tdoExpected, sdrsize);
-			if (!shiftBits(sdrsize, 1, 1, 1)) return 0;
+			jtagGotoState(JTAG_SHIFTDR);
+			jtagShiftPad(hdr, 0, 0);
+			ok=shiftBits(sdrsize, 1, 1, (tdr==0));
+			if (ok) jtagShiftPad(tdr, 0, 1);
 		} else if (ins==XSDRSIZE) {
-			if (doExplain) dprintf("XSDRSIZE\n");
+			if (doExplain) dputs("XSDRSIZE\n");
 			sdrsize=getLong();
 			if (sdrsize>(MAXTDOBYTES*8)) {
-				dprintf("Can't handle xsvf! Requested sdrsize: %i bits, can handle %i! Increase MAXTDOBYTES plz.\n", sdrsize, MAXTDOBYTES*8);
-				return 1; //not 0 because sw will retry then.
+				dputs("Can't handle xsvf! Requested sdrsize: ");
+				ddec(sdrsize);
+				dputs(" bits, can handle ");
+				ddec(MAXTDOBYTES*8);
+				dputs("! Increase MAXTDOBYTES plz.\n");
+				//Not 0 because sw will retry then. An identity check just doesn't match.
+				return (identEnd==0);
+			}
+			if (doExplain) {
+				dputs("sdrsize=");
+				ddec(sdrsize);
+				dputc('\n');
 			}
-			if (doExplain) dprintf("sdrsize=%li\n", sdrsize);
 		} else if (ins==XRUNTEST) {
-			if (doExplain) dprintf("XRUNTEST\n");
+			if (doExplain) dputs("XRUNTEST\n");
 			runtestcycles=getLong();
 		} else if (ins==XSDRB || ins==XSDRC || ins==XSDRE) {
 			//OPTIMIZE HERE! This is where an average FPGA upload
 			//will spend most of its time.
-			if (doExplain) dprintf("XSDR[BCE]\n");
-			if (ins==XSDRB) jtagGotoState(JTAG_SHIFTDR);
+			if (doExplain) dputs("XSDR[BCE]\n");
 			readBuffer(tdiData, sdrsize);
-//			shiftBits(sdrsize, 0, 0, (ins==XSDRE)); //slow variant
-			shiftOutBitsQuick(sdrsize, (ins==XSDRE)); //quick variant
-			if (ins==XSDRE) jtagGotoState(enddrstate);
+			//XSDRC and XSDRE continue in Shift-DR, or go back there if
+			//xsvfPark() had to leave it.
+			jtagGotoState(JTAG_SHIFTDR);
+			if (pending) jtagShift(pendingBit, 1, 0);
+			pending=0;
+			if (ins==XSDRB) jtagShiftPad(hdr, 0, 0);
+			if (ins==XSDRE) {
+//				shiftBits(sdrsize, 0, 0, (tdr==0)); //slow variant
+				shiftOutBitsQuick(sdrsize, (tdr==0)); //quick variant
+				jtagShiftPad(tdr, 0, 1);
+				jtagGotoState(enddrstate);
+			} else {
+				//Hold back the last bit, see xsvfPark().
+				if (sdrsize>1) shiftOutBitsQuick(sdrsize-1, 0);
+				pendingBit=tdiData[(sdrsize-1)>>3]>>((sdrsize-1)&7);
+				pending=1;
+			}
 		} else if (ins==XSDRTDOB || ins==XSDRTDOC || ins==XSDRTDOE) {
-			if (doExplain) dprintf("XSDRTDO[BCE]\n");
-			if (ins==XSDRTDOB) jtagGotoState(JTAG_SHIFTDR);
+			if (doExplain) dputs("XSDRTDO[BCE]\n");
 			readBuffer(tdiData, sdrsize);
 			readBuffer(tdoExpected, sdrsize);
-			if (!shiftBits(sdrsize, 1, 0, ins!=XSDRTDOE)) return 0;
-			if (ins==XSDRTDOE) {
+			if (ins==XSDRTDOB) jtagGotoState(JTAG_SHIFTDR);
+			if (ins==XSDRTDOB) jtagShiftPad(hdr, 0, 0);
+			ok=shiftBits(sdrsize, 1, 0, (ins==XSDRTDOE && tdr==0));
+			if (ok && ins==XSDRTDOE) {
+				jtagShiftPad(tdr, 0, 1);
 				jtagGotoState(enddrstate);
 			}
 		} else if (ins==XCOMPLETE) {
-			dprintf("Xsvf done!\n");
+			dputs("Xsvf done!\n");
 			return 1;
 		} else if (ins==XSTATE) {
-			if (doExplain) dprintf("XSTATE\n");
+			if (doExplain) dputs("XSTATE\n");
 			jtagGotoState(xsvfGetByte());
 		} else if (ins==XENDIR) {
 			if (xsvfGetByte()) endirstate=JTAG_PAUSEIR; else endirstate=JTAG_RUNTEST;
 		} else if (ins==XENDDR) {
-			if (xsvfGetByte()) endirstate=JTAG_PAUSEDR; else endirstate=JTAG_RUNTEST;
+			if (xsvfGetByte()) enddrstate=JTAG_PAUSEDR; else enddrstate=JTAG_RUNTEST;
+		} else if (ins==XHIR || ins==XTIR || ins==XHDR || ins==XTDR) {
+			if (doExplain) dputs("X[HT][ID]R\n");
+			len=xsvfGetByte()<<8;
+			len|=xsvfGetByte();
+			if (ins==XHIR) hir=len;
+			if (ins==XTIR) tir=len;
+			if (ins==XHDR) hdr=len;
+			if (ins==XTDR) tdr=len;
+		} else if (ins==XIDENT) {
+			if (doExplain) dputs("XIDENT\n");
+			skip=getLong();
+			xsvfSeek(xsvfTell()+skip);
 		} else {
-			dprintf("Xsvf: Invalid instruction %x\n", (int)ins);
+			dputs("Xsvf: Invalid instruction ");
+			dhex(ins, 2);
+			dputc('\n');
 			return 0;
 		}
 
-		//Finish XSIR and XSDR command
-		if (ins==XSIR || x==XSIR2 || ins==XSDR) {
+		//A TDO compare failed. If we're overclocked, that may be because of
+		//the speed: drop the clock and re-do the XSIR before the record, with
+		//the padding, end state and wait it had then, and the record itself.
+		//What's in between stays done. That only works for a record that
+		//does a whole scan: XSDRTDOC/E continue one, and leaving Shift-DR
+		//for the XSIR ends it. A failing XSDRTDO[BCE] fails the run; main()
+		//retries that at a slower TCK.
+		//An identity check that doesn't match means the target isn't
+		//configured, not that it needs a slower clock.
+		if (!ok) {
+			if (identEnd || overclockGetState()==OVERCLOCK_STD) return 0;
+			if (ins!=XSDR && ins!=XSDRTDO) return 0;
+			dputs("Slow @");
+			dhex(insPos, 0);
+			dputc('\n');
+			overclockCpu(OVERCLOCK_STD);
+			clean=0;
+			if (sirPos>=0) {
+				keepRuntest=runtestcycles;
+				keepEndir=endirstate;
+				keepHir=hir;
+				keepTir=tir;
+				runtestcycles=sirRuntest;
+				endirstate=sirEndir;
+				hir=sirHir;
+				tir=sirTir;
+				retryPos=insPos;
+				xsvfSeek(sirPos);
+			} else {
+				xsvfSeek(insPos);
+			}
+			continue;
+		}
+		//Go back to full speed after enough records went OK.
+		if (overclockGetState()!=fullSpeed) {
+			if (++clean>=CLEANRECORDS) overclockCpu(fullSpeed);
+		}
+
+		//Finish XSIR, XSDR and XSDRTDO command
+		if (ins==XSIR || ins==XSIR2 || ins==XSDR || ins==XSDRTDO) {
 			if (runtestcycles!=0) {
 				long w;
 				jtagGotoState(JTAG_RUNTEST);
 				for (w=0; w<runtestcycles; w++) {
+					overclockStopwatchPoll();
 					jtagShift(0, 1, 0);
+					//We wait a ms for every us XRUNTEST asks for, so reading
+					//ahead in the flash can come out of the first one.
+					if (w==0 && unpackPrefetch()) continue;
 					_delay_ms(1);
 				}
 			} else {
-				jtagGotoState((ins==XSIR)?endirstate:enddrstate);
+				jtagGotoState((ins==XSIR || ins==XSIR2)?endirstate:enddrstate);
 			}
 		}
+
+		//The XSIR before a failed record got re-done: now the record itself,
+		//with what was set up for it.
+		if (retryPos>=0) {
+			runtestcycles=keepRuntest;
+			endirstate=keepEndir;
+			hir=keepHir;
+			tir=keepTir;
+			xsvfSeek(retryPos);
+			retryPos=-1;
+		}
 	}
 }
 
+//Byte sources that need the pins for something else, like the UART in
+//stream.c, call this first. It leaves the TAP in a state it stays in while
+//TCK toggles: Run-Test/Idle, a Pause state, or Test-Logic-Reset (TMS stays
+//high there). That's why XSDRB and XSDRC hold back their last bit: it gets
+//shifted here with TMS high to go to Pause-DR instead, and the next record
+//goes back to Shift-DR. Returns 0 if the TAP can't be parked without
+//shifting an extra bit, which is the case between XSDRTDOB/C and the next
+//record.
+unsigned char xsvfPark(void) {
+	unsigned char s;
+	if (pending) jtagShift(pendingBit, 1, 1);
+	pending=0;
+	s=jtagGetState();
+	if (s==JTAG_EXIT1DR) jtagGotoState(JTAG_PAUSEDR);
+	if (s==JTAG_EXIT1IR) jtagGotoState(JTAG_PAUSEIR);
+	return (s!=JTAG_SHIFTDR && s!=JTAG_SHIFTIR);
+}
 
+unsigned char xsvfRun(void) {
+	return run(0);
+}
 
-
+//Runs the identity check if the xsvf starts with one. Returns 1 if the target
+//matched it, meaning it already runs this image. An empty one checks nothing,
+//so nothing matches.
+unsigned char xsvfIdentify(void) {
+	long start=xsvfTell();
+	if (xsvfGetByte()!=XIDENT) {
+		xsvfSeek(start);
+		return 0;
+	}
+	start=getLong();
+	if (start==0) return 0;
+	return run(xsvfTell()+start);
+}
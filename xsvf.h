@@ -1,2 +1,4 @@
 
 unsigned char xsvfRun(void);
+unsigned char xsvfIdentify(void);
+unsigned char xsvfPark(void);